@@ -0,0 +1 @@
+#include "aot_module.hpp"
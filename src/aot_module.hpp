@@ -0,0 +1,115 @@
+#ifndef MERCURY_AOT_MODULE_HPP
+#define MERCURY_AOT_MODULE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#include "instruction_formats.hpp"
+#include "memory.hpp"
+#include "registers.hpp"
+
+// What code translated ahead of time by mercury-aot is built against, and
+// how CPU::attach() runs it.
+namespace mercury::aot {
+
+// The guest state translated code works on, copied in from the CPU and back
+// out around each call.
+struct State {
+    Registers registers;
+    Register hi;
+    Register lo;
+    Register pc;
+    Memory* memory;
+
+    // Where the last store that hit a page of code went. Translated code
+    // returns right after such a store, so that the CPU can tell whether
+    // the translation is still valid.
+    Address code_store;
+    bool stored_to_code;
+};
+
+// Run translated blocks from `state.pc`, until an instruction that was not
+// translated, a block that does not fit in `max_steps` or that contains
+// `breakpoint`, or an instruction that would trap. `state.pc` is then left
+// on the first instruction not executed. Returns how many were.
+using Entry =
+    std::size_t (*)(State& state, std::size_t max_steps, Register breakpoint);
+
+// A program translated by mercury-aot. Generated files define one as
+//
+//     extern mercury::aot::Module const name;
+//
+// which must only be attached to CPUs running that same program.
+struct Module {
+    // What was translated, and the instructions it was translated from.
+    AddressRange code;
+    RawInstruction const* instructions;
+    Entry run;
+};
+
+// Helpers for the instructions that are not a single C++ expression. They
+// behave exactly as the interpreter's handlers.
+
+// Whether the signed sum of `a` and `b` overflows. If not, it is stored in
+// `result`.
+inline bool add_overflows(Register a, Register b, Register& result)
+{
+    auto const sum = std::int64_t{static_cast<std::int32_t>(a)} +
+                     static_cast<std::int32_t>(b);
+
+    result = static_cast<Register>(sum);
+
+    return sum != static_cast<std::int32_t>(sum);
+}
+
+inline bool subtract_overflows(Register a, Register b, Register& result)
+{
+    auto const difference = std::int64_t{static_cast<std::int32_t>(a)} -
+                            static_cast<std::int32_t>(b);
+
+    result = static_cast<Register>(difference);
+
+    return difference != static_cast<std::int32_t>(difference);
+}
+
+// MULT and MULTU, which leave the upper word of the product in HI and the
+// lower one in LO.
+inline void multiply(State& state, Register a, Register b)
+{
+    auto const product = static_cast<std::uint64_t>(
+        std::int64_t{static_cast<std::int32_t>(a)} *
+        static_cast<std::int32_t>(b));
+
+    state.hi = static_cast<Register>(product >> 32);
+    state.lo = static_cast<Register>(product);
+}
+
+inline void multiply_unsigned(State& state, Register a, Register b)
+{
+    auto const product = std::uint64_t{a} * b;
+
+    state.hi = static_cast<Register>(product >> 32);
+    state.lo = static_cast<Register>(product);
+}
+
+// `b` must not be zero.
+inline void divide(State& state, Register a, Register b)
+{
+    auto const dividend = static_cast<std::int32_t>(a);
+    auto const divisor = static_cast<std::int32_t>(b);
+
+    if (dividend == std::numeric_limits<std::int32_t>::min() and
+        divisor == -1) {
+        state.lo = a;
+        state.hi = 0;
+        return;
+    }
+
+    state.lo = static_cast<Register>(dividend / divisor);
+    state.hi = static_cast<Register>(dividend % divisor);
+}
+
+}
+
+#endif
@@ -0,0 +1,507 @@
+#include "aot_translator.hpp"
+
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "decoder.hpp"
+#include "instruction_spec.hpp"
+#include "registers.hpp"
+#include "specializer.hpp"
+
+namespace mercury {
+
+namespace {
+
+// The instructions left to the interpreter, which keeps the state they need.
+// LI32 never comes up, since instructions are specialized but not fused.
+bool translatable(Operation operation)
+{
+    switch (operation) {
+        case Operation::UNKNOWN:
+        case Operation::LI32:
+        case Operation::LL:
+        case Operation::SC:
+        case Operation::SYNC:
+        case Operation::SYSCALL:
+            return false;
+        default:
+            return true;
+    }
+}
+
+std::string hex(Register value)
+{
+    char text[16];
+    std::snprintf(text, sizeof(text), "0x%08xu", value);
+    return text;
+}
+
+std::string label(Address address)
+{
+    char text[16];
+    std::snprintf(text, sizeof(text), "block_%08x", address);
+    return text;
+}
+
+std::string reg(std::uint8_t index)
+{
+    return "r[" + std::to_string(index) + "]";
+}
+
+// Where a branch or jump at `address` goes if taken, if it goes anywhere
+// known before running.
+std::optional<Address> target_of(Address address, DecodedInstruction decoded)
+{
+    switch (decoded.operation) {
+        case Operation::BEQ:
+        case Operation::BNE:
+            return address + 4 + decoded.immediate;
+        case Operation::J:
+        case Operation::JAL:
+            return ((address + 8) & 0xF000'0000u) | decoded.immediate;
+        default:
+            return std::nullopt;
+    }
+}
+
+class Translator {
+public:
+    Translator(Memory& memory, Program const& program, std::ostream& out):
+        out_{out}, begin{program.code.begin}
+    {
+        auto const count = (program.code.end - begin) / 4;
+
+        for (auto i = Address{0}; i < count; ++i) {
+            words.push_back(memory.load<RawInstruction>(begin + 4 * i));
+            decoded.push_back(
+                specialize(decode_instruction(words.back())));
+        }
+
+        find_leaders(program.entry);
+    }
+
+    void write(std::string const& name)
+    {
+        out_ << "// Translated ahead of time by mercury-aot. Do not edit.\n"
+                "\n"
+                "#include \"aot_module.hpp\"\n"
+                "\n"
+                "namespace {\n"
+                "\n"
+                "using mercury::Register;\n"
+                "using namespace mercury::aot;\n"
+                "\n";
+
+        write_instructions();
+        write_run();
+
+        out_ << "}\n"
+                "\n"
+                "extern mercury::aot::Module const "
+             << name
+             << ";\n"
+                "\n"
+                "mercury::aot::Module const "
+             << name << " = {\n"
+             << "    {" << hex(begin) << ", " << hex(end()) << "},\n"
+             << "    instructions,\n"
+                "    &run,\n"
+                "};\n";
+    }
+
+private:
+    Address end() const
+    {
+        return begin + Address(4 * words.size());
+    }
+
+    Address address_of(std::size_t index) const
+    {
+        return begin + Address(4 * index);
+    }
+
+    std::optional<std::size_t> index_of(Address address) const
+    {
+        if (address < begin or address >= end() or address % 4 != 0) {
+            return std::nullopt;
+        }
+
+        return (address - begin) / 4;
+    }
+
+    bool starts_block(Address address) const
+    {
+        auto const index = index_of(address);
+
+        return index and leaders[*index] and
+               translatable(decoded[*index].operation);
+    }
+
+    void mark(Address address)
+    {
+        if (auto const index = index_of(address)) {
+            leaders[*index] = true;
+        }
+    }
+
+    // Blocks start at the entry, at branch and jump targets, after
+    // instructions that leave straight-line code, and where the interpreter
+    // hands back after an instruction it was left with.
+    void find_leaders(Address entry)
+    {
+        leaders.assign(words.size(), false);
+
+        mark(begin);
+        mark(entry);
+
+        for (auto i = std::size_t{0}; i < words.size(); ++i) {
+            auto const operation = decoded[i].operation;
+            auto const address = address_of(i);
+
+            if (not translatable(operation) or
+                spec_for(operation).flow == Flow::Jump) {
+                mark(address + 4);
+            }
+
+            if (auto const target = target_of(address, decoded[i])) {
+                mark(*target);
+            }
+
+            // Where jr $ra goes back to.
+            if (operation == Operation::JAL) {
+                mark(address + 12);
+            }
+        }
+    }
+
+    void write_instructions()
+    {
+        out_ << "constexpr mercury::RawInstruction instructions[] = {";
+
+        for (auto i = std::size_t{0}; i < words.size(); ++i) {
+            out_ << (i % 6 == 0 ? "\n    " : " ") << hex(words[i]) << ",";
+        }
+
+        out_ << "\n};\n\n";
+    }
+
+    void write_run()
+    {
+        out_ << "std::size_t run(\n"
+                "    State& s,\n"
+                "    [[maybe_unused]] std::size_t max_steps,\n"
+                "    [[maybe_unused]] Register breakpoint)\n"
+                "{\n"
+                "    [[maybe_unused]] auto& r = s.registers;\n"
+                "    [[maybe_unused]] auto& memory = *s.memory;\n"
+                "    auto steps = std::size_t{0};\n"
+                "\n"
+                "    while (true) {\n"
+                "        switch (s.pc) {\n";
+
+        for (auto i = std::size_t{0}; i < words.size(); ++i) {
+            if (starts_block(address_of(i))) {
+                out_ << "            case " << hex(address_of(i))
+                     << ": goto " << label(address_of(i)) << ";\n";
+            }
+        }
+
+        out_ << "            default: return steps;\n"
+                "        }\n";
+
+        for (auto i = std::size_t{0}; i < words.size(); ++i) {
+            if (starts_block(address_of(i))) {
+                i = write_block(i) - 1;
+            }
+        }
+
+        out_ << "    }\n"
+                "}\n"
+                "\n";
+    }
+
+    // Returns the index past the block.
+    std::size_t write_block(std::size_t first)
+    {
+        auto last = first;
+        while (last + 1 < words.size() and
+               spec_for(decoded[last].operation).flow != Flow::Jump and
+               not leaders[last + 1] and
+               translatable(decoded[last + 1].operation)) {
+            ++last;
+        }
+
+        auto const start = address_of(first);
+        auto const size = last - first + 1;
+
+        out_ << "\n" << label(start) << ":\n"
+             << "        if (max_steps - steps < " << size
+             << " or breakpoint - " << hex(start) << " < " << 4 * size
+             << ") {\n"
+             << "            s.pc = " << hex(start) << ";\n"
+             << "            return steps;\n"
+             << "        }\n"
+             << "        steps += " << size << ";\n";
+
+        for (auto i = first; i <= last; ++i) {
+            write_instruction(address_of(i), decoded[i], last - i);
+        }
+
+        if (spec_for(decoded[last].operation).flow != Flow::Jump or
+            decoded[last].operation == Operation::BEQ or
+            decoded[last].operation == Operation::BNE) {
+            go_to(address_of(last) + 4, "        ");
+        }
+
+        return last + 1;
+    }
+
+    // Carry on at `target`, which need not be a block.
+    void go_to(Address target, char const* indent)
+    {
+        if (starts_block(target)) {
+            out_ << indent << "goto " << label(target) << ";\n";
+        } else {
+            out_ << indent << "s.pc = " << hex(target) << ";\n"
+                 << indent << "return steps;\n";
+        }
+    }
+
+    // `after` instructions of the block follow this one, and were counted
+    // in `steps` already.
+    void write_instruction(
+        Address address,
+        DecodedInstruction instruction,
+        std::size_t after)
+    {
+        auto const rs = reg(instruction.rs);
+        auto const rt = reg(instruction.rt);
+        auto const rd = reg(instruction.rd);
+        auto const immediate = hex(instruction.immediate);
+
+        // Leave the instruction for the interpreter, which raises the trap.
+        auto const bail = "{\n            s.pc = " + hex(address) +
+                          ";\n            return steps - " +
+                          std::to_string(after + 1) + ";\n        }\n";
+
+        // Misaligned loads and stores are left for the interpreter too.
+        auto const aligned = [&](std::size_t size) {
+            if (size > 1) {
+                out_ << "            if (address % " << size << " != 0) {\n"
+                     << "                s.pc = " << hex(address) << ";\n"
+                     << "                return steps - " << after + 1
+                     << ";\n"
+                     << "            }\n";
+            }
+        };
+
+        auto const load = [&](char const* type, std::size_t size) {
+            out_ << "        {\n"
+                 << "            auto const address = " << rs << " + "
+                 << immediate << ";\n";
+            aligned(size);
+            out_ << "            " << rt << " = memory.load<" << type
+                 << ">(address);\n"
+                 << "        }\n";
+        };
+
+        // Words are stored as they are, and narrower values truncated.
+        auto const store = [&](std::string const& value, std::size_t size) {
+            out_ << "        {\n"
+                 << "            auto const address = " << rs << " + "
+                 << immediate << ";\n";
+            aligned(size);
+            out_ << "            if (memory.store(address, " << value
+                 << ")) {\n"
+                 << "                s.code_store = address;\n"
+                 << "                s.stored_to_code = true;\n"
+                 << "                s.pc = " << hex(address + 4) << ";\n"
+                 << "                return steps - " << after << ";\n"
+                 << "            }\n"
+                 << "        }\n";
+        };
+
+        // $zero only gets the check.
+        auto const checked = [&](char const* check,
+                                 std::string const& a,
+                                 std::string const& b,
+                                 std::uint8_t destination) {
+            out_ << "        if (Register v; " << check << "(" << a << ", "
+                 << b << ", v)) " << bail;
+
+            if (destination != 0) {
+                out_ << "        else {\n"
+                     << "            " << reg(destination) << " = v;\n"
+                     << "        }\n";
+            }
+        };
+
+        auto const line = [&](std::string const& text) {
+            out_ << "        " << text << "\n";
+        };
+
+        switch (instruction.operation) {
+            case Operation::ADD:
+                checked("add_overflows", rs, rt, instruction.rd);
+                break;
+            case Operation::ADDU:
+                line(rd + " = " + rs + " + " + rt + ";");
+                break;
+            case Operation::AND:
+                line(rd + " = " + rs + " & " + rt + ";");
+                break;
+            case Operation::DIV:
+                out_ << "        if (" << rt << " == 0) " << bail;
+                line("divide(s, " + rs + ", " + rt + ");");
+                break;
+            case Operation::DIVU:
+                out_ << "        if (" << rt << " == 0) " << bail;
+                line("s.lo = " + rs + " / " + rt + ";");
+                line("s.hi = " + rs + " % " + rt + ";");
+                break;
+            case Operation::JR:
+                out_ << "        if (" << rs << " % 4 != 0) " << bail;
+                line("s.pc = " + rs + ";");
+                line("continue;");
+                break;
+            case Operation::MFHI:
+                line(rd + " = s.hi;");
+                break;
+            case Operation::MFLO:
+                line(rd + " = s.lo;");
+                break;
+            case Operation::MULT:
+                line("multiply(s, " + rs + ", " + rt + ");");
+                break;
+            case Operation::MULTU:
+                line("multiply_unsigned(s, " + rs + ", " + rt + ");");
+                break;
+            case Operation::NOR:
+                line(rd + " = ~(" + rs + " | " + rt + ");");
+                break;
+            case Operation::OR:
+                line(rd + " = " + rs + " | " + rt + ";");
+                break;
+            case Operation::SLL:
+                line(rd + " = " + rt + " << " + immediate + ";");
+                break;
+            case Operation::SLT:
+                line(
+                    rd + " = static_cast<std::int32_t>(" + rs +
+                    ") < static_cast<std::int32_t>(" + rt + ");");
+                break;
+            case Operation::SLTU:
+                line(rd + " = " + rs + " < " + rt + ";");
+                break;
+            case Operation::SRL:
+                line(rd + " = " + rt + " >> " + immediate + ";");
+                break;
+            case Operation::SUB:
+                checked("subtract_overflows", rs, rt, instruction.rd);
+                break;
+            case Operation::SUBU:
+                line(rd + " = " + rs + " - " + rt + ";");
+                break;
+
+            case Operation::ADDI:
+                checked("add_overflows", rs, immediate, instruction.rt);
+                break;
+            case Operation::ADDIU:
+                line(rt + " = " + rs + " + " + immediate + ";");
+                break;
+            case Operation::ANDI:
+                line(rt + " = " + rs + " & " + immediate + ";");
+                break;
+            case Operation::BEQ:
+            case Operation::BNE:
+                out_ << "        if (" << rs
+                     << (instruction.operation == Operation::BEQ ? " == "
+                                                                 : " != ")
+                     << rt << ") {\n";
+                go_to(*target_of(address, instruction), "            ");
+                out_ << "        }\n";
+                break;
+            case Operation::LBU:
+                line(
+                    rt + " = memory.load<std::uint8_t>(" + rs + " + " +
+                    immediate + ");");
+                break;
+            case Operation::LHU:
+                load("std::uint16_t", 2);
+                break;
+            case Operation::LUI:
+                line(rt + " = " + immediate + ";");
+                break;
+            case Operation::LW:
+                load("std::uint32_t", 4);
+                break;
+            case Operation::ORI:
+                line(rt + " = " + rs + " | " + immediate + ";");
+                break;
+            case Operation::SB:
+                store("static_cast<std::uint8_t>(" + rt + ")", 1);
+                break;
+            case Operation::SH:
+                store("static_cast<std::uint16_t>(" + rt + ")", 2);
+                break;
+            case Operation::SLTI:
+                line(
+                    rt + " = static_cast<std::int32_t>(" + rs +
+                    ") < static_cast<std::int32_t>(" + immediate + ");");
+                break;
+            case Operation::SLTIU:
+                line(rt + " = " + rs + " < " + immediate + ";");
+                break;
+            case Operation::SW:
+                store(rt, 4);
+                break;
+
+            case Operation::J:
+                go_to(*target_of(address, instruction), "        ");
+                break;
+            case Operation::JAL:
+                // As the interpreter does.
+                line(reg(31) + " = " + hex(address + 12) + ";");
+                go_to(*target_of(address, instruction), "        ");
+                break;
+
+            case Operation::NOP:
+                break;
+            case Operation::MOVE:
+                line(rd + " = " + rs + ";");
+                break;
+            case Operation::LI:
+                line(rt + " = " + immediate + ";");
+                break;
+
+            case Operation::UNKNOWN:
+            case Operation::LI32:
+            case Operation::LL:
+            case Operation::SC:
+            case Operation::SYNC:
+            case Operation::SYSCALL:
+                break;
+        }
+    }
+
+    std::ostream& out_;
+    Address begin;
+    std::vector<RawInstruction> words;
+    std::vector<DecodedInstruction> decoded;
+    std::vector<bool> leaders;
+};
+
+}
+
+void translate_program(
+    Memory& memory,
+    Program const& program,
+    std::string const& name,
+    std::ostream& out)
+{
+    Translator{memory, program, out}.write(name);
+}
+
+}
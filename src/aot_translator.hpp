@@ -0,0 +1,29 @@
+#ifndef MERCURY_AOT_TRANSLATOR_HPP
+#define MERCURY_AOT_TRANSLATOR_HPP
+
+#include <ostream>
+#include <string>
+
+#include "memory.hpp"
+#include "program.hpp"
+
+namespace mercury {
+
+// Translate the code of `program`, already loaded in `memory`, to C++ that
+// defines an aot::Module called `name`, and write it to `out`.
+//
+// The code is split into basic blocks at every branch and jump target, and
+// each block becomes straight-line operations on the guest registers, with
+// direct branches going from block to block. Indirect jumps look their
+// target up among the blocks, and the interpreter takes over for targets
+// that are not one. So it does for the instructions that are left to it:
+// system calls, LL, SC, SYNC and unknown ones.
+void translate_program(
+    Memory& memory,
+    Program const& program,
+    std::string const& name,
+    std::ostream& out);
+
+}
+
+#endif
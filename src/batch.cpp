@@ -0,0 +1,778 @@
+#include "batch.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "decoder.hpp"
+#include "specializer.hpp"
+#include "trap.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MERCURY_X86_SIMD
+#endif
+
+namespace mercury {
+
+namespace {
+
+std::size_t width_of(SimdLevel level)
+{
+    switch (level) {
+        case SimdLevel::None:
+            return 1;
+        case SimdLevel::SSE4:
+            return 4;
+        case SimdLevel::AVX2:
+            return 8;
+        case SimdLevel::AVX512:
+            return 16;
+    }
+
+    return 1;
+}
+
+// A register of `Width` lanes, with the vector extensions of GCC and Clang,
+// which compile to whatever vector instructions the function using them is
+// built for.
+template <std::size_t Width>
+struct Vectors {
+    typedef Register Unsigned __attribute__((vector_size(4 * Width)));
+    typedef std::int32_t Signed __attribute__((vector_size(4 * Width)));
+    typedef std::uint64_t Wide __attribute__((vector_size(8 * Width)));
+    typedef std::int64_t SignedWide __attribute__((vector_size(8 * Width)));
+};
+
+// Runs lanes [first, first + Width) of a batch. Everything here must be
+// inlined into a function built for the vector level, so it all is.
+template <std::size_t Width>
+class Group {
+public:
+    using Vector = typename Vectors<Width>::Unsigned;
+    using SignedVector = typename Vectors<Width>::Signed;
+    using WideVector = typename Vectors<Width>::Wide;
+    using SignedWideVector = typename Vectors<Width>::SignedWide;
+
+    [[gnu::always_inline]] Group(
+        Batch::Lanes& state,
+        std::vector<DecodedInstruction> const& code,
+        std::size_t first,
+        std::size_t max_steps):
+        state_{state},
+        instructions{code.data()},
+        instruction_count{code.size()},
+        registers{state.registers.data()},
+        stride{state.stride},
+        first_{first}
+    {
+        for (auto i = std::size_t{0}; i < Width; ++i) {
+            auto const steps = state_.steps[first_ + i];
+            auto const left = std::numeric_limits<std::size_t>::max() - steps;
+            limits[i] = steps + std::min(max_steps, left);
+        }
+    }
+
+    [[gnu::always_inline]] void run()
+    {
+        while (pick()) {
+            execute();
+        }
+    }
+
+private:
+    [[gnu::always_inline]] bool runnable(std::size_t i) const
+    {
+        return state_.status[first_ + i] == LaneStatus::Running and
+               state_.steps[first_ + i] < limits[i];
+    }
+
+    // Go on with the lanes at the lowest PC among the runnable ones, if any.
+    [[gnu::always_inline]] bool pick()
+    {
+        auto found = false;
+        pc = std::numeric_limits<Register>::max();
+
+        for (auto i = std::size_t{0}; i < Width; ++i) {
+            if (runnable(i)) {
+                pc = std::min(pc, state_.pc[first_ + i]);
+                found = true;
+            }
+        }
+
+        if (not found) {
+            return false;
+        }
+
+        room = std::numeric_limits<std::size_t>::max();
+        run_length = 0;
+        waiting = std::numeric_limits<Register>::max();
+
+        for (auto i = std::size_t{0}; i < Width; ++i) {
+            auto const at = state_.pc[first_ + i];
+            auto const picked = runnable(i) and at == pc;
+            active[i] = picked ? ~Register{0} : 0;
+
+            if (picked) {
+                room = std::min(room, limits[i] - state_.steps[first_ + i]);
+            } else if (runnable(i)) {
+                waiting = std::min(waiting, at);
+            }
+        }
+
+        return true;
+    }
+
+    // Run the active lanes, which are all at `pc`, until they go different
+    // ways or catch up with other lanes, one of them traps or leaves the
+    // program, or one of them is out of steps.
+    [[gnu::always_inline]] void execute()
+    {
+        while (run_length < room) {
+            if (pc / 4 >= instruction_count) {
+                stop(LaneStatus::OutOfProgram);
+                return;
+            }
+
+            auto const instruction = instructions[pc / 4];
+            auto const next = pc + 4;
+            auto const rd = instruction.rd;
+            auto const rs = instruction.rs;
+            auto const rt = instruction.rt;
+            auto const immediate = instruction.immediate;
+
+            switch (instruction.operation) {
+                case Operation::NOP:
+                case Operation::SYNC:
+                    break;
+                case Operation::ADD:
+                    if (add(rd, read(rs), read(rt), next)) {
+                        return;
+                    }
+                    break;
+                case Operation::ADDU:
+                    write(rd, read(rs) + read(rt));
+                    break;
+                case Operation::AND:
+                    write(rd, read(rs) & read(rt));
+                    break;
+                case Operation::NOR:
+                    write(rd, ~(read(rs) | read(rt)));
+                    break;
+                case Operation::OR:
+                    write(rd, read(rs) | read(rt));
+                    break;
+                case Operation::SLL:
+                    write(rd, read(rt) << immediate);
+                    break;
+                case Operation::SLT:
+                    write(
+                        rd, one_if(as_signed(read(rs)) < as_signed(read(rt))));
+                    break;
+                case Operation::SLTU:
+                    write(rd, one_if(read(rs) < read(rt)));
+                    break;
+                case Operation::SRL:
+                    write(rd, read(rt) >> immediate);
+                    break;
+                case Operation::SUB:
+                    if (subtract(rd, read(rs), read(rt), next)) {
+                        return;
+                    }
+                    break;
+                case Operation::SUBU:
+                    write(rd, read(rs) - read(rt));
+                    break;
+                case Operation::MFHI:
+                    write(rd, load(state_.hi.data()));
+                    break;
+                case Operation::MFLO:
+                    write(rd, load(state_.lo.data()));
+                    break;
+                case Operation::MULT:
+                    multiply(as_wide(as_signed(read(rs))) *
+                             as_wide(as_signed(read(rt))));
+                    break;
+                case Operation::MULTU:
+                    multiply(as_wide(read(rs)) * as_wide(read(rt)));
+                    break;
+                case Operation::DIV:
+                case Operation::DIVU:
+                    if (divide(instruction, next)) {
+                        return;
+                    }
+                    break;
+                case Operation::JR:
+                    jump_register(read(rs));
+                    return;
+                case Operation::SYSCALL:
+                    trap(active, broadcast(next), ExceptionCode::Syscall);
+                    return;
+                case Operation::ADDI:
+                    if (add(rt, read(rs), broadcast(immediate), next)) {
+                        return;
+                    }
+                    break;
+                case Operation::ADDIU:
+                    write(rt, read(rs) + immediate);
+                    break;
+                case Operation::ANDI:
+                    write(rt, read(rs) & immediate);
+                    break;
+                case Operation::BEQ:
+                    if (branch(read(rs) == read(rt), next + immediate, next)) {
+                        return;
+                    }
+                    continue;
+                case Operation::BNE:
+                    if (branch(read(rs) != read(rt), next + immediate, next)) {
+                        return;
+                    }
+                    continue;
+                case Operation::LUI:
+                case Operation::LI:
+                    write(rt, broadcast(immediate));
+                    break;
+                case Operation::ORI:
+                    write(rt, read(rs) | immediate);
+                    break;
+                case Operation::SLTI:
+                    write(
+                        rt,
+                        one_if(
+                            as_signed(read(rs)) <
+                            static_cast<std::int32_t>(immediate)));
+                    break;
+                case Operation::SLTIU:
+                    write(rt, one_if(read(rs) < immediate));
+                    break;
+                case Operation::J:
+                    if (not go_on(jump_address(next, immediate))) {
+                        return;
+                    }
+                    continue;
+                case Operation::JAL:
+                    write(31, broadcast(next + 8));
+                    if (not go_on(jump_address(next, immediate))) {
+                        return;
+                    }
+                    continue;
+                case Operation::MOVE:
+                    write(rd, read(rs));
+                    break;
+                case Operation::UNKNOWN:
+                    trap(
+                        active,
+                        broadcast(next),
+                        ExceptionCode::ReservedInstruction);
+                    return;
+                case Operation::LBU:
+                case Operation::LHU:
+                case Operation::LL:
+                case Operation::LW:
+                case Operation::SB:
+                case Operation::SC:
+                case Operation::SH:
+                case Operation::SW:
+                case Operation::LI32:
+                    stop(LaneStatus::Unsupported);
+                    return;
+            }
+
+            // Falling through onto waiting lanes merges them as jumping there
+            // would.
+            if (not go_on(next)) {
+                return;
+            }
+        }
+
+        leave(broadcast(pc));
+    }
+
+    /* Lanes */
+
+    [[gnu::always_inline]] Vector load(Register const* lanes) const
+    {
+        auto vector = Vector{};
+        std::memcpy(&vector, lanes + first_, sizeof(vector));
+        return vector;
+    }
+
+    // Store `value` in the lanes of `mask`.
+    [[gnu::always_inline]] void
+    store(Register* lanes, Vector value, Vector mask) const
+    {
+        auto const blended = select(mask, value, load(lanes));
+        std::memcpy(lanes + first_, &blended, sizeof(blended));
+    }
+
+    [[gnu::always_inline]] Vector read(std::uint8_t index) const
+    {
+        return load(registers + index * stride);
+    }
+
+    // Write the active lanes of a register, or only those in `mask`.
+    [[gnu::always_inline]] void write(std::uint8_t index, Vector value)
+    {
+        write(index, value, active);
+    }
+
+    [[gnu::always_inline]] void
+    write(std::uint8_t index, Vector value, Vector mask)
+    {
+        if (index != 0) {
+            store(registers + index * stride, value, mask);
+        }
+    }
+
+    /* Vector helpers */
+
+    [[gnu::always_inline]] static Vector broadcast(Register value)
+    {
+        return Vector{} + value;
+    }
+
+    [[gnu::always_inline]] static Vector
+    select(Vector mask, Vector if_set, Vector otherwise)
+    {
+        return (if_set & mask) | (otherwise & ~mask);
+    }
+
+    // Whether any lane has a bit set, folded in 64-bit words, which is
+    // cheaper than going through the lanes one by one.
+    [[gnu::always_inline]] static bool any(Vector mask)
+    {
+        auto words = std::array<std::uint64_t, (Width + 1) / 2>{};
+        std::memcpy(words.data(), &mask, sizeof(mask));
+
+        auto folded = std::uint64_t{0};
+        for (auto const word: words) {
+            folded |= word;
+        }
+
+        return folded != 0;
+    }
+
+    // Comparisons give all ones in the lanes where they hold.
+    [[gnu::always_inline]] static Vector mask_of(SignedVector comparison)
+    {
+        return reinterpret_cast<Vector>(comparison);
+    }
+
+    [[gnu::always_inline]] static Vector one_if(SignedVector comparison)
+    {
+        return mask_of(comparison) & 1;
+    }
+
+    [[gnu::always_inline]] static SignedVector as_signed(Vector vector)
+    {
+        return reinterpret_cast<SignedVector>(vector);
+    }
+
+    [[gnu::always_inline]] static WideVector as_wide(Vector vector)
+    {
+        return __builtin_convertvector(vector, WideVector);
+    }
+
+    [[gnu::always_inline]] static SignedWideVector
+    as_wide(SignedVector vector)
+    {
+        return __builtin_convertvector(vector, SignedWideVector);
+    }
+
+    /* Instructions */
+
+    // As CPUInternals::write_checked(), trapping in the lanes that
+    // overflow. These and divide() return whether any lane trapped, which
+    // ends the run.
+    [[gnu::always_inline]] bool
+    add(std::uint8_t index, Vector lhs, Vector rhs, Register next)
+    {
+        auto const sum = lhs + rhs;
+        auto const overflow =
+            mask_of(as_signed((lhs ^ sum) & (rhs ^ sum)) < 0) & active;
+
+        write(index, sum, active & ~overflow);
+        return trap(overflow, broadcast(next), ExceptionCode::Overflow);
+    }
+
+    [[gnu::always_inline]] bool
+    subtract(std::uint8_t index, Vector lhs, Vector rhs, Register next)
+    {
+        auto const difference = lhs - rhs;
+        auto const overflow =
+            mask_of(as_signed((lhs ^ rhs) & (lhs ^ difference)) < 0) &
+            active;
+
+        write(index, difference, active & ~overflow);
+        return trap(overflow, broadcast(next), ExceptionCode::Overflow);
+    }
+
+    // MULT and MULTU, which leave the high word in HI and the low one in LO.
+    template <typename Product>
+    [[gnu::always_inline]] void multiply(Product const& product)
+    {
+        store(
+            state_.hi.data(),
+            __builtin_convertvector(product >> 32, Vector),
+            active);
+        store(
+            state_.lo.data(),
+            __builtin_convertvector(product, Vector),
+            active);
+    }
+
+    // There is no vector division, so this goes one lane at a time, as
+    // CPUInternals::div() and divu() do.
+    [[gnu::always_inline]] bool
+    divide(DecodedInstruction instruction, Register next)
+    {
+        auto const is_signed = instruction.operation == Operation::DIV;
+        auto const lhs = read(instruction.rs);
+        auto const rhs = read(instruction.rt);
+        auto by_zero = Vector{};
+
+        for (auto i = std::size_t{0}; i < Width; ++i) {
+            if (active[i] == 0) {
+                continue;
+            }
+
+            auto& lo = state_.lo[first_ + i];
+            auto& hi = state_.hi[first_ + i];
+
+            if (rhs[i] == 0) {
+                by_zero[i] = ~Register{0};
+            } else if (not is_signed) {
+                lo = lhs[i] / rhs[i];
+                hi = lhs[i] % rhs[i];
+            } else if (
+                lhs[i] == Register{1} << 31 and rhs[i] == ~Register{0}) {
+                lo = lhs[i];
+                hi = 0;
+            } else {
+                auto const dividend = static_cast<std::int32_t>(lhs[i]);
+                auto const divisor = static_cast<std::int32_t>(rhs[i]);
+                lo = static_cast<Register>(dividend / divisor);
+                hi = static_cast<Register>(dividend % divisor);
+            }
+        }
+
+        return trap(by_zero, broadcast(next), ExceptionCode::Trap);
+    }
+
+    // Returns whether the run ended, which it does when the active lanes
+    // go different ways.
+    [[gnu::always_inline]] bool
+    branch(SignedVector condition, Register target, Register next)
+    {
+        auto const taken = mask_of(condition) & active;
+
+        if (not any(taken)) {
+            return not go_on(next);
+        }
+
+        if (not any(active & ~taken)) {
+            return not go_on(target);
+        }
+
+        ++run_length;
+        leave(select(taken, broadcast(target), broadcast(next)));
+        return true;
+    }
+
+    [[gnu::always_inline]] static Register
+    jump_address(Register next, Register target)
+    {
+        return ((next + 4) & 0xF000'0000) | target;
+    }
+
+    // The active lanes all go on to `target`, and keep running together
+    // unless some other lane is waiting there or before, which it then gets
+    // to run along with them or first. Returns whether they kept running.
+    [[gnu::always_inline]] bool go_on(Register target)
+    {
+        ++run_length;
+
+        if (target < waiting) {
+            pc = target;
+            return true;
+        }
+
+        leave(broadcast(target));
+        return false;
+    }
+
+    [[gnu::always_inline]] void jump_register(Vector targets)
+    {
+        auto const misaligned = mask_of(as_signed(targets & 3) != 0) & active;
+
+        if (not trap(misaligned, targets, ExceptionCode::AddressErrorLoad)) {
+            ++run_length;
+            leave(targets);
+        }
+    }
+
+    /* Leaving */
+
+    // Unless `faulted` is empty, the active lanes have executed one more
+    // instruction, and raised `exception` in the lanes of `faulted`, while
+    // the others go on to `next`, which ends the run. Returns whether it
+    // did.
+    [[gnu::always_inline]] bool
+    trap(Vector faulted, Vector next, ExceptionCode exception)
+    {
+        if (not any(faulted)) {
+            return false;
+        }
+
+        ++run_length;
+        leave(select(faulted, broadcast(pc), next));
+
+        for (auto i = std::size_t{0}; i < Width; ++i) {
+            if (faulted[i] != 0) {
+                state_.status[first_ + i] = LaneStatus::Trap;
+                state_.cause[first_ + i] = cause_of(exception);
+            }
+        }
+
+        return true;
+    }
+
+    // The active lanes stop at `pc`, without executing it.
+    [[gnu::always_inline]] void stop(LaneStatus status)
+    {
+        leave(broadcast(pc));
+
+        for (auto i = std::size_t{0}; i < Width; ++i) {
+            if (active[i] != 0) {
+                state_.status[first_ + i] = status;
+            }
+        }
+    }
+
+    // Write back where the active lanes go next, and what they executed.
+    [[gnu::always_inline]] void leave(Vector next)
+    {
+        for (auto i = std::size_t{0}; i < Width; ++i) {
+            if (active[i] != 0) {
+                state_.pc[first_ + i] = next[i];
+                state_.steps[first_ + i] += run_length;
+            }
+        }
+    }
+
+    // Pointers kept apart from the vectors they come from, which stores to
+    // lanes would otherwise make the compiler read again.
+    Batch::Lanes& state_;
+    DecodedInstruction const* const instructions;
+    std::size_t const instruction_count;
+    Register* const registers;
+    std::size_t const stride;
+    std::size_t const first_;
+    // How many steps each lane may have executed by the end of the run.
+    std::array<std::size_t, Width> limits;
+
+    // The lanes running together, all at `pc`, and how many instructions
+    // they have executed since they were picked, out of `room`. The other
+    // runnable lanes stay where they were, the first of them at `waiting`.
+    Vector active{};
+    Register pc{0};
+    Register waiting{0};
+    std::size_t run_length{0};
+    std::size_t room{0};
+};
+
+template <std::size_t Width>
+[[gnu::always_inline]] inline void run_groups(
+    Batch::Lanes& state,
+    std::vector<DecodedInstruction> const& code,
+    std::size_t max_steps)
+{
+    for (auto first = std::size_t{0}; first < state.stride; first += Width) {
+        Group<Width>{state, code, first, max_steps}.run();
+    }
+}
+
+void run_scalar(
+    Batch::Lanes& state,
+    std::vector<DecodedInstruction> const& code,
+    std::size_t max_steps)
+{
+    run_groups<1>(state, code, max_steps);
+}
+
+#ifdef MERCURY_X86_SIMD
+
+__attribute__((target("sse4.1"))) void run_sse4(
+    Batch::Lanes& state,
+    std::vector<DecodedInstruction> const& code,
+    std::size_t max_steps)
+{
+    run_groups<4>(state, code, max_steps);
+}
+
+__attribute__((target("avx2"))) void run_avx2(
+    Batch::Lanes& state,
+    std::vector<DecodedInstruction> const& code,
+    std::size_t max_steps)
+{
+    run_groups<8>(state, code, max_steps);
+}
+
+__attribute__((target("avx512f"))) void run_avx512(
+    Batch::Lanes& state,
+    std::vector<DecodedInstruction> const& code,
+    std::size_t max_steps)
+{
+    run_groups<16>(state, code, max_steps);
+}
+
+#endif
+
+}
+
+char const* name_of(LaneStatus status)
+{
+    switch (status) {
+        case LaneStatus::Running:
+            return "running";
+        case LaneStatus::Trap:
+            return "trap";
+        case LaneStatus::OutOfProgram:
+            return "out of program";
+        case LaneStatus::Unsupported:
+            return "unsupported";
+    }
+
+    return "?";
+}
+
+Batch::Batch(
+    RawInstruction const* program,
+    std::size_t program_size,
+    std::size_t lanes,
+    SimdLevel level):
+    lanes_{lanes}, level_{level}
+{
+    if (level > best_simd_level()) {
+        throw std::invalid_argument(
+            std::string{"This machine does not support "} + name_of(level) +
+            ".");
+    }
+
+    code.reserve(program_size);
+    for (auto i = std::size_t{0}; i < program_size; ++i) {
+        code.push_back(specialize(decode_instruction(program[i])));
+    }
+
+    // With a spare group, registers stop being a multiple of 4 KiB apart
+    // for round numbers of lanes, where loads from one would wait on stores
+    // to another.
+    auto const width = width_of(level);
+    auto const stride = (lanes + width - 1) / width * width + width;
+
+    state.stride = stride;
+    state.registers.resize(std::tuple_size_v<Registers> * stride);
+    state.hi.resize(stride);
+    state.lo.resize(stride);
+    state.pc.resize(stride);
+    state.steps.resize(stride);
+    state.status.resize(stride, LaneStatus::Running);
+    state.cause.resize(stride);
+
+    std::fill(
+        state.status.begin() + static_cast<std::ptrdiff_t>(lanes),
+        state.status.end(),
+        LaneStatus::OutOfProgram);
+}
+
+std::size_t Batch::lanes() const
+{
+    return lanes_;
+}
+
+SimdLevel Batch::level() const
+{
+    return level_;
+}
+
+Registers Batch::registers(std::size_t lane) const
+{
+    auto registers = Registers{};
+    for (auto i = std::size_t{0}; i < registers.size(); ++i) {
+        registers[i] = state.registers[i * state.stride + lane];
+    }
+
+    return registers;
+}
+
+void Batch::set_registers(std::size_t lane, Registers const& registers)
+{
+    for (auto i = std::size_t{0}; i < registers.size(); ++i) {
+        state.registers[i * state.stride + lane] = registers[i];
+    }
+}
+
+Register Batch::pc(std::size_t lane) const
+{
+    return state.pc[lane];
+}
+
+Register Batch::hi(std::size_t lane) const
+{
+    return state.hi[lane];
+}
+
+Register Batch::lo(std::size_t lane) const
+{
+    return state.lo[lane];
+}
+
+LaneStatus Batch::status(std::size_t lane) const
+{
+    return state.status[lane];
+}
+
+Register Batch::cause(std::size_t lane) const
+{
+    return state.cause[lane];
+}
+
+std::size_t Batch::steps(std::size_t lane) const
+{
+    return state.steps[lane];
+}
+
+void Batch::return_from_trap(std::size_t lane, Register pc)
+{
+    state.pc[lane] = pc;
+    state.status[lane] = LaneStatus::Running;
+}
+
+void Batch::run(std::size_t max_steps)
+{
+    switch (level_) {
+        case SimdLevel::None:
+            run_scalar(state, code, max_steps);
+            return;
+#ifdef MERCURY_X86_SIMD
+        case SimdLevel::SSE4:
+            run_sse4(state, code, max_steps);
+            return;
+        case SimdLevel::AVX2:
+            run_avx2(state, code, max_steps);
+            return;
+        case SimdLevel::AVX512:
+            run_avx512(state, code, max_steps);
+            return;
+#else
+        default:
+            run_scalar(state, code, max_steps);
+            return;
+#endif
+    }
+}
+
+}
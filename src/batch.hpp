@@ -0,0 +1,102 @@
+#ifndef MERCURY_BATCH_HPP
+#define MERCURY_BATCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cpu.hpp"
+#include "decoded_instruction.hpp"
+#include "instruction_formats.hpp"
+#include "registers.hpp"
+#include "simd.hpp"
+
+namespace mercury {
+
+// Where a lane of a batch is at.
+enum class LaneStatus: std::uint8_t {
+    Running,
+    // An instruction raised an exception. As on a CPU, it counts as
+    // executed, but the PC is left on it, and the lane does nothing more
+    // until return_from_trap().
+    Trap,
+    // The PC left the program.
+    OutOfProgram,
+    // The next instruction is one batches cannot run, since they have no
+    // memory: a load, a store, LL or SC. The PC is left on it, and the lane
+    // can be finished on a CPU from its registers.
+    Unsupported,
+};
+
+char const* name_of(LaneStatus status);
+
+// One program run over many sets of registers, called lanes, each as if on a
+// CPU of its own, but with every instruction executed for a group of lanes
+// at once: 4, 8 or 16 of them with SSE4, AVX2 or AVX-512, or one at a time
+// without vector instructions.
+//
+// Registers are stored as one array of lanes per register. Each group runs
+// the lanes at the lowest PC among its running ones, so lanes that branch
+// different ways are masked off until the others catch up with them, and
+// run together again from there.
+class Batch {
+public:
+    // Load `program` at address 0 for `lanes` lanes, which all start there
+    // with zeroed registers. `level` must be supported by this machine.
+    Batch(RawInstruction const* program,
+          std::size_t program_size,
+          std::size_t lanes,
+          SimdLevel level = best_simd_level());
+
+    std::size_t lanes() const;
+    SimdLevel level() const;
+
+    // A lane's registers, copied out of and into their arrays. $zero must
+    // be left at zero.
+    Registers registers(std::size_t lane) const;
+    void set_registers(std::size_t lane, Registers const& registers);
+
+    Register pc(std::size_t lane) const;
+    Register hi(std::size_t lane) const;
+    Register lo(std::size_t lane) const;
+
+    LaneStatus status(std::size_t lane) const;
+
+    // The Cause register of a lane that trapped.
+    Register cause(std::size_t lane) const;
+
+    // How many instructions the lane executed since the batch was created.
+    std::size_t steps(std::size_t lane) const;
+
+    // Carry on with a lane that trapped from `pc`, as CPU::return_from_trap()
+    // does.
+    void return_from_trap(std::size_t lane, Register pc);
+
+    // Run every lane until it stops running or has executed `max_steps`
+    // more instructions.
+    void run(std::size_t max_steps = unlimited_steps);
+
+    // The state of every lane, and of padding up to a whole number of
+    // groups and one more, where lanes never run.
+    struct Lanes {
+        std::size_t stride;
+        // Register `i` of lane `j` is at `i * stride + j`.
+        std::vector<Register> registers;
+        std::vector<Register> hi;
+        std::vector<Register> lo;
+        std::vector<Register> pc;
+        std::vector<std::size_t> steps;
+        std::vector<LaneStatus> status;
+        std::vector<Register> cause;
+    };
+
+private:
+    std::vector<DecodedInstruction> code;
+    std::size_t lanes_;
+    SimdLevel level_;
+    Lanes state;
+};
+
+}
+
+#endif
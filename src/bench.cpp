@@ -0,0 +1,601 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "batch.hpp"
+#include "bulk_decoder.hpp"
+#include "cpu.hpp"
+#include "encoder.hpp"
+
+namespace mercury {
+
+namespace {
+
+namespace reg {
+
+constexpr auto zero = std::uint8_t{0};
+constexpr auto a0 = std::uint8_t{4};
+constexpr auto t0 = std::uint8_t{8};
+constexpr auto t1 = std::uint8_t{9};
+constexpr auto t2 = std::uint8_t{10};
+constexpr auto t3 = std::uint8_t{11};
+constexpr auto t4 = std::uint8_t{12};
+constexpr auto t5 = std::uint8_t{13};
+constexpr auto t6 = std::uint8_t{14};
+constexpr auto t7 = std::uint8_t{15};
+constexpr auto s0 = std::uint8_t{16};
+constexpr auto s1 = std::uint8_t{17};
+constexpr auto s2 = std::uint8_t{18};
+constexpr auto s3 = std::uint8_t{19};
+constexpr auto t8 = std::uint8_t{24};
+constexpr auto t9 = std::uint8_t{25};
+
+}
+
+// Just enough of an assembler to write the kernels with labels.
+class Assembler {
+public:
+    using Label = std::size_t;
+
+    Label here() const
+    {
+        return code_.size();
+    }
+
+    void emit(RawInstruction instruction)
+    {
+        code_.push_back(instruction);
+    }
+
+    // Branch to an earlier label.
+    void branch(Opcode opcode, std::uint8_t rs, std::uint8_t rt, Label target)
+    {
+        emit(i_type(opcode, rt, rs, offset_to(target)));
+    }
+
+    // Branch to a label placed later with place(), returning a fixup.
+    Label branch_forward(Opcode opcode, std::uint8_t rs, std::uint8_t rt)
+    {
+        auto const from = here();
+        emit(i_type(opcode, rt, rs, 0));
+        return from;
+    }
+
+    void place(Label fixup)
+    {
+        auto const immediate = offset(fixup, here()) & 0xFFFF;
+        code_[fixup] |= set_field(immediate, info::immediate);
+    }
+
+    std::vector<RawInstruction> finish() &&
+    {
+        return std::move(code_);
+    }
+
+private:
+    // Branches are taken relative to the instruction after the one
+    // following them.
+    static std::int32_t offset(Label from, Label to)
+    {
+        return static_cast<std::int32_t>(to) - static_cast<std::int32_t>(from) -
+               2;
+    }
+
+    std::int32_t offset_to(Label target) const
+    {
+        return offset(here(), target);
+    }
+
+    std::vector<RawInstruction> code_;
+};
+
+// Each kernel runs $a0 iterations of its loop, then reaches its last
+// instruction, a jump back to the start. Stopping on that jump lets the
+// kernel be run again without decoding it again.
+struct Kernel {
+    char const* name;
+    std::vector<RawInstruction> code;
+    Register iterations;
+};
+
+void end_kernel(Assembler& assembler)
+{
+    assembler.emit(j_type(Opcode::J, 0));
+}
+
+// Dependent integer arithmetic and logic.
+Kernel alu_kernel()
+{
+    using namespace reg;
+    auto a = Assembler{};
+
+    a.emit(r_type(Funct::ADDU, t0, a0, zero));
+    a.emit(i_type(Opcode::ORI, t1, zero, 3));
+    a.emit(i_type(Opcode::ORI, t2, zero, 5));
+
+    auto const loop = a.here();
+    a.emit(r_type(Funct::ADDU, t3, t1, t2));
+    a.emit(r_type(Funct::SUBU, t4, t3, t1));
+    a.emit(r_type(Funct::AND, t5, t3, t4));
+    a.emit(r_type(Funct::OR, t6, t5, t2));
+    a.emit(r_type(Funct::NOR, t7, t6, t3));
+    a.emit(r_type(Funct::SLT, t8, t7, t6));
+    a.emit(r_type(Funct::SLL, t9, zero, t3, 3));
+    a.emit(r_type(Funct::ADDU, t1, t9, t8));
+    a.emit(i_type(Opcode::ADDIU, t2, t2, 7));
+    a.emit(i_type(Opcode::ADDIU, t0, t0, -1));
+    a.branch(Opcode::BNE, t0, zero, loop);
+
+    end_kernel(a);
+    return {"alu", std::move(a).finish(), 1u << 20};
+}
+
+// Branches on bits of a linear congruential generator, which a host branch
+// predictor cannot learn.
+Kernel branch_kernel()
+{
+    using namespace reg;
+    auto a = Assembler{};
+
+    a.emit(r_type(Funct::ADDU, t0, a0, zero));
+    a.emit(i_type(Opcode::ORI, s0, zero, 1));
+
+    auto const loop = a.here();
+    // s0 = 5 * s0 + 1
+    a.emit(r_type(Funct::SLL, t1, zero, s0, 2));
+    a.emit(r_type(Funct::ADDU, s0, s0, t1));
+    a.emit(i_type(Opcode::ADDIU, s0, s0, 1));
+
+    a.emit(i_type(Opcode::ANDI, t1, s0, 0x4000));
+    auto const skip_first = a.branch_forward(Opcode::BEQ, t1, zero);
+    a.emit(i_type(Opcode::ADDIU, s1, s1, 1));
+    a.place(skip_first);
+
+    a.emit(i_type(Opcode::ANDI, t1, s0, 0x2000));
+    auto const skip_second = a.branch_forward(Opcode::BNE, t1, zero);
+    a.emit(i_type(Opcode::ADDIU, s2, s2, 1));
+    a.place(skip_second);
+
+    a.emit(i_type(Opcode::ANDI, t1, s0, 0x0800));
+    auto const skip_third = a.branch_forward(Opcode::BEQ, t1, zero);
+    a.emit(r_type(Funct::ADDU, s3, s3, s0));
+    a.place(skip_third);
+
+    a.emit(i_type(Opcode::ADDIU, t0, t0, -1));
+    a.branch(Opcode::BNE, t0, zero, loop);
+
+    end_kernel(a);
+    return {"branch", std::move(a).finish(), 1u << 20};
+}
+
+// Signed and unsigned multiplies and divides, with their results read back
+// through HI and LO.
+Kernel muldiv_kernel()
+{
+    using namespace reg;
+    auto a = Assembler{};
+
+    a.emit(r_type(Funct::ADDU, t0, a0, zero));
+    a.emit(i_type(Opcode::ORI, s0, zero, 12345));
+    a.emit(i_type(Opcode::ORI, s1, zero, 678));
+
+    auto const loop = a.here();
+    a.emit(r_type(Funct::MULT, zero, s0, s1));
+    a.emit(r_type(Funct::MFLO, t1, zero, zero));
+    a.emit(r_type(Funct::MFHI, t2, zero, zero));
+    a.emit(r_type(Funct::ADDU, s0, t1, t2));
+
+    // The loop counter, made odd, is never zero.
+    a.emit(i_type(Opcode::ORI, t3, t0, 1));
+    a.emit(r_type(Funct::DIVU, zero, s0, t3));
+    a.emit(r_type(Funct::MFLO, t4, zero, zero));
+    a.emit(r_type(Funct::MFHI, t5, zero, zero));
+    a.emit(r_type(Funct::ADDU, s1, t4, t5));
+    a.emit(i_type(Opcode::ADDIU, s1, s1, 3));
+
+    a.emit(r_type(Funct::DIV, zero, s1, t3));
+    a.emit(r_type(Funct::MFLO, t6, zero, zero));
+    a.emit(r_type(Funct::ADDU, s2, s2, t6));
+
+    a.emit(r_type(Funct::MULTU, zero, s1, s2));
+    a.emit(r_type(Funct::MFHI, t7, zero, zero));
+    a.emit(r_type(Funct::ADDU, s3, s3, t7));
+
+    a.emit(i_type(Opcode::ADDIU, t0, t0, -1));
+    a.branch(Opcode::BNE, t0, zero, loop);
+
+    end_kernel(a);
+    return {"muldiv", std::move(a).finish(), 1u << 19};
+}
+
+// Writes 256 bytes worth of words, then sums them back, moving through a
+// 64 KiB array from one iteration to the next.
+Kernel stream_kernel()
+{
+    using namespace reg;
+    auto a = Assembler{};
+
+    a.emit(r_type(Funct::ADDU, t0, a0, zero));
+    // s0 = 0x10000, the start of the array.
+    a.emit(i_type(Opcode::ORI, s0, zero, 1));
+    a.emit(r_type(Funct::SLL, s0, zero, s0, 16));
+
+    auto const loop = a.here();
+    a.emit(r_type(Funct::ADDU, t1, s0, t4));
+    a.emit(i_type(Opcode::ADDIU, t5, t1, 256));
+    auto const write = a.here();
+    a.emit(i_type(Opcode::SW, t2, t1, 0));
+    a.emit(i_type(Opcode::ADDIU, t2, t2, 1));
+    a.emit(i_type(Opcode::ADDIU, t1, t1, 4));
+    a.branch(Opcode::BNE, t1, t5, write);
+
+    a.emit(r_type(Funct::ADDU, t1, s0, t4));
+    auto const read = a.here();
+    a.emit(i_type(Opcode::LW, t3, t1, 0));
+    a.emit(r_type(Funct::ADDU, s2, s2, t3));
+    a.emit(i_type(Opcode::ADDIU, t1, t1, 4));
+    a.branch(Opcode::BNE, t1, t5, read);
+
+    a.emit(i_type(Opcode::ADDIU, t4, t4, 256));
+    a.emit(i_type(Opcode::ANDI, t4, t4, 0xFFFF));
+
+    a.emit(i_type(Opcode::ADDIU, t0, t0, -1));
+    a.branch(Opcode::BNE, t0, zero, loop);
+
+    end_kernel(a);
+    return {"stream", std::move(a).finish(), 1u << 15};
+}
+
+// Lanes of a batch that go either way of a branch depending on whether
+// they run an odd or even number of iterations, so that neighbouring lanes
+// part on every iteration and meet again once both sides are done, one by
+// jumping and the other by falling through.
+Kernel divergent_kernel()
+{
+    using namespace reg;
+    auto a = Assembler{};
+
+    a.emit(r_type(Funct::ADDU, t0, a0, zero));
+    a.emit(i_type(Opcode::ANDI, s0, a0, 1));
+
+    auto const loop = a.here();
+    auto const odd = a.branch_forward(Opcode::BNE, s0, zero);
+    a.emit(i_type(Opcode::ADDIU, s1, s1, 1));
+    a.emit(r_type(Funct::ADDU, s2, s2, s1));
+    auto const join = a.branch_forward(Opcode::BEQ, zero, zero);
+
+    a.place(odd);
+    a.emit(i_type(Opcode::ADDIU, s1, s1, 3));
+    a.emit(r_type(Funct::SLL, t1, zero, s1, 1));
+    a.emit(r_type(Funct::ADDU, s2, s2, t1));
+
+    a.place(join);
+    a.emit(i_type(Opcode::ADDIU, t0, t0, -1));
+    a.branch(Opcode::BNE, t0, zero, loop);
+
+    end_kernel(a);
+    return {"diverge", std::move(a).finish(), 1u << 20};
+}
+
+struct Timing {
+    std::size_t steps;
+    double seconds;
+};
+
+// Run `iterations` of the kernel in `cpu`, which must be stopped at its
+// start or at its final jump.
+Timing time_kernel(CPU& cpu, Kernel const& kernel, Register iterations)
+{
+    auto const end = static_cast<Register>(4 * (kernel.code.size() - 1));
+
+    if (cpu.pc() == end) {
+        cpu.execute_instruction();
+    }
+
+    cpu.registers()[reg::a0] = iterations;
+
+    auto const start = std::chrono::steady_clock::now();
+    auto const result = cpu.run_until(end);
+    auto const stop = std::chrono::steady_clock::now();
+
+    if (result.reason != StopReason::Breakpoint) {
+        throw std::runtime_error(
+            std::string{"Kernel "} + kernel.name + " did not finish.");
+    }
+
+    return {result.steps, std::chrono::duration<double>(stop - start).count()};
+}
+
+struct Result {
+    std::size_t steps;
+    double seconds;
+    double decode_seconds;
+    Registers registers;
+};
+
+// Best of `repetitions` runs, after a first one to warm up guest memory.
+//
+// The decode cost is how much longer a single iteration takes right after
+// every decoded instruction was thrown away than it does otherwise.
+Result measure(Kernel const& kernel, Dispatch dispatch, int repetitions)
+{
+    constexpr auto infinity = std::numeric_limits<double>::infinity();
+
+    auto cpu = CPU{kernel.code.data(), kernel.code.size(), dispatch};
+    auto const steps = time_kernel(cpu, kernel, kernel.iterations).steps;
+
+    auto full = infinity;
+    auto warm = infinity;
+    auto cold = infinity;
+
+    for (auto i = 0; i < repetitions; ++i) {
+        full = std::min(
+            full, time_kernel(cpu, kernel, kernel.iterations).seconds);
+        warm = std::min(warm, time_kernel(cpu, kernel, 1).seconds);
+
+        cpu.invalidate_instructions();
+        cold = std::min(cold, time_kernel(cpu, kernel, 1).seconds);
+    }
+
+    return {steps, full, std::max(0.0, cold - warm), cpu.registers()};
+}
+
+// Runs the kernel over `lanes` lanes of a batch, with lane `i` doing
+// `iterations + i % 16` iterations so that lanes drop out of the loop at
+// different times. The final jump is left out, for lanes to stop by leaving
+// the program. Returns the best time, checking the registers, HI and LO of
+// the lanes against the table interpreter.
+Timing measure_batch(
+    Kernel const& kernel,
+    SimdLevel level,
+    std::size_t lanes,
+    Register iterations,
+    int repetitions)
+{
+    auto const code = std::vector<RawInstruction>(
+        kernel.code.begin(), kernel.code.end() - 1);
+    auto const iterations_of = [&](std::size_t lane) {
+        return iterations + static_cast<Register>(lane % 16);
+    };
+
+    struct Expected {
+        Registers registers;
+        Register hi;
+        Register lo;
+    };
+
+    auto expected = std::vector<Expected>{};
+    for (auto i = std::size_t{0}; i < std::min(lanes, std::size_t{16}); ++i) {
+        auto cpu = CPU{code.data(), code.size()};
+        cpu.registers()[reg::a0] = iterations_of(i);
+        cpu.run(unlimited_steps);
+        expected.push_back({cpu.registers(), cpu.hi(), cpu.lo()});
+    }
+
+    auto best = Timing{0, std::numeric_limits<double>::infinity()};
+
+    for (auto repetition = 0; repetition < repetitions; ++repetition) {
+        auto batch = Batch{code.data(), code.size(), lanes, level};
+        for (auto i = std::size_t{0}; i < lanes; ++i) {
+            auto registers = Registers{};
+            registers[reg::a0] = iterations_of(i);
+            batch.set_registers(i, registers);
+        }
+
+        auto const start = std::chrono::steady_clock::now();
+        batch.run();
+        auto const stop = std::chrono::steady_clock::now();
+
+        auto steps = std::size_t{0};
+        for (auto i = std::size_t{0}; i < lanes; ++i) {
+            auto const& lane = expected[i % 16];
+
+            if (batch.status(i) != LaneStatus::OutOfProgram or
+                batch.registers(i) != lane.registers or
+                batch.hi(i) != lane.hi or batch.lo(i) != lane.lo) {
+                throw std::runtime_error(
+                    std::string{"Kernel "} + kernel.name + " ran differently"
+                    " in a batch with " + name_of(level) + ".");
+            }
+
+            steps += batch.steps(i);
+        }
+
+        auto const seconds = std::chrono::duration<double>(stop - start);
+        best = {steps, std::min(best.seconds, seconds.count())};
+    }
+
+    return best;
+}
+
+// Batches of 1024 lanes, for the kernels that do not touch memory.
+void run_batch_benchmarks(
+    std::vector<Kernel> const& kernels,
+    int repetitions)
+{
+    constexpr auto lanes = std::size_t{1024};
+
+    auto const levels = {
+        SimdLevel::None,
+        SimdLevel::SSE4,
+        SimdLevel::AVX2,
+        SimdLevel::AVX512,
+    };
+
+    std::printf(
+        "\n%-8s %-9s %12s %10s %10s\n",
+        "batch",
+        "level",
+        "steps",
+        "MIPS",
+        "ns/inst");
+
+    for (auto const& kernel: kernels) {
+        if (std::string{kernel.name} == "stream") {
+            continue;
+        }
+
+        for (auto const level: levels) {
+            if (level > best_simd_level()) {
+                continue;
+            }
+
+            auto const timing = measure_batch(
+                kernel, level, lanes, kernel.iterations / 256, repetitions);
+            auto const steps = static_cast<double>(timing.steps);
+
+            std::printf(
+                "%-8s %-9s %12zu %10.1f %10.2f\n",
+                kernel.name,
+                name_of(level),
+                timing.steps,
+                steps / timing.seconds / 1e6,
+                timing.seconds / steps * 1e9);
+        }
+    }
+}
+
+// Best time for decode_range() at `level` over `image`.
+double measure_bulk_decode(
+    std::vector<RawInstruction> const& image,
+    SimdLevel level,
+    int repetitions)
+{
+    auto fields = DecodedFields{};
+    decode_range(image.data(), image.size(), fields, level);
+
+    auto best = std::numeric_limits<double>::infinity();
+
+    for (auto i = 0; i < repetitions; ++i) {
+        auto const start = std::chrono::steady_clock::now();
+        decode_range(image.data(), image.size(), fields, level);
+        auto const stop = std::chrono::steady_clock::now();
+
+        best = std::min(
+            best, std::chrono::duration<double>(stop - start).count());
+    }
+
+    return best;
+}
+
+// Pre-decoding a 4 MiB text segment made of copies of the kernels.
+void run_bulk_decode_benchmarks(
+    std::vector<Kernel> const& kernels,
+    int repetitions)
+{
+    auto image = std::vector<RawInstruction>{};
+
+    while (image.size() < (std::size_t{4} << 20) / sizeof(RawInstruction)) {
+        for (auto const& kernel: kernels) {
+            image.insert(image.end(), kernel.code.begin(), kernel.code.end());
+        }
+    }
+
+    auto const levels = {SimdLevel::None, SimdLevel::SSE4, SimdLevel::AVX2};
+
+    std::printf(
+        "\n%-8s %12s %10s %10s\n", "bulk", "instructions", "us", "ns/inst");
+
+    for (auto const level: levels) {
+        if (level > best_simd_level()) {
+            continue;
+        }
+
+        auto const seconds = measure_bulk_decode(image, level, repetitions);
+
+        std::printf(
+            "%-8s %12zu %10.1f %10.2f\n",
+            name_of(level),
+            image.size(),
+            seconds * 1e6,
+            seconds / static_cast<double>(image.size()) * 1e9);
+    }
+}
+
+void run_benchmarks(int repetitions)
+{
+    auto const kernels = std::vector<Kernel>{
+        alu_kernel(),
+        branch_kernel(),
+        muldiv_kernel(),
+        stream_kernel(),
+    };
+
+    auto const dispatches = {
+        Dispatch::Table,
+        Dispatch::Threaded,
+        Dispatch::Blocks,
+        Dispatch::Jit,
+    };
+
+    std::printf(
+        "%-8s %-9s %12s %10s %10s %16s\n",
+        "kernel",
+        "dispatch",
+        "steps",
+        "MIPS",
+        "ns/inst",
+        "decode ns/inst");
+
+    for (auto const& kernel: kernels) {
+        auto expected = std::optional<Registers>{};
+
+        for (auto const dispatch: dispatches) {
+            auto const result = measure(kernel, dispatch, repetitions);
+
+            // Every dispatch must end up where the table interpreter does.
+            if (not expected) {
+                expected = result.registers;
+            } else if (result.registers != *expected) {
+                throw std::runtime_error(
+                    std::string{"Kernel "} + kernel.name + " ran differently"
+                    " with dispatch " + name_of(dispatch) + ".");
+            }
+
+            auto const steps = static_cast<double>(result.steps);
+            auto const size = static_cast<double>(kernel.code.size());
+
+            std::printf(
+                "%-8s %-9s %12zu %10.1f %10.2f %16.1f\n",
+                kernel.name,
+                name_of(dispatch),
+                result.steps,
+                steps / result.seconds / 1e6,
+                result.seconds / steps * 1e9,
+                result.decode_seconds / size * 1e9);
+        }
+    }
+
+    auto batch_kernels = kernels;
+    batch_kernels.push_back(divergent_kernel());
+
+    run_batch_benchmarks(batch_kernels, repetitions);
+    run_bulk_decode_benchmarks(kernels, repetitions);
+}
+
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    auto repetitions = 5;
+
+    if (argc > 1) {
+        repetitions = std::max(1, std::stoi(argv[1]));
+    }
+
+    try {
+        mercury::run_benchmarks(repetitions);
+    } catch (std::runtime_error const& error) {
+        std::cerr << error.what() << '\n';
+        return 1;
+    }
+}
@@ -0,0 +1,161 @@
+#include "block_cache.hpp"
+
+#include "cpu_internals.hpp"
+#include "decoder.hpp"
+#include "instruction_spec.hpp"
+#include "specializer.hpp"
+#include "superinstructions.hpp"
+
+namespace mercury {
+
+// Instructions that may trap end their block too, so that the run loops
+// only need to look for traps between blocks.
+static bool ends_block(DecodedInstruction instruction)
+{
+    return instruction.operation == Operation::UNKNOWN or
+           spec_for(instruction.operation).flow != Flow::Next;
+}
+
+// With `fusion`, superinstructions run the instructions they start with,
+// and everything else runs one instruction at a time.
+static std::vector<Block::Step> plan(
+    std::vector<DecodedInstruction> const& instructions,
+    bool fusion)
+{
+    auto steps = std::vector<Block::Step>{};
+    auto const count = instructions.size();
+
+    for (auto i = std::size_t{0}; i < count;) {
+        auto const* first = &instructions[i];
+        auto const found = fusion ? find_superinstruction(first, count - i)
+                                  : std::nullopt;
+
+        if (found) {
+            steps.push_back({superinstruction_handlers[*found], first});
+            i += superinstructions[*found].length;
+        } else {
+            steps.push_back({single_handlers[first->operation], first});
+            ++i;
+        }
+    }
+
+    return steps;
+}
+
+// With `fusion`, an instruction that fuses with the one before it replaces
+// that one in the block.
+static std::unique_ptr<Block> translate(
+    Memory& memory,
+    AddressRange code,
+    Register pc,
+    bool fusion)
+{
+    auto block = std::make_unique<Block>();
+    block->start = pc;
+    block->end = pc;
+
+    while (code.contains(block->end) and
+           block->size() < BlockCache::max_block_size) {
+        auto const decoded = specialize(
+            decode_instruction(memory.load<RawInstruction>(block->end)));
+        auto& instructions = block->instructions;
+        auto const fused = fusion and not instructions.empty()
+                               ? fuse(instructions.back(), decoded)
+                               : std::nullopt;
+
+        if (fused) {
+            instructions.back() = *fused;
+        } else {
+            instructions.push_back(decoded);
+        }
+
+        block->end += 4;
+
+        if (ends_block(decoded)) {
+            break;
+        }
+    }
+
+    block->steps = plan(block->instructions, fusion);
+
+    return block;
+}
+
+Block* BlockCache::fetch(Memory& memory, AddressRange code, Register pc)
+{
+    retired.clear();
+
+    if (not previous) {
+        return previous = lookup(memory, code, pc);
+    }
+
+    auto& successors = previous->successors;
+
+    for (auto successor: successors) {
+        if (successor and successor->start == pc) {
+            return previous = successor;
+        }
+    }
+
+    auto const slot = std::size_t{pc == previous->end ? 0u : 1u};
+
+    return previous = successors[slot] = lookup(memory, code, pc);
+}
+
+Block* BlockCache::lookup(Memory& memory, AddressRange code, Register pc)
+{
+    if (not code.contains(pc)) {
+        return nullptr;
+    }
+
+    auto& block = blocks[pc];
+
+    if (not block) {
+        block = translate(memory, code, pc, fusion);
+    }
+
+    return block.get();
+}
+
+void BlockCache::invalidate(Register address)
+{
+    constexpr auto max_block_bytes = Register{4 * max_block_size};
+
+    // Blocks may overlap, and any that starts less than a maximal block
+    // before `address` may cover it.
+    for (auto next = blocks.upper_bound(address); next != blocks.begin();) {
+        auto const& block = *(--next)->second;
+
+        if (address - block.start >= max_block_bytes) {
+            return;
+        }
+
+        if (address < block.end) {
+            // Blocks hold raw links to each other, so dropping all of them
+            // is the simple way to be sure no chain leads to stale code.
+            invalidate();
+            return;
+        }
+    }
+}
+
+void BlockCache::invalidate()
+{
+    for (auto& [start, block]: blocks) {
+        block->valid = false;
+        retired.push_back(std::move(block));
+    }
+
+    blocks.clear();
+    previous = nullptr;
+}
+
+void BlockCache::set_fusion(bool enabled)
+{
+    if (fusion != enabled) {
+        fusion = enabled;
+        invalidate();
+    }
+}
+
+}
@@ -0,0 +1,91 @@
+#ifndef MERCURY_BLOCK_CACHE_HPP
+#define MERCURY_BLOCK_CACHE_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "decoded_instruction.hpp"
+#include "jit.hpp"
+#include "memory.hpp"
+#include "profile.hpp"
+#include "registers.hpp"
+
+namespace mercury {
+
+// A straight-line run of instructions, ending at the first branch or jump.
+struct Block {
+    Register start;
+    Register end;
+    // Specialized, and possibly fused, so there may be fewer of these than
+    // guest instructions.
+    std::vector<DecodedInstruction> instructions;
+
+    // How the interpreter runs the instructions: one dispatch per
+    // superinstruction found among them, and one per instruction left.
+    struct Step {
+        SequenceHandler handler;
+        DecodedInstruction const* instructions;
+    };
+
+    std::vector<Step> steps;
+
+    // Cleared when the block is invalidated, possibly by one of its own
+    // instructions.
+    bool valid{true};
+
+    // The blocks this one was last seen exiting to. Slot 0 is the
+    // fall-through, slot 1 the last taken branch or jump target.
+    std::array<Block*, 2> successors{};
+
+    // How many times the block was interpreted, and what it was compiled
+    // to once that reached jit_threshold, with Dispatch::Jit.
+    std::uint32_t runs{0};
+    std::unique_ptr<CompiledBlock> compiled;
+
+    // How many guest instructions the block covers.
+    std::size_t size() const
+    {
+        return (end - start) / 4;
+    }
+};
+
+// Translates the program into blocks on demand and chains each block to its
+// successors, so that a hot loop goes from block to block without looking
+// anything up.
+class BlockCache {
+public:
+    static constexpr auto max_block_size = std::size_t{64};
+
+    // Get the block starting at `pc`, or nullptr if `pc` is outside of
+    // `code`.
+    Block* fetch(Memory& memory, AddressRange code, Register pc);
+
+    // Invalidated blocks stay alive until the next fetch, since a store from
+    // within a block may invalidate the block itself.
+    void invalidate(Register address);
+    void invalidate();
+
+    // Whether pairs of instructions may be fused into one operation, and
+    // sequences of them run as superinstructions, which is on unless
+    // profiling. Profiles and traces need to see every instruction run on
+    // its own.
+    void set_fusion(bool enabled);
+
+private:
+    Block* lookup(Memory& memory, AddressRange code, Register pc);
+
+    // By start address, so that the blocks covering an address are found
+    // among the few that start just before it.
+    std::map<Register, std::unique_ptr<Block>> blocks;
+    std::vector<std::unique_ptr<Block>> retired;
+    Block* previous{nullptr};
+    bool fusion{not profiling};
+};
+
+}
+
+#endif
@@ -0,0 +1,279 @@
+#include "bulk_decoder.hpp"
+
+#include <array>
+#include <stdexcept>
+#include <string>
+
+#include "decoder.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MERCURY_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace mercury {
+
+namespace {
+
+// A field of every instruction, shifted down and masked.
+constexpr std::uint32_t low_mask(FieldInfo info)
+{
+    return info.mask >> info.position;
+}
+
+// Decode [begin, end) one instruction at a time, for the tail that does not
+// fill a vector, or for machines without one.
+void decode_scalar(
+    RawInstruction const* instructions,
+    std::size_t begin,
+    std::size_t end,
+    DecodedFields& fields)
+{
+    for (auto i = begin; i < end; ++i) {
+        auto const raw = instructions[i];
+
+        fields.operation[i] = decode_table[decode_table_index(raw)].operation;
+        fields.opcode[i] = get_field<std::uint8_t>(raw, info::opcode);
+        fields.rs[i] = get_field<std::uint8_t>(raw, info::rs);
+        fields.rt[i] = get_field<std::uint8_t>(raw, info::rt);
+        fields.rd[i] = get_field<std::uint8_t>(raw, info::rd);
+        fields.shamt[i] = get_field<std::uint8_t>(raw, info::shamt);
+        fields.funct[i] = get_field<std::uint8_t>(raw, info::funct);
+        fields.immediate[i] = get_field<std::uint16_t>(raw, info::immediate);
+    }
+}
+
+#ifdef MERCURY_X86_SIMD
+
+// The operation column of decode_table, as bytes to shuffle from.
+constexpr std::array<std::uint8_t, 128> make_operation_bytes()
+{
+    auto bytes = std::array<std::uint8_t, 128>{};
+    for (auto i = std::size_t{0}; i < bytes.size(); ++i) {
+        bytes[i] = value_of(decode_table[i].operation);
+    }
+
+    return bytes;
+}
+
+alignas(16) constexpr auto operation_bytes = make_operation_bytes();
+
+// Each field is a shift and a mask of every lane, after which packing with
+// unsigned saturation narrows the lanes without changing them.
+
+__attribute__((target("sse4.1"))) __m128i
+sse4_field(__m128i instructions, FieldInfo info)
+{
+    return _mm_and_si128(
+        _mm_srli_epi32(instructions, info.position),
+        _mm_set1_epi32(static_cast<int>(low_mask(info))));
+}
+
+// Eight fields, in order, as 16-bit lanes.
+__attribute__((target("sse4.1"))) __m128i
+sse4_field16(__m128i low, __m128i high, FieldInfo info)
+{
+    return _mm_packus_epi32(sse4_field(low, info), sse4_field(high, info));
+}
+
+// Eight fields, in order, in the low half.
+__attribute__((target("sse4.1"))) __m128i
+sse4_field8(__m128i low, __m128i high, FieldInfo info)
+{
+    auto const words = sse4_field16(low, high, info);
+    return _mm_packus_epi16(words, words);
+}
+
+// The operations of sixteen instructions, from their opcodes and functs:
+// decode_table_index() on every byte, then a lookup in each sixteen-byte
+// slice of operation_bytes, keeping the lanes whose index is in that slice.
+__attribute__((target("sse4.1"))) __m128i
+sse4_operations(__m128i opcode, __m128i funct)
+{
+    auto const r_format = _mm_cmpeq_epi8(opcode, _mm_setzero_si128());
+    auto const index = _mm_blendv_epi8(
+        opcode, _mm_add_epi8(funct, _mm_set1_epi8(64)), r_format);
+    auto const slice =
+        _mm_and_si128(_mm_srli_epi16(index, 4), _mm_set1_epi8(0x0F));
+
+    auto operations = _mm_setzero_si128();
+    for (auto i = 0; i < 8; ++i) {
+        auto const bytes = _mm_load_si128(
+            reinterpret_cast<__m128i const*>(operation_bytes.data() + 16 * i));
+        auto const in_slice =
+            _mm_cmpeq_epi8(slice, _mm_set1_epi8(static_cast<char>(i)));
+        operations = _mm_or_si128(
+            operations,
+            _mm_and_si128(in_slice, _mm_shuffle_epi8(bytes, index)));
+    }
+
+    return operations;
+}
+
+__attribute__((target("sse4.1"))) void
+store8(std::uint8_t* destination, __m128i bytes)
+{
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(destination), bytes);
+}
+
+__attribute__((target("sse4.1"))) std::size_t decode_sse4(
+    RawInstruction const* instructions,
+    std::size_t count,
+    DecodedFields& fields)
+{
+    constexpr auto width = std::size_t{8};
+    auto i = std::size_t{0};
+
+    for (; i + width <= count; i += width) {
+        auto const low = _mm_loadu_si128(
+            reinterpret_cast<__m128i const*>(instructions + i));
+        auto const high = _mm_loadu_si128(
+            reinterpret_cast<__m128i const*>(instructions + i + 4));
+
+        auto const opcode = sse4_field8(low, high, info::opcode);
+        auto const funct = sse4_field8(low, high, info::funct);
+
+        store8(
+            reinterpret_cast<std::uint8_t*>(&fields.operation[i]),
+            sse4_operations(opcode, funct));
+        store8(&fields.opcode[i], opcode);
+        store8(&fields.rs[i], sse4_field8(low, high, info::rs));
+        store8(&fields.rt[i], sse4_field8(low, high, info::rt));
+        store8(&fields.rd[i], sse4_field8(low, high, info::rd));
+        store8(&fields.shamt[i], sse4_field8(low, high, info::shamt));
+        store8(&fields.funct[i], funct);
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(&fields.immediate[i]),
+            sse4_field16(low, high, info::immediate));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2"))) __m256i
+avx2_field(__m256i instructions, FieldInfo info)
+{
+    return _mm256_and_si256(
+        _mm256_srli_epi32(instructions, info.position),
+        _mm256_set1_epi32(static_cast<int>(low_mask(info))));
+}
+
+// Sixteen fields, in order, as 16-bit lanes. Packing works within each
+// 128-bit half, so the middle quarters need swapping back.
+__attribute__((target("avx2"))) __m256i
+avx2_field16(__m256i low, __m256i high, FieldInfo info)
+{
+    auto const packed =
+        _mm256_packus_epi32(avx2_field(low, info), avx2_field(high, info));
+
+    return _mm256_permute4x64_epi64(packed, 0b11'01'10'00);
+}
+
+// Sixteen fields, in order, as bytes.
+__attribute__((target("avx2"))) __m128i
+avx2_field8(__m256i low, __m256i high, FieldInfo info)
+{
+    auto const words = avx2_field16(low, high, info);
+    return _mm_packus_epi16(
+        _mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+}
+
+__attribute__((target("avx2"))) void
+store16(std::uint8_t* destination, __m128i bytes)
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination), bytes);
+}
+
+__attribute__((target("avx2"))) std::size_t decode_avx2(
+    RawInstruction const* instructions,
+    std::size_t count,
+    DecodedFields& fields)
+{
+    constexpr auto width = std::size_t{16};
+    auto i = std::size_t{0};
+
+    for (; i + width <= count; i += width) {
+        auto const low = _mm256_loadu_si256(
+            reinterpret_cast<__m256i const*>(instructions + i));
+        auto const high = _mm256_loadu_si256(
+            reinterpret_cast<__m256i const*>(instructions + i + 8));
+
+        auto const opcode = avx2_field8(low, high, info::opcode);
+        auto const funct = avx2_field8(low, high, info::funct);
+
+        store16(
+            reinterpret_cast<std::uint8_t*>(&fields.operation[i]),
+            sse4_operations(opcode, funct));
+        store16(&fields.opcode[i], opcode);
+        store16(&fields.rs[i], avx2_field8(low, high, info::rs));
+        store16(&fields.rt[i], avx2_field8(low, high, info::rt));
+        store16(&fields.rd[i], avx2_field8(low, high, info::rd));
+        store16(&fields.shamt[i], avx2_field8(low, high, info::shamt));
+        store16(&fields.funct[i], funct);
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i*>(&fields.immediate[i]),
+            avx2_field16(low, high, info::immediate));
+    }
+
+    return i;
+}
+
+#endif
+
+}
+
+void DecodedFields::resize(std::size_t size)
+{
+    operation.resize(size);
+    opcode.resize(size);
+    rs.resize(size);
+    rt.resize(size);
+    rd.resize(size);
+    shamt.resize(size);
+    funct.resize(size);
+    immediate.resize(size);
+}
+
+void decode_range(
+    RawInstruction const* instructions,
+    std::size_t count,
+    DecodedFields& fields,
+    SimdLevel level)
+{
+    if (level > best_simd_level()) {
+        throw std::invalid_argument(
+            std::string{"This machine does not support "} + name_of(level) +
+            ".");
+    }
+
+    fields.resize(count);
+
+    auto decoded = std::size_t{0};
+
+#ifdef MERCURY_X86_SIMD
+    switch (level) {
+        case SimdLevel::None:
+            break;
+        case SimdLevel::SSE4:
+            decoded = decode_sse4(instructions, count, fields);
+            break;
+        case SimdLevel::AVX2:
+        case SimdLevel::AVX512:
+            decoded = decode_avx2(instructions, count, fields);
+            break;
+    }
+#endif
+
+    decode_scalar(instructions, decoded, count, fields);
+}
+
+DecodedFields
+decode_range(RawInstruction const* instructions, std::size_t count)
+{
+    auto fields = DecodedFields{};
+    decode_range(instructions, count, fields, best_simd_level());
+
+    return fields;
+}
+
+}
@@ -0,0 +1,52 @@
+#ifndef MERCURY_BULK_DECODER_HPP
+#define MERCURY_BULK_DECODER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "decoded_instruction.hpp"
+#include "instruction_formats.hpp"
+#include "simd.hpp"
+
+namespace mercury {
+
+// The fields of a run of instructions, one array per field, so that a whole
+// text segment can be scanned a field at a time.
+//
+// `operation` is what decode_instruction() would find for each instruction,
+// and the other fields are the raw ones, whatever the format.
+struct DecodedFields {
+    std::vector<Operation> operation;
+    std::vector<std::uint8_t> opcode;
+    std::vector<std::uint8_t> rs;
+    std::vector<std::uint8_t> rt;
+    std::vector<std::uint8_t> rd;
+    std::vector<std::uint8_t> shamt;
+    std::vector<std::uint8_t> funct;
+    std::vector<std::uint16_t> immediate;
+
+    std::size_t size() const
+    {
+        return operation.size();
+    }
+
+    void resize(std::size_t size);
+};
+
+// Decode `count` instructions, in host byte order, into `fields`, which is
+// resized to fit. `level` must be supported by this machine. It decodes
+// eight instructions at a time with SSE4, and sixteen with AVX2 and above.
+void decode_range(
+    RawInstruction const* instructions,
+    std::size_t count,
+    DecodedFields& fields,
+    SimdLevel level);
+
+// Decode `count` instructions with the best level this machine supports.
+DecodedFields
+decode_range(RawInstruction const* instructions, std::size_t count);
+
+}
+
+#endif
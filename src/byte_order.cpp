@@ -0,0 +1,94 @@
+#include "byte_order.hpp"
+
+#include <cstring>
+
+#include "simd.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MERCURY_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace mercury {
+
+static_assert(swap_bytes(0x12345678u) == 0x78563412u);
+
+namespace {
+
+// Swap the words of [begin, end) one at a time, for the tail that does not
+// fill a vector, or for machines without one.
+void swap_scalar(std::byte* data, std::size_t begin, std::size_t end)
+{
+    for (auto offset = begin; offset + 4 <= end; offset += 4) {
+        auto word = std::uint32_t{};
+        std::memcpy(&word, data + offset, sizeof(word));
+        word = swap_bytes(word);
+        std::memcpy(data + offset, &word, sizeof(word));
+    }
+}
+
+#ifdef MERCURY_X86_SIMD
+
+// Each swaps as many bytes as fill its vectors, and returns how many that
+// was.
+
+__attribute__((target("ssse3"))) std::size_t
+swap_ssse3(std::byte* data, std::size_t size)
+{
+    auto const shuffle = _mm_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    auto offset = std::size_t{0};
+
+    for (; offset + 16 <= size; offset += 16) {
+        auto* at = reinterpret_cast<__m128i*>(data + offset);
+        _mm_storeu_si128(at, _mm_shuffle_epi8(_mm_loadu_si128(at), shuffle));
+    }
+
+    return offset;
+}
+
+__attribute__((target("avx2"))) std::size_t
+swap_avx2(std::byte* data, std::size_t size)
+{
+    auto const shuffle = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    auto offset = std::size_t{0};
+
+    for (; offset + 32 <= size; offset += 32) {
+        auto* at = reinterpret_cast<__m256i*>(data + offset);
+        _mm256_storeu_si256(
+            at, _mm256_shuffle_epi8(_mm256_loadu_si256(at), shuffle));
+    }
+
+    return offset;
+}
+
+#endif
+
+}
+
+void swap_word_bytes(std::byte* data, std::size_t size)
+{
+    auto swapped = std::size_t{0};
+
+#ifdef MERCURY_X86_SIMD
+    switch (best_simd_level()) {
+        case SimdLevel::None:
+            break;
+        case SimdLevel::SSE4:
+            swapped = swap_ssse3(data, size);
+            break;
+        case SimdLevel::AVX2:
+        case SimdLevel::AVX512:
+            swapped = swap_avx2(data, size);
+            break;
+    }
+#endif
+
+    swap_scalar(data, swapped, size);
+}
+
+}
@@ -0,0 +1,21 @@
+#ifndef MERCURY_BYTE_ORDER_HPP
+#define MERCURY_BYTE_ORDER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mercury {
+
+constexpr std::uint32_t swap_bytes(std::uint32_t value)
+{
+    return ((value & 0x000000FFu) << 24) | ((value & 0x0000FF00u) << 8) |
+           ((value & 0x00FF0000u) >> 8) | ((value & 0xFF000000u) >> 24);
+}
+
+// Reverse the bytes of every 32-bit word in `data`, in place. `size` must be
+// a multiple of 4. Uses SIMD shuffles when the machine has them.
+void swap_word_bytes(std::byte* data, std::size_t size);
+
+}
+
+#endif
@@ -1,435 +1,466 @@
 #include "cpu.hpp"
 
-#include <iostream>
+#include <stdexcept>
+#include <utility>
 
-#include "bitwise.hpp"
-#include "decoder.hpp"
-#include "enum_indexed_array.hpp"
+#include "cpu_internals.hpp"
 
 namespace mercury {
 
-using RInstructionHandler = void (CPUInternals::*)(RInstruction);
-using IInstructionHandler = void (CPUInternals::*)(IInstruction);
-using JInstructionHandler = void (CPUInternals::*)(JInstruction);
+char const* name_of(Dispatch dispatch)
+{
+    switch (dispatch) {
+        case Dispatch::Table:
+            return "table";
+        case Dispatch::Threaded:
+            return "threaded";
+        case Dispatch::Blocks:
+            return "blocks";
+        case Dispatch::Jit:
+            return "jit";
+    }
+
+    return "?";
+}
 
-using RInstructionHandlers =
-    EnumIndexedArray<Funct, RInstructionHandler, Funct::SLTU>;
-using IInstructionHandlers =
-    EnumIndexedArray<Opcode, IInstructionHandler, Opcode::SC>;
-using JInstructionHandlers =
-    EnumIndexedArray<Opcode, JInstructionHandler, Opcode::JAL>;
+CPU::CPU(Dispatch dispatch):
+    dispatch_{dispatch}, impl{std::make_unique<CPUInternals>()}
+{}
 
-constexpr auto as_signed(std::uint32_t u)
+CPU::CPU(
+    RawInstruction const* program,
+    std::size_t program_size,
+    Dispatch dispatch):
+    CPU{dispatch}
 {
-    return static_cast<std::int32_t>(u);
+    auto const size = program_size * sizeof(RawInstruction);
+
+    impl->memory.write(0, program, size);
+    auto const end = static_cast<Address>(size);
+    start({0, {0, end}, end});
 }
 
-constexpr auto as_unsigned(std::int32_t s)
+CPU::CPU(CPU& sibling, Dispatch dispatch):
+    dispatch_{dispatch},
+    impl{std::make_unique<CPUInternals>(*sibling.impl)}
+{}
+
+CPU::CPU(Snapshot const& snapshot, Dispatch dispatch): CPU{dispatch}
 {
-    return static_cast<std::uint32_t>(s);
+    restore(snapshot);
 }
 
-constexpr auto as_signed(std::uint16_t u)
+CPU::~CPU() = default;
+
+void CPU::start(Program const& program)
 {
-    return static_cast<std::int16_t>(u);
+    impl->pc = program.entry;
+    impl->trap_pending = false;
+    impl->code = program.code;
+    impl->memory.mark_code(program.code);
+    impl->invalidate_code();
+
+    if constexpr (profiling) {
+        impl->profile.reset(program.code);
+    }
 }
 
-constexpr auto as_unsigned(std::int16_t s)
+Registers& CPU::registers()
 {
-    return static_cast<std::uint16_t>(s);
+    return impl->register_bank;
 }
 
-constexpr auto zero_extend(std::uint16_t u)
+Registers const& CPU::registers() const
 {
-    return static_cast<std::uint32_t>(u);
+    return impl->register_bank;
 }
 
-constexpr auto sign_extend(std::int16_t u)
+Register CPU::pc() const
 {
-    return static_cast<std::int32_t>(u);
+    return impl->pc;
 }
 
-constexpr auto sign_extend(std::uint16_t u)
+Register CPU::hi() const
 {
-    return sign_extend(as_signed(u));
+    return impl->hi;
 }
 
-struct CPUInternals {
-    CPUInternals(): register_bank{}
-    {
-        for (auto&& r: register_bank) {
-            r = 0u;
-        }
-    }
-
-    void unknown_r_instruction(RInstruction)
-    {
-        std::cout << "unknown_r_instruction\n";
-    }
+Register CPU::lo() const
+{
+    return impl->lo;
+}
 
-    void unknown_i_instruction(IInstruction)
-    {
-        std::cout << "unknown_i_instruction\n";
-    }
+Memory& CPU::memory()
+{
+    return impl->memory;
+}
 
-    void unknown_j_instruction(JInstruction)
-    {
-        std::cout << "unknown_j_instruction\n";
-    }
+Memory const& CPU::memory() const
+{
+    return impl->memory;
+}
 
-    /* Basic R instructions */
+bool CPU::trap_pending() const
+{
+    return impl->trap_pending;
+}
 
-    void add(RInstruction instruction)
-    {
-        auto rs = as_signed(register_bank[instruction.rs]);
-        auto rt = as_signed(register_bank[instruction.rt]);
+Register CPU::epc() const
+{
+    return impl->epc;
+}
 
-        register_bank[instruction.rd] = as_unsigned(rs + rt);
-    }
+Register CPU::cause() const
+{
+    return impl->cause;
+}
 
-    void addu(RInstruction instruction)
-    {
-        auto rs = register_bank[instruction.rs];
-        auto rt = register_bank[instruction.rt];
+void CPU::return_from_trap(Register pc)
+{
+    impl->pc = pc;
+    impl->trap_pending = false;
+}
 
-        register_bank[instruction.rd] = rs + rt;
-    }
+Profile const& CPU::profile() const
+{
+    return impl->profile;
+}
 
-    void bitwise_and(RInstruction instruction)
-    {
-        auto rs = register_bank[instruction.rs];
-        auto rt = register_bank[instruction.rt];
+void CPU::invalidate_instruction(Register address)
+{
+    impl->invalidate_code(address);
+}
 
-        register_bank[instruction.rd] = rs & rt;
-    }
+void CPU::invalidate_instructions()
+{
+    impl->invalidate_code();
+}
 
-    void jr(RInstruction instruction)
-    {
-        pc = register_bank[instruction.rs];
-    }
+void CPU::attach(aot::Module const& module)
+{
+    auto const& code = module.code;
 
-    void nor(RInstruction instruction)
-    {
-        auto rs = register_bank[instruction.rs];
-        auto rt = register_bank[instruction.rt];
+    for (auto address = code.begin; address < code.end; address += 4) {
+        auto const index = (address - code.begin) / 4;
 
-        register_bank[instruction.rd] = ~(rs | rt);
+        if (impl->memory.load<RawInstruction>(address) !=
+            module.instructions[index]) {
+            throw std::invalid_argument(
+                "The module was not translated from this program.");
+        }
     }
 
-    void bitwise_or(RInstruction instruction)
-    {
-        auto rs = register_bank[instruction.rs];
-        auto rt = register_bank[instruction.rt];
-
-        register_bank[instruction.rd] = rs | rt;
-    }
+    impl->translation = &module;
+}
 
-    void slt(RInstruction instruction)
-    {
-        auto rs = as_signed(register_bank[instruction.rs]);
-        auto rt = as_signed(register_bank[instruction.rt]);
+void CPU::detach()
+{
+    impl->translation = nullptr;
+}
 
-        register_bank[instruction.rd] = rs < rt;
+void CPU::trace_to(std::string const& path)
+{
+    if constexpr (not tracing) {
+        throw std::logic_error("Tracing needs a build with MERCURY_TRACE.");
     }
 
-    void sltu(RInstruction instruction)
-    {
-        auto rs = register_bank[instruction.rs];
-        auto rt = register_bank[instruction.rt];
+    stop_trace();
+    impl->trace = std::make_unique<TraceWriter>(path);
+    impl->block_cache.set_fusion(false);
+}
 
-        register_bank[instruction.rd] = rs < rt;
+void CPU::stop_trace()
+{
+    if (impl->trace) {
+        auto trace = std::move(impl->trace);
+        impl->block_cache.set_fusion(not profiling);
+        trace->close();
     }
+}
 
-    void sll(RInstruction instruction)
-    {
-        auto rt = as_signed(register_bank[instruction.rt]);
+void CPU::report_code_to(PerfMap* map, SymbolTable symbols)
+{
+    impl->perf_map = map;
+    impl->symbols = std::move(symbols);
+}
 
-        register_bank[instruction.rd] = as_unsigned(rt << instruction.shamt);
-    }
+Snapshot CPU::snapshot()
+{
+    return {
+        impl->register_bank,
+        impl->hi,
+        impl->lo,
+        impl->pc,
+        impl->epc,
+        impl->cause,
+        impl->trap_pending,
+        impl->code,
+        impl->memory.snapshot(),
+    };
+}
 
-    void srl(RInstruction instruction)
-    {
-        auto rt = as_signed(register_bank[instruction.rt]);
+void CPU::restore(Snapshot const& snapshot)
+{
+    auto const code_changed = impl->memory.restore(snapshot.memory);
 
-        register_bank[instruction.rd] = as_unsigned(rt << instruction.shamt);
+    if (code_changed or snapshot.code.begin != impl->code.begin or
+        snapshot.code.end != impl->code.end) {
+        impl->code = snapshot.code;
+        impl->invalidate_code();
     }
 
-    void sub(RInstruction instruction)
-    {
-        auto rs = as_signed(register_bank[instruction.rs]);
-        auto rt = as_signed(register_bank[instruction.rt]);
+    impl->register_bank = snapshot.registers;
+    impl->hi = snapshot.hi;
+    impl->lo = snapshot.lo;
+    impl->pc = snapshot.pc;
+    impl->epc = snapshot.epc;
+    impl->cause = snapshot.cause;
+    impl->trap_pending = snapshot.trap_pending;
+    impl->link.reset();
+    impl->code_generation = impl->memory.code_generation();
 
-        register_bank[instruction.rd] = as_unsigned(rs - rt);
+    if constexpr (profiling) {
+        impl->profile.reset(impl->code);
     }
+}
 
-    void subu(RInstruction instruction)
-    {
-        auto rs = register_bank[instruction.rs];
-        auto rt = register_bank[instruction.rt];
+// Instructions are word-aligned, so no PC ever reaches this breakpoint.
+constexpr auto no_breakpoint = ~Register{0};
 
-        register_bank[instruction.rd] = rs - rt;
-    }
+static void step(CPUInternals& impl)
+{
+    auto const& decoded = impl.instruction_cache.fetch(impl.memory, impl.pc);
 
-    /* Multiplication R instructions */
+    impl.pc += 4;
 
-    void mfhi(RInstruction instruction)
-    {
-        register_bank[instruction.rd] = hi;
-    }
+    dispatch(impl, decoded);
+}
 
-    void mflo(RInstruction instruction)
-    {
-        register_bank[instruction.rd] = lo;
-    }
+// Returns how many instructions were executed, which is less than the size
+// of the block if it overwrote its own code or a load or store trapped.
+static std::size_t execute(CPUInternals& impl, Block const& block)
+{
+    for (auto const& step: block.steps) {
+        step.handler(impl, step.instructions);
 
-    void mult(RInstruction instruction)
-    {
-        auto rs =
-            static_cast<int64_t>(as_signed(register_bank[instruction.rs]));
-        auto rt =
-            static_cast<int64_t>(as_signed(register_bank[instruction.rt]));
+        if (impl.trap_pending) {
+            // The PC is back on the instruction that trapped, which counts
+            // as executed.
+            return (impl.pc - block.start) / 4 + 1;
+        }
 
-        auto result = static_cast<uint64_t>(rs * rt);
-        lo = static_cast<Register>((result & 0xFFFFFFFF00000000) >> 32);
-        hi = static_cast<Register>(result & 0x00000000FFFFFFFF);
+        if (not block.valid) {
+            // Only stores invalidate blocks, and they move on to the next
+            // instruction.
+            return (impl.pc - block.start) / 4;
+        }
     }
 
-    void multu(RInstruction instruction)
-    {
-        auto rs = static_cast<uint64_t>(register_bank[instruction.rs]);
-        auto rt = static_cast<uint64_t>(register_bank[instruction.rt]);
+    return block.size();
+}
 
-        auto result = rs * rt;
-        lo = static_cast<Register>((result & 0xFFFFFFFF00000000) >> 32);
-        hi = static_cast<Register>(result & 0x00000000FFFFFFFF);
+void CPU::execute_instruction()
+{
+    if (impl->trap_pending) {
+        return;
     }
 
-    void div(RInstruction instruction)
-    {
-        auto rs = as_signed(register_bank[instruction.rs]);
-        auto rt = as_signed(register_bank[instruction.rt]);
+    impl->synchronize_code();
+    step(*impl);
+}
 
-        lo = as_unsigned(rs / rt);
-        hi = as_unsigned(rs % rt);
+void CPU::execute_block()
+{
+    if (impl->trap_pending) {
+        return;
     }
 
-    void divu(RInstruction instruction)
-    {
-        auto rs = register_bank[instruction.rs];
-        auto rt = register_bank[instruction.rt];
+    impl->synchronize_code();
 
-        lo = rs / rt;
-        hi = rs % rt;
+    auto const* block =
+        impl->block_cache.fetch(impl->memory, impl->code, impl->pc);
+
+    if (not block) {
+        execute_instruction();
+        return;
     }
 
-    /* I instructions */
+    execute(*impl, *block);
+}
 
-    void addi(IInstruction instruction)
-    {
-        auto rs = as_signed(register_bank[instruction.rs]);
+RunResult CPU::run(std::size_t max_steps)
+{
+    return run(max_steps, no_breakpoint);
+}
 
-        register_bank[instruction.rt] =
-            as_unsigned(rs + sign_extend(instruction.immediate));
-    }
+RunResult CPU::run_until(Register breakpoint, std::size_t max_steps)
+{
+    return run(max_steps, breakpoint);
+}
 
-    void addiu(IInstruction instruction)
-    {
-        auto rs = register_bank[instruction.rs];
+RunResult CPU::run(std::size_t max_steps, Register breakpoint)
+{
+    impl->synchronize_code();
 
-        register_bank[instruction.rt] =
-            rs + as_unsigned(sign_extend(instruction.immediate));
+    if (impl->translation and not profiling and not impl->trace) {
+        return run_translated(max_steps, breakpoint);
     }
 
-    void andi(IInstruction instruction)
-    {
-        auto rs = register_bank[instruction.rs];
-
-        register_bank[instruction.rt] = rs & zero_extend(instruction.immediate);
+    switch (dispatch_) {
+        case Dispatch::Threaded:
+            return run_threaded(*impl, max_steps, breakpoint);
+        case Dispatch::Blocks:
+            return run_blocks(max_steps, breakpoint, false);
+        case Dispatch::Jit:
+            return run_blocks(
+                max_steps,
+                breakpoint,
+                jit_supported and not profiling and not impl->trace);
+        case Dispatch::Table:
+            break;
     }
 
-    void branch(std::uint16_t immediate)
-    {
-        auto address_delta = sign_extend(immediate) << 2;
-
-        pc += as_unsigned(4 + address_delta);
-    }
+    return run_table(max_steps, breakpoint);
+}
 
-    void beq(IInstruction instruction)
-    {
-        auto rs = register_bank[instruction.rs];
-        auto rt = register_bank[instruction.rt];
+RunResult CPU::run_table(std::size_t max_steps, Register breakpoint)
+{
+    auto& state = *impl;
+    auto steps = std::size_t{0};
 
-        if (rs == rt) {
-            branch(instruction.immediate);
+    while (true) {
+        if (state.trap_pending) {
+            return {StopReason::Trap, steps};
         }
-    }
-
-    void bne(IInstruction instruction)
-    {
-        auto rs = register_bank[instruction.rs];
-        auto rt = register_bank[instruction.rt];
 
-        if (rs != rt) {
-            branch(instruction.immediate);
+        if (steps == max_steps) {
+            return {StopReason::StepLimit, steps};
         }
-    }
-
-    void ori(IInstruction instruction)
-    {
-        auto rs = register_bank[instruction.rs];
-
-        register_bank[instruction.rt] = rs | zero_extend(instruction.immediate);
-    }
-
-    void slti(IInstruction instruction)
-    {
-        auto rs = register_bank[instruction.rs];
-
-        register_bank[instruction.rt] =
-            as_signed(rs) < sign_extend(instruction.immediate);
-    }
-
-    void sltiu(IInstruction instruction)
-    {
-        auto rs = register_bank[instruction.rs];
-
-        register_bank[instruction.rt] =
-            rs < as_unsigned(sign_extend(instruction.immediate));
-    }
 
-    Register jump_address(std::uint32_t address_field)
-    {
-        auto page_base = (pc + 4) & bitwise::and_mask(4, 28);
-        return page_base | (address_field << 2);
-    }
+        if (not state.code.contains(state.pc)) {
+            return {StopReason::OutOfProgram, steps};
+        }
 
-    void jump(JInstruction instruction)
-    {
-        pc = jump_address(instruction.address);
-    }
+        if (state.pc == breakpoint) {
+            return {StopReason::Breakpoint, steps};
+        }
 
-    void jal(JInstruction instruction)
-    {
-        register_bank[31] = pc + 8;
-        jump(instruction);
+        step(state);
+        ++steps;
     }
-
-    Registers register_bank;
-    Register hi{0}, lo{0};
-    Register pc{0};
-};
-
-constexpr static RInstructionHandlers make_r_handlers()
-{
-    auto handlers = RInstructionHandlers{&CPUInternals::unknown_r_instruction};
-
-    handlers[Funct::ADD] = &CPUInternals::add;
-    handlers[Funct::ADDU] = &CPUInternals::addu;
-    handlers[Funct::AND] = &CPUInternals::bitwise_and;
-    handlers[Funct::DIV] = &CPUInternals::div;
-    handlers[Funct::DIVU] = &CPUInternals::divu;
-    handlers[Funct::JR] = &CPUInternals::jr;
-    handlers[Funct::MFHI] = &CPUInternals::mfhi;
-    handlers[Funct::MFLO] = &CPUInternals::mflo;
-    handlers[Funct::MULT] = &CPUInternals::mult;
-    handlers[Funct::MULTU] = &CPUInternals::multu;
-    handlers[Funct::NOR] = &CPUInternals::nor;
-    handlers[Funct::OR] = &CPUInternals::bitwise_or;
-    handlers[Funct::SLT] = &CPUInternals::slt;
-    handlers[Funct::SLTU] = &CPUInternals::sltu;
-    handlers[Funct::SLL] = &CPUInternals::sll;
-    handlers[Funct::SRL] = &CPUInternals::sll;
-    handlers[Funct::SUB] = &CPUInternals::sub;
-    handlers[Funct::SUBU] = &CPUInternals::subu;
-
-    return handlers;
 }
 
-constexpr static IInstructionHandlers make_i_handlers()
+// With `compile`, blocks that get hot are compiled and run as machine code
+// from then on.
+RunResult CPU::run_blocks(
+    std::size_t max_steps,
+    Register breakpoint,
+    bool compile)
 {
-    auto handlers = IInstructionHandlers{&CPUInternals::unknown_i_instruction};
-
-    handlers[Opcode::ADDI] = &CPUInternals::addi;
-    handlers[Opcode::ADDIU] = &CPUInternals::addiu;
-    handlers[Opcode::ANDI] = &CPUInternals::andi;
-    handlers[Opcode::BEQ] = &CPUInternals::beq;
-    handlers[Opcode::BNE] = &CPUInternals::bne;
-    handlers[Opcode::ORI] = &CPUInternals::ori;
-    handlers[Opcode::SLTI] = &CPUInternals::slti;
-    handlers[Opcode::SLTIU] = &CPUInternals::sltiu;
+    auto& state = *impl;
+    auto steps = std::size_t{0};
 
-    return handlers;
-}
+    while (true) {
+        if (state.trap_pending) {
+            return {StopReason::Trap, steps};
+        }
 
-constexpr static JInstructionHandlers make_j_handlers()
-{
-    auto handlers = JInstructionHandlers{&CPUInternals::unknown_j_instruction};
+        if (steps == max_steps) {
+            return {StopReason::StepLimit, steps};
+        }
 
-    handlers[Opcode::J] = &CPUInternals::jump;
-    handlers[Opcode::JAL] = &CPUInternals::jal;
+        auto* block =
+            state.block_cache.fetch(state.memory, state.code, state.pc);
 
-    return handlers;
-}
+        if (not block) {
+            return {StopReason::OutOfProgram, steps};
+        }
 
-constexpr auto r_handlers = make_r_handlers();
-constexpr auto i_handlers = make_i_handlers();
-constexpr auto j_handlers = make_j_handlers();
+        if (state.pc == breakpoint) {
+            return {StopReason::Breakpoint, steps};
+        }
 
-CPU::CPU(RawInstruction const* program):
-    program_{program}, impl{std::make_unique<CPUInternals>()}
-{}
+        auto const size = block->size();
+        auto const fits = size <= max_steps - steps;
+        auto const hits_breakpoint =
+            block->start < breakpoint and breakpoint < block->end;
+
+        // Partial blocks are single-stepped, so that we stop exactly where
+        // asked to.
+        if (not fits or hits_breakpoint) {
+            step(state);
+            ++steps;
+            continue;
+        }
 
-CPU::~CPU() = default;
+        if (compile and not block->compiled and
+            ++block->runs == jit_threshold) {
+            block->compiled = compile_block(state, *block);
+        }
 
-Registers const& CPU::registers() const
-{
-    return impl->register_bank;
+        steps += compile and block->compiled ? block->compiled->run()
+                                             : execute(state, *block);
+    }
 }
 
-Register CPU::pc() const
-{
-    return impl->pc;
-}
 
-void CPU::execute(RInstruction instruction)
+// Translated code runs on a copy of the registers, which goes back into the
+// CPU whenever the interpreter has to take over.
+RunResult CPU::run_translated(std::size_t max_steps, Register breakpoint)
 {
-    auto&& handler = r_handlers[instruction.funct];
-
-    (*impl.*handler)(instruction);
-}
+    auto& state = *impl;
+    auto steps = std::size_t{0};
+    auto translated = aot::State{};
+    translated.memory = &state.memory;
+
+    while (true) {
+        if (state.trap_pending) {
+            return {StopReason::Trap, steps};
+        }
 
-void CPU::execute(IInstruction instruction)
-{
-    auto&& handler = i_handlers[instruction.opcode];
+        if (steps == max_steps) {
+            return {StopReason::StepLimit, steps};
+        }
 
-    (*impl.*handler)(instruction);
-}
+        if (not state.code.contains(state.pc)) {
+            return {StopReason::OutOfProgram, steps};
+        }
 
-void CPU::execute(JInstruction instruction)
-{
-    auto&& handler = j_handlers[instruction.opcode];
+        if (state.pc == breakpoint) {
+            return {StopReason::Breakpoint, steps};
+        }
 
-    (*impl.*handler)(instruction);
-}
+        auto executed = std::size_t{0};
 
-template <class... Ts> struct overload: Ts... {
-    using Ts::operator()...;
-};
+        if (state.translation) {
+            translated.registers = state.register_bank;
+            translated.hi = state.hi;
+            translated.lo = state.lo;
+            translated.pc = state.pc;
+            translated.stored_to_code = false;
 
-template <class... Ts> overload(Ts...) -> overload<Ts...>;
+            executed = state.translation->run(
+                translated, max_steps - steps, breakpoint);
 
-void CPU::execute_instruction()
-{
-    auto const decoded = decode(program_[impl->pc / 4]);
+            state.register_bank = translated.registers;
+            state.hi = translated.hi;
+            state.lo = translated.lo;
+            state.pc = translated.pc;
+            steps += executed;
 
-    impl->pc += 4;
+            if (translated.stored_to_code) {
+                state.invalidate_code(translated.code_store);
+                state.invalidate_code(translated.code_store + 3);
+            }
+        }
 
-    if (not decoded) {
-        std::cout << "Unknown instruction.\n";
-        return;
+        // Whatever was not translated, or is about to trap, is interpreted
+        // one instruction at a time until translated code can take over.
+        if (executed == 0) {
+            step(state);
+            ++steps;
+        }
     }
-
-    std::visit([&](auto instruction) { execute(instruction); }, *decoded);
 }
 
 }
@@ -1,35 +1,190 @@
 #ifndef MERCURY_CPU_HPP
 #define MERCURY_CPU_HPP
 
-#include <array>
+#include <cstddef>
+#include <limits>
 #include <memory>
+#include <string>
 
 #include "instruction_formats.hpp"
 #include "enum_tools.hpp"
+#include "memory.hpp"
+#include "profile.hpp"
+#include "program.hpp"
+#include "registers.hpp"
+#include "snapshot.hpp"
+#include "symbol_table.hpp"
+#include "trace_format.hpp"
+#include "trap.hpp"
 
 
 namespace mercury {
 
 struct CPUInternals;
+class PerfMap;
 
-using Register = std::uint32_t;
-using Registers = std::array<Register, 32>;
+namespace aot {
+struct Module;
+}
+
+// How instructions get dispatched to their handlers.
+enum class Dispatch {
+    // Look up each instruction's handler through the instruction cache.
+    Table,
+    // Direct-threaded code, where each handler jumps straight to the next.
+    Threaded,
+    // Translated basic blocks, chained to their successors.
+    Blocks,
+    // Blocks as above, compiled to host machine code once they have run
+    // often enough. Only on x86-64 Linux, and never while profiling or
+    // tracing. Otherwise the same as Blocks.
+    Jit,
+};
+
+// The dispatch's name, in lower case.
+char const* name_of(Dispatch dispatch);
+
+// Why a call to CPU::run() returned. When several apply, the first one listed
+// here wins.
+enum class StopReason {
+    // An instruction raised an exception. It counts as executed, but the PC
+    // is left on it, and the CPU does nothing more until return_from_trap().
+    Trap,
+    // The step budget ran out.
+    StepLimit,
+    // The PC left the program.
+    OutOfProgram,
+    // The PC reached the requested breakpoint.
+    Breakpoint,
+};
+
+struct RunResult {
+    StopReason reason;
+    std::size_t steps;
+};
+
+constexpr auto unlimited_steps = std::numeric_limits<std::size_t>::max();
 
 class CPU {
 public:
-    CPU(RawInstruction const* program);
+    // Create a CPU with empty memory, which does nothing until a program is
+    // started.
+    explicit CPU(Dispatch dispatch = Dispatch::Table);
+
+    // Load `program` at address 0 of the CPU's memory and start executing it
+    // from there.
+    CPU(RawInstruction const* program,
+        std::size_t program_size,
+        Dispatch dispatch = Dispatch::Table);
+
+    // Create another core sharing `sibling`'s memory, which starts running
+    // the same program from the sibling's current PC with zeroed registers.
+    // Both can then run on different threads at the same time. The sibling
+    // must not be running while this is being constructed.
+    explicit CPU(CPU& sibling, Dispatch dispatch = Dispatch::Table);
+
+    // Create a CPU that carries on from `snapshot`, with memory of its own.
+    // Only the pages it writes to get copied.
+    explicit CPU(Snapshot const& snapshot, Dispatch dispatch = Dispatch::Table);
     ~CPU();
 
+    // Start executing `program`, which must already be in memory().
+    void start(Program const& program);
+
+    // $zero must be left at zero, since guest instructions never write it
+    // and reads of it may be compiled away.
+    Registers& registers();
     Registers const& registers() const;
     Register pc() const;
+
+    // What the last multiplication or division left in HI and LO.
+    Register hi() const;
+    Register lo() const;
+
+    Memory& memory();
+    Memory const& memory() const;
+
+    // The exception state, as the EPC and Cause registers. They describe
+    // the last trap, which is pending until return_from_trap().
+    bool trap_pending() const;
+    Register epc() const;
+    Register cause() const;
+
+    // Handle the pending trap by carrying on from `pc`, which is usually
+    // the EPC to retry the instruction, or the one after to skip it.
+    void return_from_trap(Register pc);
+
+    // What ran since the program was started. Empty unless built with
+    // profiling.
+    Profile const& profile() const;
+
+    // Neither of these do anything while a trap is pending.
     void execute_instruction();
 
+    // Execute instructions up to and including the next branch or jump, or
+    // the next instruction that may trap.
+    void execute_block();
+
+    // Execute up to `max_steps` instructions with the dispatch chosen at
+    // construction, stopping early if the PC leaves the program.
+    RunResult run(std::size_t max_steps);
+
+    // Same as run(), but also stop right before executing the instruction at
+    // `breakpoint`, even if that is the very first one.
+    RunResult run_until(
+        Register breakpoint,
+        std::size_t max_steps = unlimited_steps);
+
+    // Must be called after writing to the program through memory(), so that
+    // stale decoded instructions are not executed. Guest stores invalidate
+    // what they overwrite by themselves.
+    void invalidate_instruction(Register address);
+    void invalidate_instructions();
+
+    // Capture the registers and memory, without copying memory. Pages are
+    // copied the next time the CPU writes to them instead. The memory must
+    // not be shared with another CPU.
+    Snapshot snapshot();
+
+    // Go back to `snapshot`. If it is the last one taken or restored by this
+    // CPU, this only costs as much as the pages written since, and decoded
+    // instructions are kept unless code was written to.
+    void restore(Snapshot const& snapshot);
+
+    // Run the code `module` translated ahead of time wherever it can,
+    // instead of interpreting it, until the guest overwrites any of it. The
+    // module must outlive the CPU or be detached, and is ignored when built
+    // with profiling or while tracing. Throws std::invalid_argument unless
+    // it was translated from the program in memory.
+    void attach(aot::Module const& module);
+    void detach();
+
+    // Stream every instruction executed from now on, and the registers it
+    // wrote, to a trace at `path`, replacing any trace in progress. Throws
+    // std::logic_error unless built with tracing, and std::runtime_error if
+    // the file cannot be created.
+    void trace_to(std::string const& path);
+
+    // Finish writing the trace in progress, if any. Throws
+    // std::runtime_error if writing it failed.
+    void stop_trace();
+
+    // Describe the machine code of every block the JIT compiles from now on
+    // to `map`, for Linux perf, naming blocks after the `symbols` of the
+    // program, or stop with nullptr. The map must outlive the CPU or be
+    // detached. Several CPUs may share one.
+    void report_code_to(PerfMap* map, SymbolTable symbols = {});
+
 private:
-    void execute(RInstruction);
-    void execute(IInstruction);
-    void execute(JInstruction);
+    RunResult run(std::size_t max_steps, Register breakpoint);
+    RunResult run_table(std::size_t max_steps, Register breakpoint);
+    RunResult run_blocks(
+        std::size_t max_steps,
+        Register breakpoint,
+        bool compile);
+    RunResult run_translated(std::size_t max_steps, Register breakpoint);
 
-    RawInstruction const* program_;
+    Dispatch dispatch_;
     std::unique_ptr<CPUInternals> impl;
 };
 
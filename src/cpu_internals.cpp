@@ -0,0 +1,211 @@
+#include "cpu_internals.hpp"
+
+#include <utility>
+
+namespace mercury {
+
+// The trace record of `instruction`, which has just run.
+static TraceRecord trace_record(
+    CPUInternals const& impl,
+    Register pc,
+    RawInstruction raw,
+    DecodedInstruction instruction)
+{
+    auto record = TraceRecord{pc, raw, 0, {}};
+
+    // A trapping instruction does not write anything.
+    if (impl.trap_pending) {
+        return record;
+    }
+
+    auto const add = [&](std::uint8_t index, Register value) {
+        record.writes[record.write_count++] = {index, value};
+    };
+
+    switch (spec_for(instruction.operation).destination) {
+        case Destination::None:
+            break;
+        case Destination::Rd:
+            add(instruction.rd, impl.register_bank[instruction.rd]);
+            break;
+        case Destination::Rt:
+            add(instruction.rt, impl.register_bank[instruction.rt]);
+            break;
+        case Destination::Link:
+            add(31, impl.register_bank[31]);
+            break;
+        case Destination::HiLo:
+            add(trace::hi, impl.hi);
+            add(trace::lo, impl.lo);
+            break;
+    }
+
+    return record;
+}
+
+template <void (CPUInternals::*handler)(DecodedInstruction)>
+void bound_handler(CPUInternals& impl, DecodedInstruction instruction)
+{
+    if constexpr (profiling or tracing) {
+        // The PC has already moved past the instruction.
+        auto const pc = impl.pc - 4;
+
+        // Read before running the instruction, which may overwrite itself.
+        auto const raw = tracing and impl.trace
+                             ? impl.memory.load<RawInstruction>(pc)
+                             : RawInstruction{0};
+
+        (impl.*handler)(instruction);
+
+        if constexpr (profiling) {
+            impl.profile.record(pc, instruction, impl.pc);
+        }
+
+        if constexpr (tracing) {
+            if (impl.trace) {
+                impl.trace->record(trace_record(impl, pc, raw, instruction));
+            }
+        }
+    } else {
+        (impl.*handler)(instruction);
+    }
+}
+
+constexpr static InstructionHandlers make_handlers()
+{
+    auto handlers =
+        InstructionHandlers{&bound_handler<&CPUInternals::unknown_instruction>};
+
+    handlers[Operation::ADD] = &bound_handler<&CPUInternals::add>;
+    handlers[Operation::ADDU] = &bound_handler<&CPUInternals::addu>;
+    handlers[Operation::AND] = &bound_handler<&CPUInternals::bitwise_and>;
+    handlers[Operation::DIV] = &bound_handler<&CPUInternals::div>;
+    handlers[Operation::DIVU] = &bound_handler<&CPUInternals::divu>;
+    handlers[Operation::JR] = &bound_handler<&CPUInternals::jr>;
+    handlers[Operation::MFHI] = &bound_handler<&CPUInternals::mfhi>;
+    handlers[Operation::MFLO] = &bound_handler<&CPUInternals::mflo>;
+    handlers[Operation::MULT] = &bound_handler<&CPUInternals::mult>;
+    handlers[Operation::MULTU] = &bound_handler<&CPUInternals::multu>;
+    handlers[Operation::NOR] = &bound_handler<&CPUInternals::nor>;
+    handlers[Operation::OR] = &bound_handler<&CPUInternals::bitwise_or>;
+    handlers[Operation::SLL] = &bound_handler<&CPUInternals::sll>;
+    handlers[Operation::SLT] = &bound_handler<&CPUInternals::slt>;
+    handlers[Operation::SLTU] = &bound_handler<&CPUInternals::sltu>;
+    handlers[Operation::SRL] = &bound_handler<&CPUInternals::srl>;
+    handlers[Operation::SUB] = &bound_handler<&CPUInternals::sub>;
+    handlers[Operation::SUBU] = &bound_handler<&CPUInternals::subu>;
+    handlers[Operation::SYNC] = &bound_handler<&CPUInternals::sync>;
+    handlers[Operation::SYSCALL] = &bound_handler<&CPUInternals::syscall>;
+
+    handlers[Operation::ADDI] = &bound_handler<&CPUInternals::addi>;
+    handlers[Operation::ADDIU] = &bound_handler<&CPUInternals::addiu>;
+    handlers[Operation::ANDI] = &bound_handler<&CPUInternals::andi>;
+    handlers[Operation::BEQ] = &bound_handler<&CPUInternals::beq>;
+    handlers[Operation::BNE] = &bound_handler<&CPUInternals::bne>;
+    handlers[Operation::LBU] = &bound_handler<&CPUInternals::lbu>;
+    handlers[Operation::LHU] = &bound_handler<&CPUInternals::lhu>;
+    handlers[Operation::LL] = &bound_handler<&CPUInternals::ll>;
+    handlers[Operation::LUI] = &bound_handler<&CPUInternals::lui>;
+    handlers[Operation::LW] = &bound_handler<&CPUInternals::lw>;
+    handlers[Operation::ORI] = &bound_handler<&CPUInternals::ori>;
+    handlers[Operation::SB] = &bound_handler<&CPUInternals::sb>;
+    handlers[Operation::SC] = &bound_handler<&CPUInternals::sc>;
+    handlers[Operation::SH] = &bound_handler<&CPUInternals::sh>;
+    handlers[Operation::SLTI] = &bound_handler<&CPUInternals::slti>;
+    handlers[Operation::SLTIU] = &bound_handler<&CPUInternals::sltiu>;
+    handlers[Operation::SW] = &bound_handler<&CPUInternals::sw>;
+
+    handlers[Operation::J] = &bound_handler<&CPUInternals::jump>;
+    handlers[Operation::JAL] = &bound_handler<&CPUInternals::jal>;
+
+    handlers[Operation::NOP] = &bound_handler<&CPUInternals::nop>;
+    handlers[Operation::MOVE] = &bound_handler<&CPUInternals::move>;
+    handlers[Operation::LI] = &bound_handler<&CPUInternals::load_constant<1>>;
+    handlers[Operation::LI32] =
+        &bound_handler<&CPUInternals::load_constant<2>>;
+
+    return handlers;
+}
+
+constexpr InstructionHandlers instruction_handlers = make_handlers();
+
+constexpr bool binds_every_spec()
+{
+    constexpr auto unknown =
+        &bound_handler<&CPUInternals::unknown_instruction>;
+
+    for (auto const& spec: instruction_specs) {
+        if (instruction_handlers[spec.operation] == unknown) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static_assert(
+    binds_every_spec(),
+    "Every instruction in instruction_specs needs a handler.");
+
+// Handlers take their operation as a template argument, so that each one
+// calls the instruction handlers it runs directly, and inlines them.
+template <Operation operation>
+static void single_handler(
+    CPUInternals& impl,
+    DecodedInstruction const* instructions)
+{
+    constexpr auto handler = instruction_handlers[operation];
+
+    impl.pc += 4;
+    handler(impl, *instructions);
+}
+
+template <std::size_t index, std::size_t position = 0>
+static void superinstruction_handler(
+    CPUInternals& impl,
+    DecodedInstruction const* instructions)
+{
+    constexpr auto const& superinstruction = superinstructions[index];
+
+    single_handler<superinstruction.operations[position]>(
+        impl, instructions + position);
+
+    if constexpr (position + 1 < superinstruction.length) {
+        // A load or store that trapped ends the sequence.
+        if constexpr (needs_alignment(superinstruction.operations[position])) {
+            if (impl.trap_pending) {
+                return;
+            }
+        }
+
+        superinstruction_handler<index, position + 1>(impl, instructions);
+    }
+}
+
+template <std::size_t... operations>
+constexpr static SingleHandlers make_single_handlers(
+    std::index_sequence<operations...>)
+{
+    auto handlers = SingleHandlers{};
+    ((handlers[Operation{operations}] =
+          &single_handler<Operation{operations}>),
+     ...);
+
+    return handlers;
+}
+
+template <std::size_t... indices>
+constexpr static SuperinstructionHandlers make_superinstruction_handlers(
+    std::index_sequence<indices...>)
+{
+    return {&superinstruction_handler<indices>...};
+}
+
+constexpr SingleHandlers single_handlers =
+    make_single_handlers(std::make_index_sequence<operation_count>{});
+
+constexpr SuperinstructionHandlers superinstruction_handlers =
+    make_superinstruction_handlers(
+        std::make_index_sequence<superinstructions.size()>{});
+
+}
@@ -0,0 +1,633 @@
+#ifndef MERCURY_CPU_INTERNALS_HPP
+#define MERCURY_CPU_INTERNALS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+
+#include "aot_module.hpp"
+#include "bitwise.hpp"
+#include "block_cache.hpp"
+#include "decoded_instruction.hpp"
+#include "enum_indexed_array.hpp"
+#include "instruction_cache.hpp"
+#include "instruction_spec.hpp"
+#include "memory.hpp"
+#include "perf_map.hpp"
+#include "profile.hpp"
+#include "registers.hpp"
+#include "superinstructions.hpp"
+#include "symbol_table.hpp"
+#include "threaded_interpreter.hpp"
+#include "trace_writer.hpp"
+#include "trap.hpp"
+
+namespace mercury {
+
+constexpr auto as_signed(std::uint32_t u)
+{
+    return static_cast<std::int32_t>(u);
+}
+
+constexpr auto as_unsigned(std::int32_t s)
+{
+    return static_cast<std::uint32_t>(s);
+}
+
+// What the run loops and handlers touch for every instruction, packed so
+// that the loops' own checks share one cache line, with the registers in
+// the two lines after it.
+struct alignas(64) HotState {
+    Register pc{0};
+
+    // Nothing runs while a trap is pending.
+    bool trap_pending{false};
+
+    // Where the program lives in guest memory. Running outside of it stops
+    // the CPU.
+    AddressRange code{0, 0};
+
+    Register hi{0}, lo{0};
+
+    Registers register_bank{};
+};
+
+static_assert(offsetof(HotState, register_bank) <= 64);
+
+struct CPUInternals: HotState {
+    CPUInternals() = default;
+
+    // Share `sibling`'s memory and run the same program.
+    explicit CPUInternals(CPUInternals& sibling):
+        memory{sibling.memory, Memory::Shared{}},
+        code_generation{memory.code_generation()}
+    {
+        pc = sibling.pc;
+        code = sibling.code;
+
+        if constexpr (profiling) {
+            profile.reset(code);
+        }
+    }
+
+    // Stop on the instruction being executed with `exception`. The run loops
+    // look for pending traps once per block, and every instruction that
+    // may raise one ends its block, except for loads and stores, which are
+    // checked right after running.
+    void raise(ExceptionCode exception)
+    {
+        pc -= 4;
+        epc = pc;
+        cause = cause_of(exception);
+        trap_pending = true;
+    }
+
+    void unknown_instruction(DecodedInstruction)
+    {
+        raise(ExceptionCode::ReservedInstruction);
+    }
+
+    // Write a register, unless it is $zero. Only the handlers that
+    // specialize() does not turn into a NOP when they write $zero need this.
+    void write(std::uint8_t index, Register value)
+    {
+        if (index != 0) {
+            register_bank[index] = value;
+        }
+    }
+
+    // Write the result of a signed addition or subtraction, or trap if it
+    // overflowed, leaving the register alone.
+    void write_checked(std::uint8_t index, std::int64_t result)
+    {
+        auto const truncated = static_cast<std::int32_t>(result);
+
+        if (truncated != result) {
+            raise(ExceptionCode::Overflow);
+            return;
+        }
+
+        write(index, as_unsigned(truncated));
+    }
+
+    /* Basic R instructions */
+
+    void add(DecodedInstruction instruction)
+    {
+        auto rs = as_signed(register_bank[instruction.rs]);
+        auto rt = as_signed(register_bank[instruction.rt]);
+
+        write_checked(instruction.rd, std::int64_t{rs} + rt);
+    }
+
+    void addu(DecodedInstruction instruction)
+    {
+        auto rs = register_bank[instruction.rs];
+        auto rt = register_bank[instruction.rt];
+
+        register_bank[instruction.rd] = rs + rt;
+    }
+
+    void bitwise_and(DecodedInstruction instruction)
+    {
+        auto rs = register_bank[instruction.rs];
+        auto rt = register_bank[instruction.rt];
+
+        register_bank[instruction.rd] = rs & rt;
+    }
+
+    // Instructions are word-aligned, so there is nothing to fetch anywhere
+    // else. The address error is raised on the jump itself.
+    void jr(DecodedInstruction instruction)
+    {
+        auto const target = register_bank[instruction.rs];
+
+        if (target % 4 != 0) {
+            raise(ExceptionCode::AddressErrorLoad);
+            return;
+        }
+
+        pc = target;
+    }
+
+    void nor(DecodedInstruction instruction)
+    {
+        auto rs = register_bank[instruction.rs];
+        auto rt = register_bank[instruction.rt];
+
+        register_bank[instruction.rd] = ~(rs | rt);
+    }
+
+    void bitwise_or(DecodedInstruction instruction)
+    {
+        auto rs = register_bank[instruction.rs];
+        auto rt = register_bank[instruction.rt];
+
+        register_bank[instruction.rd] = rs | rt;
+    }
+
+    void slt(DecodedInstruction instruction)
+    {
+        auto rs = as_signed(register_bank[instruction.rs]);
+        auto rt = as_signed(register_bank[instruction.rt]);
+
+        register_bank[instruction.rd] = rs < rt;
+    }
+
+    void sltu(DecodedInstruction instruction)
+    {
+        auto rs = register_bank[instruction.rs];
+        auto rt = register_bank[instruction.rt];
+
+        register_bank[instruction.rd] = rs < rt;
+    }
+
+    void sll(DecodedInstruction instruction)
+    {
+        auto rt = register_bank[instruction.rt];
+
+        register_bank[instruction.rd] = rt << instruction.immediate;
+    }
+
+    void srl(DecodedInstruction instruction)
+    {
+        auto rt = register_bank[instruction.rt];
+
+        register_bank[instruction.rd] = rt >> instruction.immediate;
+    }
+
+    void sub(DecodedInstruction instruction)
+    {
+        auto rs = as_signed(register_bank[instruction.rs]);
+        auto rt = as_signed(register_bank[instruction.rt]);
+
+        write_checked(instruction.rd, std::int64_t{rs} - rt);
+    }
+
+    void subu(DecodedInstruction instruction)
+    {
+        auto rs = register_bank[instruction.rs];
+        auto rt = register_bank[instruction.rt];
+
+        register_bank[instruction.rd] = rs - rt;
+    }
+
+    void sync(DecodedInstruction)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    // Whoever runs the CPU emulates the call, see Syscalls.
+    void syscall(DecodedInstruction)
+    {
+        raise(ExceptionCode::Syscall);
+    }
+
+    /* Multiplication R instructions */
+
+    void mfhi(DecodedInstruction instruction)
+    {
+        register_bank[instruction.rd] = hi;
+    }
+
+    void mflo(DecodedInstruction instruction)
+    {
+        register_bank[instruction.rd] = lo;
+    }
+
+    void mult(DecodedInstruction instruction)
+    {
+        auto rs =
+            static_cast<int64_t>(as_signed(register_bank[instruction.rs]));
+        auto rt =
+            static_cast<int64_t>(as_signed(register_bank[instruction.rt]));
+
+        auto result = static_cast<uint64_t>(rs * rt);
+        hi = static_cast<Register>((result & 0xFFFFFFFF00000000) >> 32);
+        lo = static_cast<Register>(result & 0x00000000FFFFFFFF);
+    }
+
+    void multu(DecodedInstruction instruction)
+    {
+        auto rs = static_cast<uint64_t>(register_bank[instruction.rs]);
+        auto rt = static_cast<uint64_t>(register_bank[instruction.rt]);
+
+        auto result = rs * rt;
+        hi = static_cast<Register>((result & 0xFFFFFFFF00000000) >> 32);
+        lo = static_cast<Register>(result & 0x00000000FFFFFFFF);
+    }
+
+    void div(DecodedInstruction instruction)
+    {
+        auto rs = as_signed(register_bank[instruction.rs]);
+        auto rt = as_signed(register_bank[instruction.rt]);
+
+        // MIPS leaves the result undefined, and compilers follow a division
+        // with a trap if the divisor is zero, so trap straight away.
+        if (rt == 0) {
+            raise(ExceptionCode::Trap);
+            return;
+        }
+
+        // The one quotient that does not fit wraps around.
+        if (rs == std::numeric_limits<std::int32_t>::min() and rt == -1) {
+            lo = as_unsigned(rs);
+            hi = 0;
+            return;
+        }
+
+        lo = as_unsigned(rs / rt);
+        hi = as_unsigned(rs % rt);
+    }
+
+    void divu(DecodedInstruction instruction)
+    {
+        auto rs = register_bank[instruction.rs];
+        auto rt = register_bank[instruction.rt];
+
+        if (rt == 0) {
+            raise(ExceptionCode::Trap);
+            return;
+        }
+
+        lo = rs / rt;
+        hi = rs % rt;
+    }
+
+    /* I instructions */
+
+    void addi(DecodedInstruction instruction)
+    {
+        auto rs = as_signed(register_bank[instruction.rs]);
+
+        write_checked(
+            instruction.rt, std::int64_t{rs} + as_signed(instruction.immediate));
+    }
+
+    void addiu(DecodedInstruction instruction)
+    {
+        auto rs = register_bank[instruction.rs];
+
+        register_bank[instruction.rt] = rs + instruction.immediate;
+    }
+
+    void andi(DecodedInstruction instruction)
+    {
+        auto rs = register_bank[instruction.rs];
+
+        register_bank[instruction.rt] = rs & instruction.immediate;
+    }
+
+    void branch(std::uint32_t displacement)
+    {
+        pc += displacement;
+    }
+
+    void beq(DecodedInstruction instruction)
+    {
+        auto rs = register_bank[instruction.rs];
+        auto rt = register_bank[instruction.rt];
+
+        if (rs == rt) {
+            branch(instruction.immediate);
+        }
+    }
+
+    void bne(DecodedInstruction instruction)
+    {
+        auto rs = register_bank[instruction.rs];
+        auto rt = register_bank[instruction.rt];
+
+        if (rs != rt) {
+            branch(instruction.immediate);
+        }
+    }
+
+    void lui(DecodedInstruction instruction)
+    {
+        register_bank[instruction.rt] = instruction.immediate;
+    }
+
+    void ori(DecodedInstruction instruction)
+    {
+        auto rs = register_bank[instruction.rs];
+
+        register_bank[instruction.rt] = rs | instruction.immediate;
+    }
+
+    void slti(DecodedInstruction instruction)
+    {
+        auto rs = register_bank[instruction.rs];
+
+        register_bank[instruction.rt] =
+            as_signed(rs) < as_signed(instruction.immediate);
+    }
+
+    void sltiu(DecodedInstruction instruction)
+    {
+        auto rs = register_bank[instruction.rs];
+
+        register_bank[instruction.rt] = rs < instruction.immediate;
+    }
+
+    /* Load and store I instructions */
+
+    Address effective_address(DecodedInstruction instruction)
+    {
+        return register_bank[instruction.rs] + instruction.immediate;
+    }
+
+    template <typename T>
+    void load(DecodedInstruction instruction)
+    {
+        auto const address = effective_address(instruction);
+
+        if (address % sizeof(T) != 0) {
+            raise(ExceptionCode::AddressErrorLoad);
+            return;
+        }
+
+        register_bank[instruction.rt] = memory.load<T>(address);
+    }
+
+    template <typename T>
+    void store(DecodedInstruction instruction)
+    {
+        auto const address = effective_address(instruction);
+        auto const value = static_cast<T>(register_bank[instruction.rt]);
+
+        if (address % sizeof(T) != 0) {
+            raise(ExceptionCode::AddressErrorStore);
+            return;
+        }
+
+        if (memory.store(address, value)) {
+            invalidate_code(address);
+            invalidate_code(address + sizeof(T) - 1);
+        }
+    }
+
+    void lw(DecodedInstruction instruction)
+    {
+        load<std::uint32_t>(instruction);
+    }
+
+    void lbu(DecodedInstruction instruction)
+    {
+        load<std::uint8_t>(instruction);
+    }
+
+    void lhu(DecodedInstruction instruction)
+    {
+        load<std::uint16_t>(instruction);
+    }
+
+    void sb(DecodedInstruction instruction)
+    {
+        store<std::uint8_t>(instruction);
+    }
+
+    void sh(DecodedInstruction instruction)
+    {
+        store<std::uint16_t>(instruction);
+    }
+
+    void sw(DecodedInstruction instruction)
+    {
+        store<std::uint32_t>(instruction);
+    }
+
+    void ll(DecodedInstruction instruction)
+    {
+        auto const address = effective_address(instruction);
+
+        if (address % 4 != 0) {
+            raise(ExceptionCode::AddressErrorLoad);
+            return;
+        }
+
+        link = memory.load_linked(address);
+        write(instruction.rt, link->value);
+    }
+
+    void sc(DecodedInstruction instruction)
+    {
+        auto const address = effective_address(instruction);
+
+        if (address % 4 != 0) {
+            raise(ExceptionCode::AddressErrorStore);
+            return;
+        }
+
+        auto const linked = link and link->address == address;
+        auto const stored =
+            linked and
+            memory.store_conditional(*link, register_bank[instruction.rt]);
+
+        link.reset();
+
+        if (stored and code.contains(address)) {
+            invalidate_code(address);
+        }
+
+        write(instruction.rt, stored);
+    }
+
+    Register jump_address(std::uint32_t target)
+    {
+        auto page_base = (pc + 4) & bitwise::and_mask(4, 28);
+        return page_base | target;
+    }
+
+    void jump(DecodedInstruction instruction)
+    {
+        pc = jump_address(instruction.immediate);
+    }
+
+    void jal(DecodedInstruction instruction)
+    {
+        register_bank[31] = pc + 8;
+        jump(instruction);
+    }
+
+    /* Special cases, see specializer.hpp */
+
+    void nop(DecodedInstruction)
+    {}
+
+    void move(DecodedInstruction instruction)
+    {
+        register_bank[instruction.rd] = register_bank[instruction.rs];
+    }
+
+    // LI and the LI32 that a LUI and an ORI or ADDIU fuse into, which has
+    // to move the PC past both of them.
+    template <int Width>
+    void load_constant(DecodedInstruction instruction)
+    {
+        register_bank[instruction.rt] = instruction.immediate;
+        pc += 4 * (Width - 1);
+    }
+
+    // Drop every decoded copy of the instruction at `address`.
+    void invalidate_code(Address address)
+    {
+        instruction_cache.invalidate(address);
+        block_cache.invalidate(address);
+        threaded_code.invalidate(address);
+        check_translation(address);
+    }
+
+    void invalidate_code()
+    {
+        instruction_cache.invalidate();
+        block_cache.invalidate();
+        threaded_code.invalidate();
+
+        if (translation) {
+            check_translation(translation->code);
+        }
+    }
+
+    // Drop the translation if any instruction it was made from in `range`
+    // has changed since.
+    void check_translation(AddressRange range)
+    {
+        for (auto address = range.begin & ~Address{3};
+             translation and address < range.end;
+             address += 4) {
+            check_translation(address);
+        }
+    }
+
+    void check_translation(Address address)
+    {
+        if (not translation or not translation->code.contains(address)) {
+            return;
+        }
+
+        auto const word = address & ~Address{3};
+        auto const index = (word - translation->code.begin) / 4;
+
+        if (memory.load<RawInstruction>(word) !=
+            translation->instructions[index]) {
+            translation = nullptr;
+        }
+    }
+
+    // Drop everything decoded if a CPU sharing our memory wrote to code.
+    void synchronize_code()
+    {
+        auto const generation = memory.code_generation();
+
+        if (generation != code_generation) {
+            code_generation = generation;
+            invalidate_code();
+        }
+    }
+
+    // Loads and stores go through its TLBs, which come right after the hot
+    // state.
+    Memory memory;
+
+    // The exception state: where the last trap happened, and why.
+    Register epc{0};
+    Register cause{0};
+
+    // Set by LL, and cleared by SC whether it succeeds or not.
+    std::optional<Memory::Link> link;
+
+    // The memory's code generation as of the last synchronize_code().
+    std::uint64_t code_generation{0};
+
+    InstructionCache instruction_cache;
+    BlockCache block_cache;
+    ThreadedCode threaded_code;
+
+    Profile profile;
+
+    // Where executed instructions go, when built with tracing and asked to.
+    std::unique_ptr<TraceWriter> trace;
+
+    // Code translated ahead of time, if any was attached and still matches
+    // memory.
+    aot::Module const* translation{nullptr};
+
+    // Where compiled blocks are described for Linux perf, if anywhere, and
+    // what they are named after.
+    PerfMap* perf_map{nullptr};
+    SymbolTable symbols;
+};
+
+using InstructionHandlers =
+    EnumIndexedArray<Operation, InstructionHandler, Operation::LAST>;
+
+// The handler for each operation, bound to CPUInternals.
+extern InstructionHandlers const instruction_handlers;
+
+// Execute an instruction whose PC has already been moved past.
+inline void dispatch(CPUInternals& impl, DecodedInstruction instruction)
+{
+    instruction_handlers[instruction.operation](impl, instruction);
+}
+
+using SingleHandlers =
+    EnumIndexedArray<Operation, SequenceHandler, Operation::LAST>;
+
+// The handler for each operation as a sequence of one, and for each of the
+// superinstructions, which blocks run instead of dispatching every
+// instruction.
+extern SingleHandlers const single_handlers;
+
+using SuperinstructionHandlers =
+    std::array<SequenceHandler, superinstructions.size()>;
+
+extern SuperinstructionHandlers const superinstruction_handlers;
+
+}
+
+#endif
@@ -0,0 +1 @@
+#include "decoded_instruction.hpp"
@@ -0,0 +1,114 @@
+#ifndef MERCURY_DECODED_INSTRUCTION_HPP
+#define MERCURY_DECODED_INSTRUCTION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "enum_tools.hpp"
+#include "instruction_formats.hpp"
+
+namespace mercury {
+
+struct CPUInternals;
+
+// Every instruction we can execute, across all formats. These index the
+// handler table directly.
+enum class Operation: std::uint8_t {
+    UNKNOWN,
+
+    // R instructions
+    ADD,
+    ADDU,
+    AND,
+    DIV,
+    DIVU,
+    JR,
+    MFHI,
+    MFLO,
+    MULT,
+    MULTU,
+    NOR,
+    OR,
+    SLL,
+    SLT,
+    SLTU,
+    SRL,
+    SUB,
+    SUBU,
+    SYNC,
+    SYSCALL,
+
+    // I instructions
+    ADDI,
+    ADDIU,
+    ANDI,
+    BEQ,
+    BNE,
+    LBU,
+    LHU,
+    LL,
+    LUI,
+    LW,
+    ORI,
+    SB,
+    SC,
+    SH,
+    SLTI,
+    SLTIU,
+    SW,
+
+    // J instructions
+    J,
+    JAL,
+
+    // Special cases of the instructions above, which decoding never gives
+    // but specialize() and fuse() bind instead. See specializer.hpp.
+    NOP,
+    MOVE,
+    LI,
+    LI32,
+
+    LAST = LI32,
+};
+
+constexpr auto operation_count = std::size_t{value_of(Operation::LAST) + 1};
+
+// An instruction after decoding, with its operands ready to use.
+//
+// The register fields are the raw ones, and only mean something for the
+// formats that have them. `immediate` depends on the instruction:
+//
+// - Arithmetic and memory immediates are sign-extended, and logical ones are
+//   zero-extended. LUI's is already shifted into place.
+// - Shifts by a constant have their shift amount.
+// - Branches have the displacement to add to the PC once it has moved past
+//   the branch.
+// - Jumps have their target within the current 256 MiB region.
+struct DecodedInstruction {
+    Operation operation;
+    std::uint8_t rs;
+    std::uint8_t rt;
+    std::uint8_t rd;
+    std::uint32_t immediate;
+};
+
+static_assert(sizeof(DecodedInstruction) <= 8);
+static_assert(std::is_trivially_copyable_v<DecodedInstruction>);
+
+constexpr bool operator==(DecodedInstruction lhs, DecodedInstruction rhs)
+{
+    return lhs.operation == rhs.operation and lhs.rs == rhs.rs and
+           lhs.rt == rhs.rt and lhs.rd == rhs.rd and
+           lhs.immediate == rhs.immediate;
+}
+
+using InstructionHandler = void (*)(CPUInternals&, DecodedInstruction);
+
+// Executes one or more instructions in a row, starting with `instructions`,
+// each of which it moves the PC past first.
+using SequenceHandler = void (*)(CPUInternals&, DecodedInstruction const*);
+
+}
+
+#endif
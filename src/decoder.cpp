@@ -48,6 +48,47 @@ static_assert(
 static_assert(
     *decode(0b000010'00000000000000000000001010) == JInstruction{Opcode::J, 10}
 );
+
+static_assert(
+    decode_instruction(0b000000'00001'00010'00011'00000'100000) ==
+    DecodedInstruction{Operation::ADD, 1, 2, 3, 0}
+);
+static_assert(
+    decode_instruction(0b000000'00000'00010'00011'00101'000000) ==
+    DecodedInstruction{Operation::SLL, 0, 2, 3, 5}
+);
+static_assert(
+    decode_instruction(0b001001'00001'00010'1111111111111110) ==
+    DecodedInstruction{Operation::ADDIU, 1, 2, 0b11111, 0xFFFFFFFE}
+);
+static_assert(
+    decode_instruction(0b001101'00001'00010'1111111111111110) ==
+    DecodedInstruction{Operation::ORI, 1, 2, 0b11111, 0xFFFE}
+);
+static_assert(
+    decode_instruction(0b000101'00001'00010'1111111111111110).immediate ==
+    static_cast<std::uint32_t>(4 - 8)
+);
+static_assert(
+    decode_instruction(0b000010'00000000000000000000001010) ==
+    DecodedInstruction{Operation::J, 0, 0, 0, 40}
+);
+static_assert(
+    decode_instruction(0b000000'00000'00010'00011'00101'000010) ==
+    DecodedInstruction{Operation::SRL, 0, 2, 3, 5}
+);
+static_assert(
+    decode_instruction(0b001111'00000'00010'1000000000000001) ==
+    DecodedInstruction{Operation::LUI, 0, 2, 0b10000, 0x80010000}
+);
+static_assert(
+    decode_instruction(0b111111'00000000000000000000000000).operation ==
+    Operation::UNKNOWN
+);
+static_assert(
+    decode_instruction(0b000000'00000'00000'00000'00000'111111).operation ==
+    Operation::UNKNOWN
+);
 // clang-format on
 //
 }
@@ -1,14 +1,17 @@
 #ifndef MERCURY_DECODER_HPP
 #define MERCURY_DECODER_HPP
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <optional>
 #include <stdexcept>
-#include <iostream>
 
 #include "bitwise.hpp"
+#include "decoded_instruction.hpp"
 #include "enum_tools.hpp"
 #include "instruction_formats.hpp"
+#include "instruction_spec.hpp"
 
 namespace mercury {
 
@@ -76,42 +79,54 @@ constexpr auto get_field(RawInstruction raw, FieldInfo info)
     return static_cast<T>((raw & info.mask) >> info.position);
 }
 
-constexpr std::optional<RInstruction> r_instruction(RawInstruction raw)
+// What the decode table knows about each encoding.
+struct OperationInfo {
+    Operation operation;
+    Format format;
+    ImmediateKind immediate;
+};
+
+// Indexed by opcode, except that R instructions, whose opcode is 0, are
+// indexed by 64 + funct.
+using DecodeTable = std::array<OperationInfo, 128>;
+
+constexpr std::size_t decode_table_index(RawInstruction raw)
+{
+    auto const opcode = get_field<std::size_t>(raw, info::opcode);
+    auto const funct = get_field<std::size_t>(raw, info::funct);
+
+    return opcode == 0 ? 64 + funct : opcode;
+}
+
+constexpr DecodeTable make_decode_table()
 {
-    auto funct = get_field<Funct>(raw, info::funct);
-
-    switch (funct) {
-        case Funct::ADD:
-        case Funct::ADDU:
-        case Funct::AND:
-        case Funct::DIV:
-        case Funct::DIVU:
-        case Funct::JR:
-        case Funct::MFHI:
-        case Funct::MFLO:
-        case Funct::MULT:
-        case Funct::MULTU:
-        case Funct::NOR:
-        case Funct::OR:
-        case Funct::SLT:
-        case Funct::SLTU:
-        case Funct::SLL:
-        case Funct::SRL:
-        case Funct::SUB:
-        case Funct::SUBU: {
-            return RInstruction{
-                get_field<std::uint8_t>(raw, info::rs),
-                get_field<std::uint8_t>(raw, info::rt),
-                get_field<std::uint8_t>(raw, info::rd),
-                get_field<std::uint8_t>(raw, info::shamt),
-                get_field<Funct>(raw, info::funct),
-            };
+    auto table = DecodeTable{};
+    for (auto& entry: table) {
+        entry = {Operation::UNKNOWN, Format::R, ImmediateKind::None};
+    }
+
+    for (auto const& spec: instruction_specs) {
+        if (spec.format == Format::Special) {
+            continue;
+        }
+
+        auto const index = spec.format == Format::R
+                               ? 64 + std::size_t{value_of(spec.funct)}
+                               : std::size_t{value_of(spec.opcode)};
+
+        if (table[index].operation != Operation::UNKNOWN) {
+            // Not a constant expression, so it fails the build.
+            throw std::logic_error("Two instructions have the same encoding.");
         }
+
+        table[index] = {spec.operation, spec.format, spec.immediate};
     }
 
-    return std::nullopt;
+    return table;
 }
 
+inline constexpr auto decode_table = make_decode_table();
+
 constexpr auto j_instruction(Opcode opcode, RawInstruction raw)
 {
     return JInstruction{
@@ -130,47 +145,85 @@ constexpr auto i_instruction(Opcode opcode, RawInstruction raw)
     };
 }
 
+constexpr auto r_instruction(RawInstruction raw)
+{
+    return RInstruction{
+        get_field<std::uint8_t>(raw, info::rs),
+        get_field<std::uint8_t>(raw, info::rt),
+        get_field<std::uint8_t>(raw, info::rd),
+        get_field<std::uint8_t>(raw, info::shamt),
+        get_field<Funct>(raw, info::funct),
+    };
+}
+
+// Decode a raw instruction into its fields, or nothing if it is not one we
+// know.
 constexpr std::optional<Instruction> decode(RawInstruction raw)
 {
-    auto opcode = get_field<Opcode>(raw, info::opcode);
+    auto const& entry = decode_table[decode_table_index(raw)];
 
-    switch (opcode) {
-        case Opcode::RInst: {
-            auto decoded = r_instruction(raw);
-            if (not decoded) {
-                return std::nullopt;
-            }
+    if (entry.operation == Operation::UNKNOWN) {
+        return std::nullopt;
+    }
 
-            return *decoded;
-        }
-        case Opcode::J:
-        case Opcode::JAL: {
-            return j_instruction(opcode, raw);
-        }
-        case Opcode::ADDI:
-        case Opcode::ADDIU:
-        case Opcode::BEQ:
-        case Opcode::BNE:
-        case Opcode::SLTI:
-        case Opcode::SLTIU:
-        case Opcode::ANDI:
-        case Opcode::ORI:
-        case Opcode::LUI:
-        case Opcode::LW:
-        case Opcode::LBU:
-        case Opcode::LHU:
-        case Opcode::SB:
-        case Opcode::SH:
-        case Opcode::SW:
-        case Opcode::LL:
-        case Opcode::SC: {
+    auto const opcode = get_field<Opcode>(raw, info::opcode);
+
+    switch (entry.format) {
+        case Format::R:
+            return r_instruction(raw);
+        case Format::I:
             return i_instruction(opcode, raw);
-        }
+        case Format::J:
+            return j_instruction(opcode, raw);
+        case Format::Special:
+            break;
     }
 
     return std::nullopt;
 }
 
+constexpr std::uint32_t immediate_of(ImmediateKind kind, RawInstruction raw)
+{
+    auto const immediate = get_field<std::uint16_t>(raw, info::immediate);
+    auto const sign_extended = static_cast<std::uint32_t>(
+        static_cast<std::int32_t>(static_cast<std::int16_t>(immediate)));
+
+    switch (kind) {
+        case ImmediateKind::None:
+            return 0;
+        case ImmediateKind::Signed:
+            return sign_extended;
+        case ImmediateKind::Unsigned:
+            return immediate;
+        case ImmediateKind::Upper:
+            return std::uint32_t{immediate} << 16;
+        case ImmediateKind::Shift:
+            return get_field(raw, info::shamt);
+        case ImmediateKind::Branch:
+            // Branches skip the instruction after them as well.
+            return 4 + (sign_extended << 2);
+        case ImmediateKind::Jump:
+            return get_field(raw, info::address) << 2;
+    }
+
+    return 0;
+}
+
+// Decode a raw instruction into the form the interpreters run, with a
+// single table lookup.
+constexpr DecodedInstruction decode_instruction(RawInstruction raw)
+{
+    auto const& entry = decode_table[decode_table_index(raw)];
+
+    return {
+        entry.operation,
+        get_field<std::uint8_t>(raw, info::rs),
+        get_field<std::uint8_t>(raw, info::rt),
+        get_field<std::uint8_t>(raw, info::rd),
+        immediate_of(entry.immediate, raw),
+    };
+}
+
 }
 
 #endif
@@ -0,0 +1,72 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include "decoder.hpp"
+#include "instruction_spec.hpp"
+#include "trace_reader.hpp"
+
+namespace mercury {
+
+namespace {
+
+void print_write(RegisterWrite const& write)
+{
+    switch (write.index) {
+        case trace::hi:
+            std::printf(" hi=%08x", write.value);
+            break;
+        case trace::lo:
+            std::printf(" lo=%08x", write.value);
+            break;
+        default:
+            std::printf(" r%u=%08x", unsigned{write.index}, write.value);
+            break;
+    }
+}
+
+// Print one line per record: the PC, the raw word, its mnemonic and the
+// registers it wrote.
+void dump_trace(std::istream& in)
+{
+    auto reader = TraceReader{in};
+
+    while (auto const record = reader.next()) {
+        auto const operation = decode_instruction(record->raw).operation;
+
+        std::printf(
+            "%08x %08x %-6s", record->pc, record->raw, mnemonic(operation));
+
+        for (auto i = std::size_t{0}; i < record->write_count; ++i) {
+            print_write(record->writes[i]);
+        }
+
+        std::printf("\n");
+    }
+}
+
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        std::cerr << "usage: mercury-trace <trace>\n";
+        return 1;
+    }
+
+    auto in = std::ifstream{argv[1], std::ios::binary};
+    if (not in) {
+        std::cerr << "Could not open " << argv[1] << ".\n";
+        return 1;
+    }
+
+    try {
+        mercury::dump_trace(in);
+    } catch (std::runtime_error const& error) {
+        std::cerr << error.what() << '\n';
+        return 1;
+    }
+}
@@ -0,0 +1,26 @@
+#include "encoder.hpp"
+
+namespace mercury {
+
+namespace {
+
+// clang-format off
+static_assert(
+    encode(RInstruction{1, 2, 3, 0, Funct::ADD}) ==
+    0b000000'00001'00010'00011'00000'100000
+);
+static_assert(
+    encode(IInstruction{Opcode::BEQ, 1, 2, 42}) ==
+    0b000100'00001'00010'0000000000101010
+);
+static_assert(
+    encode(JInstruction{Opcode::J, 10}) == 0b000010'00000000000000000000001010
+);
+static_assert(
+    i_type(Opcode::ADDIU, 8, 8, -1) == 0b001001'01000'01000'1111111111111111
+);
+// clang-format on
+
+}
+
+}
@@ -0,0 +1,81 @@
+#ifndef MERCURY_ENCODER_HPP
+#define MERCURY_ENCODER_HPP
+
+#include <cstdint>
+#include <variant>
+
+#include "decoder.hpp"
+#include "enum_tools.hpp"
+#include "instruction_formats.hpp"
+
+namespace mercury {
+
+// The inverse of decode(), for generating guest code.
+
+template <typename T>
+constexpr RawInstruction set_field(T value, FieldInfo info)
+{
+    return (static_cast<RawInstruction>(value) << info.position) & info.mask;
+}
+
+constexpr RawInstruction encode(RInstruction instruction)
+{
+    return set_field(instruction.rs, info::rs) |
+           set_field(instruction.rt, info::rt) |
+           set_field(instruction.rd, info::rd) |
+           set_field(instruction.shamt, info::shamt) |
+           set_field(value_of(instruction.funct), info::funct);
+}
+
+constexpr RawInstruction encode(IInstruction instruction)
+{
+    return set_field(value_of(instruction.opcode), info::opcode) |
+           set_field(instruction.rs, info::rs) |
+           set_field(instruction.rt, info::rt) |
+           set_field(instruction.immediate, info::immediate);
+}
+
+constexpr RawInstruction encode(JInstruction instruction)
+{
+    return set_field(value_of(instruction.opcode), info::opcode) |
+           set_field(instruction.address, info::address);
+}
+
+inline RawInstruction encode(Instruction const& instruction)
+{
+    return std::visit(
+        [](auto const& operands) { return encode(operands); }, instruction);
+}
+
+// Shorthands for writing guest code by hand, with operands in the order
+// assembly has them. Immediates are taken as signed, and truncated to 16
+// bits.
+
+constexpr RawInstruction r_type(
+    Funct funct,
+    std::uint8_t rd,
+    std::uint8_t rs,
+    std::uint8_t rt,
+    std::uint8_t shamt = 0)
+{
+    return encode(RInstruction{rs, rt, rd, shamt, funct});
+}
+
+constexpr RawInstruction i_type(
+    Opcode opcode,
+    std::uint8_t rt,
+    std::uint8_t rs,
+    std::int32_t immediate)
+{
+    return encode(IInstruction{
+        opcode, rs, rt, static_cast<std::uint16_t>(immediate & 0xFFFF)});
+}
+
+constexpr RawInstruction j_type(Opcode opcode, std::uint32_t address)
+{
+    return encode(JInstruction{opcode, address});
+}
+
+}
+
+#endif
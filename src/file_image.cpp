@@ -0,0 +1,85 @@
+#include "file_image.hpp"
+
+#include <fstream>
+#include <new>
+#include <stdexcept>
+
+#include "memory.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MERCURY_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace mercury {
+
+#if defined(MERCURY_HAS_MMAP)
+
+bool host_pages_match()
+{
+    return sysconf(_SC_PAGESIZE) == long{Memory::page_size};
+}
+
+FileImage open_image(std::string const& path)
+{
+    auto const fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open " + path + ".");
+    }
+
+    struct stat status {};
+    if (fstat(fd, &status) != 0 or status.st_size <= 0) {
+        ::close(fd);
+        throw std::runtime_error("Could not read " + path + ".");
+    }
+
+    auto const size = static_cast<std::size_t>(status.st_size);
+    auto* mapped = mmap(
+        nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("Could not map " + path + ".");
+    }
+
+    auto data = std::shared_ptr<std::byte>(
+        static_cast<std::byte*>(mapped),
+        [size](std::byte* bytes) { munmap(bytes, size); });
+
+    return {std::move(data), size};
+}
+
+#else
+
+bool host_pages_match()
+{
+    return true;
+}
+
+FileImage open_image(std::string const& path)
+{
+    auto file = std::ifstream{path, std::ios::binary | std::ios::ate};
+    if (not file) {
+        throw std::runtime_error("Could not open " + path + ".");
+    }
+
+    auto const size = static_cast<std::size_t>(file.tellg());
+    auto const alignment = std::align_val_t{Memory::page_size};
+    auto* bytes = static_cast<std::byte*>(::operator new(size, alignment));
+    auto data = std::shared_ptr<std::byte>(bytes, [alignment](std::byte* p) {
+        ::operator delete(p, alignment);
+    });
+
+    file.seekg(0);
+    file.read(
+        reinterpret_cast<char*>(bytes), static_cast<std::streamsize>(size));
+
+    return {std::move(data), size};
+}
+
+#endif
+
+}
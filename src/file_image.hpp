@@ -0,0 +1,26 @@
+#ifndef MERCURY_FILE_IMAGE_HPP
+#define MERCURY_FILE_IMAGE_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace mercury {
+
+// A whole file in host memory, page-aligned and privately writable.
+struct FileImage {
+    std::shared_ptr<std::byte> data;
+    std::size_t size;
+};
+
+// Whether host pages are the size of guest pages, so that page-aligned parts
+// of a FileImage can be mapped into guest memory.
+bool host_pages_match();
+
+// Map the file at `path`, or read it where mapping is not available. Throws
+// std::runtime_error if it cannot be opened or is empty.
+FileImage open_image(std::string const& path);
+
+}
+
+#endif
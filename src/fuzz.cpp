@@ -0,0 +1,343 @@
+#include <cstdio>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "aot_module.hpp"
+#include "aot_translator.hpp"
+#include "bulk_decoder.hpp"
+#include "cpu.hpp"
+#include "decoder.hpp"
+#include "instruction_spec.hpp"
+#include "lockstep.hpp"
+#include "random_program.hpp"
+
+#ifdef MERCURY_FUZZ_AOT
+// The first programs, by seed, as translated by mercury-fuzz --translate.
+extern mercury::aot::Module const* const fuzz_aot_modules[];
+extern std::size_t const fuzz_aot_module_count;
+#endif
+
+namespace mercury {
+
+namespace {
+
+// The random program fuzzed for `seed`.
+RandomProgram program_for(std::uint32_t seed)
+{
+    return random_program(seed, 64 + seed % 256);
+}
+
+// The translation of the program for `seed`, if it was built in.
+aot::Module const* translation_for([[maybe_unused]] std::uint32_t seed)
+{
+#ifdef MERCURY_FUZZ_AOT
+    if (seed < fuzz_aot_module_count) {
+        return fuzz_aot_modules[seed];
+    }
+#endif
+
+    return nullptr;
+}
+
+char const* name_of(StopReason reason)
+{
+    switch (reason) {
+        case StopReason::Trap:
+            return "trap";
+        case StopReason::StepLimit:
+            return "step limit";
+        case StopReason::OutOfProgram:
+            return "out of program";
+        case StopReason::Breakpoint:
+            return "breakpoint";
+    }
+
+    return "?";
+}
+
+void print_state(char const* name, CPUState const& state)
+{
+    std::printf(
+        "  %-9s %s after %zu, pc %08x",
+        name,
+        name_of(state.result.reason),
+        state.result.steps,
+        state.pc);
+
+    if (state.trap_pending) {
+        std::printf(
+            ", %s", mercury::name_of(exception_code(state.cause)));
+    }
+
+    std::printf("\n");
+}
+
+// Print what differs between the reference and the candidate run by
+// `engine`, along with the instruction the diverging run started on, as
+// generated.
+void report(
+    std::uint32_t seed,
+    char const* engine,
+    RandomProgram const& program,
+    Divergence const& divergence)
+{
+    auto const index = std::size_t{divergence.pc / 4};
+    auto const* instruction =
+        divergence.pc % 4 == 0 and index < program.code.size()
+            ? mnemonic(decode_instruction(program.code[index]).operation)
+            : "-";
+
+    std::printf(
+        "seed %u, %s: diverged after %zu instructions, at %08x (%s), "
+        "running %zu",
+        seed,
+        engine,
+        divergence.step,
+        divergence.pc,
+        instruction,
+        divergence.length);
+
+    if (divergence.breakpoint) {
+        std::printf(" until %08x", *divergence.breakpoint);
+    }
+
+    std::printf("\n");
+
+    auto const& expected = divergence.reference;
+    auto const& actual = divergence.candidate;
+
+    print_state("expected", expected);
+    print_state("got", actual);
+
+    for (auto i = std::size_t{0}; i < expected.registers.size(); ++i) {
+        if (expected.registers[i] != actual.registers[i]) {
+            std::printf(
+                "  r%-8zu %08x != %08x\n",
+                i,
+                expected.registers[i],
+                actual.registers[i]);
+        }
+    }
+
+    if (expected.hi != actual.hi) {
+        std::printf("  %-9s %08x != %08x\n", "hi", expected.hi, actual.hi);
+    }
+
+    if (expected.lo != actual.lo) {
+        std::printf("  %-9s %08x != %08x\n", "lo", expected.lo, actual.lo);
+    }
+}
+
+// The first instruction whose fields differ between `expected` and `actual`,
+// if any.
+std::optional<std::size_t>
+first_difference(DecodedFields const& expected, DecodedFields const& actual)
+{
+    for (auto i = std::size_t{0}; i < expected.size(); ++i) {
+        if (expected.operation[i] != actual.operation[i] or
+            expected.opcode[i] != actual.opcode[i] or
+            expected.rs[i] != actual.rs[i] or expected.rt[i] != actual.rt[i] or
+            expected.rd[i] != actual.rd[i] or
+            expected.shamt[i] != actual.shamt[i] or
+            expected.funct[i] != actual.funct[i] or
+            expected.immediate[i] != actual.immediate[i]) {
+            return i;
+        }
+    }
+
+    return std::nullopt;
+}
+
+// Bulk decode `code` followed by as many random words, which are mostly not
+// instructions, with every SIMD level this machine has. Each must find what
+// scalar decoding does. Returns how many did not.
+std::size_t check_bulk_decoder(
+    std::uint32_t seed,
+    std::vector<RawInstruction> const& code)
+{
+    auto words = code;
+    auto random = std::mt19937{seed};
+    words.resize(2 * code.size());
+    for (auto i = code.size(); i < words.size(); ++i) {
+        words[i] = static_cast<RawInstruction>(random());
+    }
+
+    auto expected = DecodedFields{};
+    decode_range(words.data(), words.size(), expected, SimdLevel::None);
+
+    auto const levels = {SimdLevel::SSE4, SimdLevel::AVX2, SimdLevel::AVX512};
+    auto differences = std::size_t{0};
+
+    for (auto const level: levels) {
+        if (level > best_simd_level()) {
+            continue;
+        }
+
+        auto actual = DecodedFields{};
+        decode_range(words.data(), words.size(), actual, level);
+
+        if (auto const index = first_difference(expected, actual)) {
+            std::printf(
+                "seed %u, bulk decoding with %s: %08x at %zu differs from "
+                "scalar\n",
+                seed,
+                mercury::name_of(level),
+                words[*index],
+                *index);
+            ++differences;
+        }
+    }
+
+    return differences;
+}
+
+// Run each of `count` random programs with every fast dispatch, and its
+// translation if it was built in, in lockstep with the table interpreter,
+// and bulk decode it. Returns how many runs diverged.
+std::size_t fuzz(std::uint32_t first_seed, std::uint32_t count)
+{
+    auto const dispatches = {
+        Dispatch::Threaded,
+        Dispatch::Blocks,
+        Dispatch::Jit,
+    };
+
+    auto divergences = std::size_t{0};
+
+    for (auto seed = first_seed; seed - first_seed < count; ++seed) {
+        auto const program = program_for(seed);
+        auto const& code = program.code;
+        auto const end = static_cast<Address>(code.size() * 4);
+
+        divergences += check_bulk_decoder(seed, code);
+
+        auto options = LockstepOptions{};
+        options.interval = 256;
+        options.max_steps = 100'000;
+        options.seed = seed;
+        options.breakpoints = {0, end};
+
+        auto const check = [&](char const* engine, CPU& candidate) {
+            auto reference = CPU{code.data(), code.size(), Dispatch::Table};
+            reference.registers() = program.registers;
+            candidate.registers() = program.registers;
+
+            if (auto const divergence =
+                    run_lockstep(reference, candidate, options)) {
+                report(seed, engine, program, *divergence);
+                ++divergences;
+            }
+        };
+
+        for (auto const dispatch: dispatches) {
+            auto candidate = CPU{code.data(), code.size(), dispatch};
+            check(name_of(dispatch), candidate);
+        }
+
+        if (auto const* translation = translation_for(seed)) {
+            auto candidate = CPU{code.data(), code.size(), Dispatch::Table};
+            candidate.attach(*translation);
+            check("aot", candidate);
+        }
+    }
+
+    return divergences;
+}
+
+void write_file(std::string const& path, std::ostringstream const& text)
+{
+    auto out = std::ofstream{path};
+
+    if (not (out << text.str()) or not out.flush()) {
+        throw std::runtime_error("Could not write " + path + ".");
+    }
+}
+
+// Translate the first `count` random programs to C++, into `directory`, as
+// program_<seed>.cpp defining a module fuzz_aot_<seed>, and list them by
+// seed in modules.cpp for mercury-fuzz-aot.
+void translate(std::uint32_t count, std::string const& directory)
+{
+    auto modules = std::ostringstream{};
+    modules << "// Listed by mercury-fuzz --translate. Do not edit.\n"
+               "\n"
+               "#include <cstddef>\n"
+               "\n"
+               "#include \"aot_module.hpp\"\n"
+               "\n";
+
+    for (auto seed = 0u; seed < count; ++seed) {
+        auto const program = program_for(seed);
+        auto const size = program.code.size() * sizeof(RawInstruction);
+        auto const end = static_cast<Address>(size);
+        auto const name = "fuzz_aot_" + std::to_string(seed);
+
+        auto memory = Memory{};
+        memory.write(0, program.code.data(), size);
+
+        auto text = std::ostringstream{};
+        translate_program(memory, {0, {0, end}, end}, name, text);
+        write_file(
+            directory + "/program_" + std::to_string(seed) + ".cpp", text);
+
+        modules << "extern mercury::aot::Module const " << name << ";\n";
+    }
+
+    modules << "\n"
+               "extern mercury::aot::Module const* const fuzz_aot_modules[];\n"
+               "extern std::size_t const fuzz_aot_module_count;\n"
+               "\n"
+               "mercury::aot::Module const* const fuzz_aot_modules[] = {\n";
+
+    for (auto seed = 0u; seed < count; ++seed) {
+        modules << "    &fuzz_aot_" << seed << ",\n";
+    }
+
+    modules << "};\n"
+               "\n"
+               "std::size_t const fuzz_aot_module_count = "
+            << count << ";\n";
+
+    write_file(directory + "/modules.cpp", modules);
+}
+
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 4 and std::string{argv[1]} == "--translate") {
+        try {
+            mercury::translate(
+                static_cast<std::uint32_t>(std::stoul(argv[2])), argv[3]);
+        } catch (std::runtime_error const& error) {
+            std::fprintf(stderr, "%s\n", error.what());
+            return 1;
+        }
+        return 0;
+    }
+
+    if (argc > 3) {
+        std::fprintf(
+            stderr,
+            "usage: mercury-fuzz [programs] [first seed]\n"
+            "       mercury-fuzz --translate <programs> <directory>\n");
+        return 1;
+    }
+
+    auto const count =
+        argc > 1 ? static_cast<std::uint32_t>(std::stoul(argv[1])) : 1000u;
+    auto const first_seed =
+        argc > 2 ? static_cast<std::uint32_t>(std::stoul(argv[2])) : 0u;
+
+    auto const divergences = mercury::fuzz(first_seed, count);
+
+    std::printf("%u programs, %zu divergences\n", count, divergences);
+
+    return divergences == 0 ? 0 : 1;
+}
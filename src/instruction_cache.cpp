@@ -0,0 +1 @@
+#include "instruction_cache.hpp"
@@ -0,0 +1,77 @@
+#ifndef MERCURY_INSTRUCTION_CACHE_HPP
+#define MERCURY_INSTRUCTION_CACHE_HPP
+
+#include <array>
+#include <cstddef>
+
+#include "decoded_instruction.hpp"
+#include "decoder.hpp"
+#include "memory.hpp"
+#include "registers.hpp"
+#include "specializer.hpp"
+
+namespace mercury {
+
+// Direct-mapped cache of decoded and specialized instructions, keyed by PC.
+//
+// Entries are filled lazily on a miss, so a loop only pays for decoding its
+// body once. Whoever writes to code memory must invalidate the affected
+// addresses.
+class InstructionCache {
+public:
+    static constexpr auto size = std::size_t{4096};
+
+    InstructionCache()
+    {
+        invalidate();
+    }
+
+    DecodedInstruction const& fetch(Memory& memory, Register pc)
+    {
+        auto& line = line_for(pc);
+
+        if (line.tag != pc) {
+            line.tag = pc;
+            line.decoded = specialize(
+                decode_instruction(memory.load<RawInstruction>(pc)));
+        }
+
+        return line.decoded;
+    }
+
+    void invalidate(Register address)
+    {
+        auto& line = line_for(address);
+
+        if (line.tag == (address & ~Register{3})) {
+            line.tag = invalid_tag;
+        }
+    }
+
+    void invalidate()
+    {
+        for (auto& line: lines) {
+            line.tag = invalid_tag;
+        }
+    }
+
+private:
+    // PCs are always word-aligned, so no PC ever matches this tag.
+    static constexpr auto invalid_tag = ~Register{0};
+
+    struct Line {
+        Register tag;
+        DecodedInstruction decoded;
+    };
+
+    Line& line_for(Register address)
+    {
+        return lines[(address / 4) % size];
+    }
+
+    std::array<Line, size> lines;
+};
+
+}
+
+#endif
@@ -35,6 +35,8 @@ enum class Funct: std::uint8_t {
     SLL = 0x00,
     SRL = 0x02,
     JR = 0x08,
+    SYSCALL = 0x0c,
+    SYNC = 0x0f,
     MFHI = 0x10,
     MFLO = 0x12,
     MULT = 0x18,
@@ -0,0 +1 @@
+#include "instruction_spec.hpp"
@@ -0,0 +1,256 @@
+#ifndef MERCURY_INSTRUCTION_SPEC_HPP
+#define MERCURY_INSTRUCTION_SPEC_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "decoded_instruction.hpp"
+#include "enum_tools.hpp"
+#include "instruction_formats.hpp"
+
+namespace mercury {
+
+enum class Format: std::uint8_t {
+    R,
+    I,
+    J,
+    // Not encodable, only ever bound by the specializer.
+    Special,
+};
+
+// How an instruction's low bits become its decoded immediate.
+enum class ImmediateKind: std::uint8_t {
+    None,
+    Signed,
+    Unsigned,
+    // Shifted into the upper halfword.
+    Upper,
+    Shift,
+    Branch,
+    Jump,
+};
+
+// The register an instruction writes, if any.
+enum class Destination: std::uint8_t {
+    None,
+    Rd,
+    Rt,
+    // The return address register, $ra.
+    Link,
+    // Both hi and lo.
+    HiLo,
+};
+
+// Where execution may go after an instruction.
+enum class Flow: std::uint8_t {
+    // Always on to the next instruction.
+    Next,
+    // Possibly somewhere else.
+    Jump,
+    // Possibly nowhere, if it raises an exception.
+    Trap,
+};
+
+// Everything there is to know about one instruction. The decoder's tables,
+// the handler table and the mnemonics are all checked against, or built
+// from, instruction_specs.
+struct InstructionSpec {
+    Operation operation;
+    char const* mnemonic;
+    Format format;
+    // Opcode::RInst for R instructions, which are told apart by `funct`.
+    Opcode opcode;
+    Funct funct;
+    ImmediateKind immediate;
+    Destination destination;
+    Flow flow;
+    // How many guest instructions it covers, which is only ever more than
+    // one for fused operations.
+    std::uint8_t width;
+};
+
+constexpr InstructionSpec r_spec(
+    Operation operation,
+    char const* mnemonic,
+    Funct funct,
+    Destination destination = Destination::Rd,
+    ImmediateKind immediate = ImmediateKind::None,
+    Flow flow = Flow::Next)
+{
+    return {
+        operation,
+        mnemonic,
+        Format::R,
+        Opcode::RInst,
+        funct,
+        immediate,
+        destination,
+        flow,
+        1,
+    };
+}
+
+constexpr InstructionSpec i_spec(
+    Operation operation,
+    char const* mnemonic,
+    Opcode opcode,
+    ImmediateKind immediate,
+    Destination destination = Destination::Rt,
+    Flow flow = Flow::Next)
+{
+    return {
+        operation,
+        mnemonic,
+        Format::I,
+        opcode,
+        Funct{0},
+        immediate,
+        destination,
+        flow,
+        1,
+    };
+}
+
+constexpr InstructionSpec j_spec(
+    Operation operation,
+    char const* mnemonic,
+    Opcode opcode,
+    Destination destination)
+{
+    return {
+        operation,
+        mnemonic,
+        Format::J,
+        opcode,
+        Funct{0},
+        ImmediateKind::Jump,
+        destination,
+        Flow::Jump,
+        1,
+    };
+}
+
+// `width` is how many instructions it stands for.
+constexpr InstructionSpec special_spec(
+    Operation operation,
+    char const* mnemonic,
+    Destination destination,
+    std::uint8_t width = 1)
+{
+    return {
+        operation,
+        mnemonic,
+        Format::Special,
+        Opcode::RInst,
+        Funct{0},
+        ImmediateKind::None,
+        destination,
+        Flow::Next,
+        width,
+    };
+}
+
+// One entry per operation, in the order of Operation, without UNKNOWN.
+// clang-format off
+inline constexpr auto instruction_specs = std::array{
+    r_spec(Operation::ADD, "add", Funct::ADD, Destination::Rd, ImmediateKind::None, Flow::Trap),
+    r_spec(Operation::ADDU, "addu", Funct::ADDU),
+    r_spec(Operation::AND, "and", Funct::AND),
+    r_spec(Operation::DIV, "div", Funct::DIV, Destination::HiLo, ImmediateKind::None, Flow::Trap),
+    r_spec(Operation::DIVU, "divu", Funct::DIVU, Destination::HiLo, ImmediateKind::None, Flow::Trap),
+    r_spec(Operation::JR, "jr", Funct::JR, Destination::None, ImmediateKind::None, Flow::Jump),
+    r_spec(Operation::MFHI, "mfhi", Funct::MFHI),
+    r_spec(Operation::MFLO, "mflo", Funct::MFLO),
+    r_spec(Operation::MULT, "mult", Funct::MULT, Destination::HiLo),
+    r_spec(Operation::MULTU, "multu", Funct::MULTU, Destination::HiLo),
+    r_spec(Operation::NOR, "nor", Funct::NOR),
+    r_spec(Operation::OR, "or", Funct::OR),
+    r_spec(Operation::SLL, "sll", Funct::SLL, Destination::Rd, ImmediateKind::Shift),
+    r_spec(Operation::SLT, "slt", Funct::SLT),
+    r_spec(Operation::SLTU, "sltu", Funct::SLTU),
+    r_spec(Operation::SRL, "srl", Funct::SRL, Destination::Rd, ImmediateKind::Shift),
+    r_spec(Operation::SUB, "sub", Funct::SUB, Destination::Rd, ImmediateKind::None, Flow::Trap),
+    r_spec(Operation::SUBU, "subu", Funct::SUBU),
+    r_spec(Operation::SYNC, "sync", Funct::SYNC, Destination::None),
+    r_spec(Operation::SYSCALL, "syscall", Funct::SYSCALL, Destination::None, ImmediateKind::None, Flow::Trap),
+
+    i_spec(Operation::ADDI, "addi", Opcode::ADDI, ImmediateKind::Signed, Destination::Rt, Flow::Trap),
+    i_spec(Operation::ADDIU, "addiu", Opcode::ADDIU, ImmediateKind::Signed),
+    i_spec(Operation::ANDI, "andi", Opcode::ANDI, ImmediateKind::Unsigned),
+    i_spec(Operation::BEQ, "beq", Opcode::BEQ, ImmediateKind::Branch, Destination::None, Flow::Jump),
+    i_spec(Operation::BNE, "bne", Opcode::BNE, ImmediateKind::Branch, Destination::None, Flow::Jump),
+    i_spec(Operation::LBU, "lbu", Opcode::LBU, ImmediateKind::Signed),
+    i_spec(Operation::LHU, "lhu", Opcode::LHU, ImmediateKind::Signed),
+    i_spec(Operation::LL, "ll", Opcode::LL, ImmediateKind::Signed),
+    i_spec(Operation::LUI, "lui", Opcode::LUI, ImmediateKind::Upper),
+    i_spec(Operation::LW, "lw", Opcode::LW, ImmediateKind::Signed),
+    i_spec(Operation::ORI, "ori", Opcode::ORI, ImmediateKind::Unsigned),
+    i_spec(Operation::SB, "sb", Opcode::SB, ImmediateKind::Signed, Destination::None),
+    i_spec(Operation::SC, "sc", Opcode::SC, ImmediateKind::Signed),
+    i_spec(Operation::SH, "sh", Opcode::SH, ImmediateKind::Signed, Destination::None),
+    i_spec(Operation::SLTI, "slti", Opcode::SLTI, ImmediateKind::Signed),
+    i_spec(Operation::SLTIU, "sltiu", Opcode::SLTIU, ImmediateKind::Signed),
+    i_spec(Operation::SW, "sw", Opcode::SW, ImmediateKind::Signed, Destination::None),
+
+    j_spec(Operation::J, "j", Opcode::J, Destination::None),
+    j_spec(Operation::JAL, "jal", Opcode::JAL, Destination::Link),
+
+    special_spec(Operation::NOP, "nop", Destination::None),
+    special_spec(Operation::MOVE, "move", Destination::Rd),
+    special_spec(Operation::LI, "li", Destination::Rt),
+    special_spec(Operation::LI32, "li32", Destination::Rt, 2),
+};
+// clang-format on
+
+static_assert(
+    instruction_specs.size() == operation_count - 1,
+    "Every operation but UNKNOWN needs exactly one spec.");
+
+constexpr bool specs_follow_operations()
+{
+    for (auto i = std::size_t{0}; i < instruction_specs.size(); ++i) {
+        if (value_of(instruction_specs[i].operation) != i + 1) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static_assert(
+    specs_follow_operations(),
+    "Specs must be in the same order as Operation.");
+
+// The spec of any operation but UNKNOWN.
+constexpr InstructionSpec const& spec_for(Operation operation)
+{
+    return instruction_specs[value_of(operation) - 1u];
+}
+
+// The assembly name of an operation, in lower case.
+constexpr char const* mnemonic(Operation operation)
+{
+    return operation == Operation::UNKNOWN ? "unknown"
+                                           : spec_for(operation).mnemonic;
+}
+
+// How many guest instructions an operation covers.
+constexpr std::size_t width_of(Operation operation)
+{
+    return operation == Operation::UNKNOWN ? 1 : spec_for(operation).width;
+}
+
+// Loads and stores of halfwords and words, which raise an address error
+// rather than run when their address is not a multiple of their size. They
+// trap too rarely to end blocks, so whatever runs them checks afterwards.
+constexpr bool needs_alignment(Operation operation)
+{
+    return operation == Operation::LHU or operation == Operation::LW or
+           operation == Operation::LL or operation == Operation::SH or
+           operation == Operation::SW or operation == Operation::SC;
+}
+
+}
+
+#endif
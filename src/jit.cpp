@@ -0,0 +1,667 @@
+#include "jit.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+
+#include "cpu_internals.hpp"
+#include "x86_emitter.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MERCURY_HAS_MMAP 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace mercury {
+
+#if defined(MERCURY_HAS_MMAP)
+
+CompiledBlock::CompiledBlock(std::vector<std::uint8_t> const& code):
+    pages{nullptr}, size{0}, function{nullptr}
+{
+    auto const page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    size = (code.size() + page_size - 1) / page_size * page_size;
+
+    pages = mmap(
+        nullptr,
+        size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0);
+
+    if (pages == MAP_FAILED) {
+        throw std::runtime_error("Could not map pages for compiled code.");
+    }
+
+    std::memcpy(pages, code.data(), code.size());
+
+    if (mprotect(pages, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(pages, size);
+        throw std::runtime_error("Could not make compiled code executable.");
+    }
+
+    function = reinterpret_cast<std::size_t (*)()>(pages);
+}
+
+CompiledBlock::~CompiledBlock()
+{
+    munmap(pages, size);
+}
+
+#else
+
+CompiledBlock::CompiledBlock(std::vector<std::uint8_t> const&):
+    pages{nullptr}, size{0}, function{nullptr}
+{
+    throw std::runtime_error("Compiled code needs mmap.");
+}
+
+CompiledBlock::~CompiledBlock() = default;
+
+#endif
+
+// Handlers take the instruction by value, and the System V ABI passes one
+// this size in a single register.
+static_assert(sizeof(DecodedInstruction) == sizeof(std::uint64_t));
+
+namespace {
+
+using x86::Alu;
+using x86::Condition;
+using x86::Reg;
+
+// rbx points at the guest registers, rbp at the CPU, and the others hold
+// the guest registers the block uses most. All of them are callee-saved, so
+// handlers leave them alone.
+constexpr auto guest_registers = Reg::rbx;
+constexpr auto cpu = Reg::rbp;
+constexpr auto mapped_hosts =
+    std::array{Reg::r12, Reg::r13, Reg::r14, Reg::r15};
+constexpr auto saved_hosts =
+    std::array{Reg::rbx, Reg::rbp, Reg::r12, Reg::r13, Reg::r14, Reg::r15};
+
+bool may_store(Operation operation)
+{
+    return operation == Operation::SB or operation == Operation::SH or
+           operation == Operation::SW or operation == Operation::SC;
+}
+
+class Compiler {
+public:
+    Compiler(CPUInternals& impl, Block const& block):
+        impl_{impl}, block_{block}
+    {
+        auto position = std::size_t{0};
+
+        for (auto const& instruction: block.instructions) {
+            positions.push_back(position);
+            position += width_of(instruction.operation);
+        }
+
+        positions.push_back(position);
+    }
+
+    std::vector<std::uint8_t> const& compile();
+
+private:
+    // A check that failed, for overflow or a misaligned jump, to be handed
+    // to the instruction's handler, which raises the trap.
+    struct SlowPath {
+        x86::Label label;
+        std::size_t index;
+    };
+
+    void map_registers();
+    bool compile_instruction(std::size_t index);
+
+    void binary(Alu operation, DecodedInstruction instruction);
+    void binary_immediate(Alu operation, DecodedInstruction instruction);
+    void compare(Condition condition, DecodedInstruction instruction);
+    void compare_immediate(
+        Condition condition,
+        DecodedInstruction instruction);
+    void checked(std::size_t index, DecodedInstruction instruction);
+    void branch(
+        Condition not_taken,
+        std::size_t index,
+        DecodedInstruction instruction);
+    void call_handler(std::size_t index);
+
+    std::int32_t offset_of(void const* field) const;
+    Register address_of(std::size_t index) const;
+
+    void read(Reg destination, std::uint8_t guest);
+    void combine(Alu operation, Reg destination, std::uint8_t guest);
+    void write(std::uint8_t guest, Reg source);
+    void write(std::uint8_t guest, std::uint32_t value);
+    void set_pc(Register value);
+
+    // Write back the host registers that changed, or read all of them
+    // again after a handler may have changed their guest registers.
+    void flush();
+    void reload();
+
+    void exit(std::size_t steps);
+
+    CPUInternals& impl_;
+    Block const& block_;
+    x86::Emitter a;
+    std::array<std::optional<Reg>, 32> hosts{};
+    std::array<bool, 32> dirty{};
+    std::vector<SlowPath> slow_paths;
+    // Where each of the block's operations is, counting guest instructions,
+    // which only differs from its index after a fused operation. One more
+    // gives the size of the block.
+    std::vector<std::size_t> positions;
+};
+
+std::vector<std::uint8_t> const& Compiler::compile()
+{
+    map_registers();
+
+    for (auto const host: saved_hosts) {
+        a.push(host);
+    }
+
+    // Keep the stack 16-byte aligned for handler calls.
+    a.sub_rsp(8);
+
+    a.mov64(
+        guest_registers,
+        reinterpret_cast<std::uintptr_t>(impl_.register_bank.data()));
+    a.mov64(cpu, reinterpret_cast<std::uintptr_t>(&impl_));
+    reload();
+
+    auto const size = block_.instructions.size();
+    auto exited = false;
+
+    for (auto i = std::size_t{0}; i < size and not exited; ++i) {
+        exited = compile_instruction(i);
+    }
+
+    if (not exited) {
+        flush();
+        set_pc(block_.end);
+        exit(block_.size());
+    }
+
+    for (auto const& slow_path: slow_paths) {
+        a.bind(slow_path.label);
+        call_handler(slow_path.index);
+        exit(positions[slow_path.index + 1]);
+    }
+
+    return a.code();
+}
+
+// Only inlined instructions count, since handlers work on the guest
+// registers in memory.
+void Compiler::map_registers()
+{
+    auto uses = std::array<unsigned, 32>{};
+
+    for (auto const& instruction: block_.instructions) {
+        switch (instruction.operation) {
+            case Operation::ADD:
+            case Operation::ADDU:
+            case Operation::AND:
+            case Operation::NOR:
+            case Operation::OR:
+            case Operation::SLT:
+            case Operation::SLTU:
+            case Operation::SUB:
+            case Operation::SUBU:
+                ++uses[instruction.rs];
+                ++uses[instruction.rt];
+                ++uses[instruction.rd];
+                break;
+            case Operation::SLL:
+            case Operation::SRL:
+                ++uses[instruction.rt];
+                ++uses[instruction.rd];
+                break;
+            case Operation::ADDI:
+            case Operation::ADDIU:
+            case Operation::ANDI:
+            case Operation::ORI:
+            case Operation::SLTI:
+            case Operation::SLTIU:
+            case Operation::BEQ:
+            case Operation::BNE:
+                ++uses[instruction.rs];
+                ++uses[instruction.rt];
+                break;
+            case Operation::MOVE:
+                ++uses[instruction.rs];
+                ++uses[instruction.rd];
+                break;
+            case Operation::LUI:
+            case Operation::LI:
+            case Operation::LI32:
+                ++uses[instruction.rt];
+                break;
+            case Operation::JR:
+                ++uses[instruction.rs];
+                break;
+            case Operation::MFHI:
+            case Operation::MFLO:
+                ++uses[instruction.rd];
+                break;
+            default:
+                break;
+        }
+    }
+
+    auto order = std::array<std::uint8_t, 32>{};
+    for (auto i = std::size_t{0}; i < order.size(); ++i) {
+        order[i] = static_cast<std::uint8_t>(i);
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&](auto lhs, auto rhs) {
+        return uses[lhs] > uses[rhs];
+    });
+
+    // A register used once costs as much to map as to leave in memory.
+    for (auto i = std::size_t{0}; i < mapped_hosts.size(); ++i) {
+        if (uses[order[i]] >= 2) {
+            hosts[order[i]] = mapped_hosts[i];
+        }
+    }
+}
+
+// Returns whether the instruction left the compiled code.
+bool Compiler::compile_instruction(std::size_t index)
+{
+    auto const instruction = block_.instructions[index];
+    auto const address = address_of(index);
+    auto const last = index + 1 == block_.instructions.size();
+
+    switch (instruction.operation) {
+        case Operation::ADDU:
+            binary(Alu::Add, instruction);
+            return false;
+        case Operation::AND:
+            binary(Alu::And, instruction);
+            return false;
+        case Operation::OR:
+            binary(Alu::Or, instruction);
+            return false;
+        case Operation::SUBU:
+            binary(Alu::Sub, instruction);
+            return false;
+        case Operation::NOR:
+            read(Reg::rax, instruction.rs);
+            combine(Alu::Or, Reg::rax, instruction.rt);
+            a.bitwise_not(Reg::rax);
+            write(instruction.rd, Reg::rax);
+            return false;
+        case Operation::SLT:
+            compare(Condition::Less, instruction);
+            return false;
+        case Operation::SLTU:
+            compare(Condition::Below, instruction);
+            return false;
+        case Operation::SLL:
+            read(Reg::rax, instruction.rt);
+            a.shift_left(
+                Reg::rax, static_cast<std::uint8_t>(instruction.immediate));
+            write(instruction.rd, Reg::rax);
+            return false;
+        case Operation::SRL:
+            read(Reg::rax, instruction.rt);
+            a.shift_right(
+                Reg::rax, static_cast<std::uint8_t>(instruction.immediate));
+            write(instruction.rd, Reg::rax);
+            return false;
+        case Operation::MFHI:
+            a.load(Reg::rax, guest_registers, offset_of(&impl_.hi));
+            write(instruction.rd, Reg::rax);
+            return false;
+        case Operation::MFLO:
+            a.load(Reg::rax, guest_registers, offset_of(&impl_.lo));
+            write(instruction.rd, Reg::rax);
+            return false;
+
+        case Operation::ADDIU:
+            binary_immediate(Alu::Add, instruction);
+            return false;
+        case Operation::ANDI:
+            binary_immediate(Alu::And, instruction);
+            return false;
+        case Operation::ORI:
+            binary_immediate(Alu::Or, instruction);
+            return false;
+        case Operation::SLTI:
+            compare_immediate(Condition::Less, instruction);
+            return false;
+        case Operation::SLTIU:
+            compare_immediate(Condition::Below, instruction);
+            return false;
+        case Operation::LUI:
+            write(instruction.rt, instruction.immediate);
+            return false;
+
+        case Operation::NOP:
+            return false;
+        case Operation::MOVE:
+            read(Reg::rax, instruction.rs);
+            write(instruction.rd, Reg::rax);
+            return false;
+        case Operation::LI:
+        case Operation::LI32:
+            write(instruction.rt, instruction.immediate);
+            return false;
+
+        case Operation::ADD:
+        case Operation::ADDI:
+        case Operation::SUB:
+            checked(index, instruction);
+            return false;
+
+        case Operation::BEQ:
+            branch(Condition::NotEqual, index, instruction);
+            return true;
+        case Operation::BNE:
+            branch(Condition::Equal, index, instruction);
+            return true;
+        case Operation::JAL:
+            write(31, address + 12);
+            [[fallthrough]];
+        case Operation::J:
+            flush();
+            set_pc(
+                ((address + 8) & bitwise::and_mask(4, 28)) |
+                instruction.immediate);
+            exit(positions[index + 1]);
+            return true;
+        case Operation::JR:
+            flush();
+            read(Reg::rax, instruction.rs);
+
+            // The handler raises the address error for misaligned targets.
+            a.mov(Reg::rcx, Reg::rax);
+            a.alu(Alu::And, Reg::rcx, 3u);
+            slow_paths.push_back({a.jump(Condition::NotEqual), index});
+
+            a.store(guest_registers, offset_of(&impl_.pc), Reg::rax);
+            exit(positions[index + 1]);
+            return true;
+
+        default:
+            break;
+    }
+
+    call_handler(index);
+
+    // The handler has set the PC, possibly to raise a trap.
+    if (last) {
+        exit(positions[index + 1]);
+        return true;
+    }
+
+    // Misaligned loads and stores raise an address error in the handler.
+    if (needs_alignment(instruction.operation)) {
+        a.mov64(
+            Reg::rax, reinterpret_cast<std::uintptr_t>(&impl_.trap_pending));
+        a.compare_byte(Reg::rax, 0);
+        auto const aligned = a.jump(Condition::Equal);
+        exit(positions[index + 1]);
+        a.bind(aligned);
+    }
+
+    // A store to the block itself makes the rest of it stale.
+    if (may_store(instruction.operation)) {
+        a.mov64(Reg::rax, reinterpret_cast<std::uintptr_t>(&block_.valid));
+        a.compare_byte(Reg::rax, 0);
+        auto const valid = a.jump(Condition::NotEqual);
+        exit(positions[index + 1]);
+        a.bind(valid);
+    }
+
+    return false;
+}
+
+void Compiler::binary(Alu operation, DecodedInstruction instruction)
+{
+    read(Reg::rax, instruction.rs);
+    combine(operation, Reg::rax, instruction.rt);
+    write(instruction.rd, Reg::rax);
+}
+
+void Compiler::binary_immediate(Alu operation, DecodedInstruction instruction)
+{
+    read(Reg::rax, instruction.rs);
+    a.alu(operation, Reg::rax, instruction.immediate);
+    write(instruction.rt, Reg::rax);
+}
+
+void Compiler::compare(Condition condition, DecodedInstruction instruction)
+{
+    read(Reg::rax, instruction.rs);
+    combine(Alu::Cmp, Reg::rax, instruction.rt);
+    a.set(condition, Reg::rax);
+    write(instruction.rd, Reg::rax);
+}
+
+void Compiler::compare_immediate(
+    Condition condition,
+    DecodedInstruction instruction)
+{
+    read(Reg::rax, instruction.rs);
+    a.alu(Alu::Cmp, Reg::rax, instruction.immediate);
+    a.set(condition, Reg::rax);
+    write(instruction.rt, Reg::rax);
+}
+
+// Signed additions and subtractions that overflow leave their destination
+// alone, so the result is only written once it is known to fit.
+void Compiler::checked(std::size_t index, DecodedInstruction instruction)
+{
+    // The slow path calls the handler, so nothing may be left to write back
+    // when it is taken.
+    flush();
+    read(Reg::rax, instruction.rs);
+
+    auto destination = instruction.rd;
+
+    switch (instruction.operation) {
+        case Operation::ADD:
+            combine(Alu::Add, Reg::rax, instruction.rt);
+            break;
+        case Operation::SUB:
+            combine(Alu::Sub, Reg::rax, instruction.rt);
+            break;
+        default:
+            a.alu(Alu::Add, Reg::rax, instruction.immediate);
+            destination = instruction.rt;
+            break;
+    }
+
+    slow_paths.push_back({a.jump(Condition::Overflow), index});
+    write(destination, Reg::rax);
+}
+
+void Compiler::branch(
+    Condition not_taken,
+    std::size_t index,
+    DecodedInstruction instruction)
+{
+    auto const address = address_of(index);
+
+    flush();
+    read(Reg::rax, instruction.rs);
+    combine(Alu::Cmp, Reg::rax, instruction.rt);
+
+    // Storing the PC leaves the flags alone.
+    set_pc(address + 4);
+    auto const skip = a.jump(not_taken);
+    set_pc(address + 4 + instruction.immediate);
+    a.bind(skip);
+
+    exit(positions[index + 1]);
+}
+
+// Call the handler the way the interpreter does, with the PC moved past the
+// instruction.
+void Compiler::call_handler(std::size_t index)
+{
+    auto const& instruction = block_.instructions[index];
+    auto const handler = instruction_handlers[instruction.operation];
+
+    auto bits = std::uint64_t{0};
+    std::memcpy(&bits, &instruction, sizeof(bits));
+
+    flush();
+    set_pc(address_of(index) + 4);
+    a.mov64(Reg::rdi, cpu);
+    a.mov64(Reg::rsi, bits);
+    a.mov64(Reg::rax, reinterpret_cast<std::uintptr_t>(handler));
+    a.call(Reg::rax);
+    reload();
+}
+
+// Fields of the CPU are addressed relative to its guest registers.
+std::int32_t Compiler::offset_of(void const* field) const
+{
+    auto const* base = static_cast<void const*>(impl_.register_bank.data());
+
+    return static_cast<std::int32_t>(
+        static_cast<char const*>(field) - static_cast<char const*>(base));
+}
+
+Register Compiler::address_of(std::size_t index) const
+{
+    return block_.start + static_cast<Register>(4 * positions[index]);
+}
+
+void Compiler::read(Reg destination, std::uint8_t guest)
+{
+    if (auto const host = hosts[guest]) {
+        a.mov(destination, *host);
+    } else {
+        a.load(
+            destination,
+            guest_registers,
+            offset_of(&impl_.register_bank[guest]));
+    }
+}
+
+void Compiler::combine(Alu operation, Reg destination, std::uint8_t guest)
+{
+    if (auto const host = hosts[guest]) {
+        a.alu(operation, destination, *host);
+    } else {
+        a.alu(
+            operation,
+            destination,
+            guest_registers,
+            offset_of(&impl_.register_bank[guest]));
+    }
+}
+
+// Writes to $zero, which only checked additions and subtractions still
+// make, are dropped.
+void Compiler::write(std::uint8_t guest, Reg source)
+{
+    if (guest == 0) {
+        return;
+    }
+
+    if (auto const host = hosts[guest]) {
+        a.mov(*host, source);
+        dirty[guest] = true;
+    } else {
+        a.store(
+            guest_registers, offset_of(&impl_.register_bank[guest]), source);
+    }
+}
+
+void Compiler::write(std::uint8_t guest, std::uint32_t value)
+{
+    if (guest == 0) {
+        return;
+    }
+
+    if (auto const host = hosts[guest]) {
+        a.mov(*host, value);
+        dirty[guest] = true;
+    } else {
+        a.store(
+            guest_registers, offset_of(&impl_.register_bank[guest]), value);
+    }
+}
+
+void Compiler::set_pc(Register value)
+{
+    a.store(guest_registers, offset_of(&impl_.pc), value);
+}
+
+void Compiler::flush()
+{
+    for (auto guest = std::size_t{0}; guest < hosts.size(); ++guest) {
+        if (dirty[guest]) {
+            a.store(
+                guest_registers,
+                offset_of(&impl_.register_bank[guest]),
+                *hosts[guest]);
+            dirty[guest] = false;
+        }
+    }
+}
+
+void Compiler::reload()
+{
+    for (auto guest = std::size_t{0}; guest < hosts.size(); ++guest) {
+        if (auto const host = hosts[guest]) {
+            a.load(
+                *host, guest_registers, offset_of(&impl_.register_bank[guest]));
+        }
+    }
+}
+
+// Return how many instructions ran. Whatever was written is flushed by
+// then.
+void Compiler::exit(std::size_t steps)
+{
+    a.mov(Reg::rax, static_cast<std::uint32_t>(steps));
+    a.add_rsp(8);
+
+    for (auto host = saved_hosts.rbegin(); host != saved_hosts.rend();
+         ++host) {
+        a.pop(*host);
+    }
+
+    a.ret();
+}
+
+}
+
+std::unique_ptr<CompiledBlock> compile_block(
+    CPUInternals& impl,
+    Block const& block)
+{
+    if constexpr (not jit_supported) {
+        return nullptr;
+    }
+
+    auto compiler = Compiler{impl, block};
+    auto const code = compiler.compile();
+    auto compiled = std::make_unique<CompiledBlock>(code);
+
+    if (impl.perf_map) {
+        impl.perf_map->add(
+            compiled->code(),
+            code.size(),
+            block.start,
+            block.end,
+            impl.symbols);
+    }
+
+    return compiled;
+}
+
+}
@@ -0,0 +1,68 @@
+#ifndef MERCURY_JIT_HPP
+#define MERCURY_JIT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace mercury {
+
+struct Block;
+struct CPUInternals;
+
+// Blocks are only compiled on x86-64 Linux. Elsewhere, Dispatch::Jit
+// interprets them like Dispatch::Blocks does.
+#if defined(__x86_64__) && defined(__linux__)
+constexpr auto jit_supported = true;
+#else
+constexpr auto jit_supported = false;
+#endif
+
+// How many times a block gets interpreted before it is compiled.
+constexpr auto jit_threshold = std::uint32_t{32};
+
+// A block compiled to host machine code, in pages of its own which are
+// never writable and executable at the same time.
+class CompiledBlock {
+public:
+    // Throws std::runtime_error if the pages cannot be mapped.
+    explicit CompiledBlock(std::vector<std::uint8_t> const& code);
+    ~CompiledBlock();
+
+    CompiledBlock(CompiledBlock const&) = delete;
+    CompiledBlock& operator=(CompiledBlock const&) = delete;
+
+    // Execute the block, leaving the PC wherever it exits to, and return
+    // how many instructions ran. That is fewer than the block's size if it
+    // overwrote its own code, in which case the block must not run again.
+    std::size_t run() const
+    {
+        return function();
+    }
+
+    void const* code() const
+    {
+        return pages;
+    }
+
+private:
+    void* pages;
+    std::size_t size;
+    std::size_t (*function)();
+};
+
+// Compile `block`, which belongs to `impl`'s block cache, or return nullptr
+// if this host has no JIT.
+//
+// The compiled code works on `impl` directly, keeping a few of the guest
+// registers the block uses most in host registers. ALU operations, moves,
+// constants, branches and jumps are inlined, as are additions and
+// subtractions that do not overflow. Everything else calls the instruction's handler.
+std::unique_ptr<CompiledBlock> compile_block(
+    CPUInternals& impl,
+    Block const& block);
+
+}
+
+#endif
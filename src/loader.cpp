@@ -0,0 +1,314 @@
+#include "loader.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "byte_order.hpp"
+#include "file_image.hpp"
+
+namespace mercury {
+
+namespace {
+
+struct Segment {
+    std::size_t offset;
+    Address address;
+    std::size_t file_size;
+    std::size_t memory_size;
+    bool executable;
+};
+
+// Put `segment` in memory, mapping the whole pages in the middle and copying
+// the partial ones at the edges.
+void load_segment(Memory& memory, FileImage const& image, Segment segment)
+{
+    if (segment.offset > image.size or
+        segment.file_size > image.size - segment.offset) {
+        throw std::runtime_error("Segment goes past the end of the file.");
+    }
+
+    auto const extent = std::max(segment.file_size, segment.memory_size);
+
+    if (extent > std::numeric_limits<Address>::max() - segment.address) {
+        throw std::runtime_error("Segment goes past the end of memory.");
+    }
+
+    auto const page_size = std::size_t{Memory::page_size};
+    auto* bytes = image.data.get() + segment.offset;
+    auto address = segment.address;
+    auto remaining = segment.file_size;
+
+    auto const copy = [&](std::size_t size) {
+        memory.write(address, bytes, size);
+        bytes += size;
+        address += static_cast<Address>(size);
+        remaining -= size;
+    };
+
+    if (address % page_size != 0) {
+        copy(std::min(remaining, page_size - address % page_size));
+    }
+
+    // The file and the guest only line up page by page if the segment is
+    // laid out that way, which it always is in practice.
+    auto const file_position = segment.offset + segment.file_size - remaining;
+    auto const mappable =
+        host_pages_match() and file_position % page_size == 0;
+
+    if (mappable and remaining >= page_size) {
+        auto const size = remaining - remaining % page_size;
+
+        if (memory.endianness() == Endianness::Big) {
+            swap_word_bytes(bytes, size);
+        }
+
+        memory.map(address, bytes, size, image.data);
+        bytes += size;
+        address += static_cast<Address>(size);
+        remaining -= size;
+    }
+
+    copy(remaining);
+}
+
+class HeaderReader {
+public:
+    HeaderReader(FileImage const& image, Endianness endianness):
+        image_{image}, endianness_{endianness}
+    {}
+
+    std::uint32_t word(std::size_t offset) const
+    {
+        return static_cast<std::uint32_t>(read(offset, 4));
+    }
+
+    std::uint16_t half(std::size_t offset) const
+    {
+        return static_cast<std::uint16_t>(read(offset, 2));
+    }
+
+    std::uint8_t byte(std::size_t offset) const
+    {
+        return static_cast<std::uint8_t>(read(offset, 1));
+    }
+
+    // The string starting at `offset`, which must end before `end`.
+    std::string string(std::size_t offset, std::size_t end) const
+    {
+        auto text = std::string{};
+
+        for (auto i = offset; byte(i) != 0; ++i) {
+            if (i + 1 >= end) {
+                throw std::runtime_error("Unterminated ELF string.");
+            }
+
+            text += static_cast<char>(byte(i));
+        }
+
+        return text;
+    }
+
+private:
+    std::uint64_t read(std::size_t offset, std::size_t size) const
+    {
+        if (offset > image_.size or size > image_.size - offset) {
+            throw std::runtime_error("Truncated ELF header.");
+        }
+
+        auto const* bytes = image_.data.get() + offset;
+        auto value = std::uint64_t{0};
+
+        for (auto i = std::size_t{0}; i < size; ++i) {
+            auto const index =
+                endianness_ == Endianness::Big ? i : size - 1 - i;
+            value = (value << 8) | std::to_integer<std::uint64_t>(bytes[index]);
+        }
+
+        return value;
+    }
+
+    FileImage const& image_;
+    Endianness endianness_;
+};
+
+namespace elf {
+
+constexpr auto class_32 = 1;
+constexpr auto data_little = 1;
+constexpr auto data_big = 2;
+constexpr auto machine_mips = 8;
+constexpr auto segment_load = 1;
+constexpr auto flag_executable = 1u;
+constexpr auto section_symbols = 2;
+constexpr auto symbol_notype = 0;
+constexpr auto symbol_function = 2;
+constexpr auto symbol_size = std::size_t{16};
+constexpr auto section_size = std::size_t{40};
+
+}
+
+// Check that `image` is a 32-bit MIPS ELF file, and return its byte order.
+Endianness check_elf(FileImage const& image, std::string const& path)
+{
+    auto const* ident = image.data.get();
+
+    if (image.size < 52 or ident[0] != std::byte{0x7f} or
+        ident[1] != std::byte{'E'} or ident[2] != std::byte{'L'} or
+        ident[3] != std::byte{'F'}) {
+        throw std::runtime_error(path + " is not an ELF file.");
+    }
+
+    if (std::to_integer<int>(ident[4]) != elf::class_32) {
+        throw std::runtime_error(path + " is not a 32-bit ELF file.");
+    }
+
+    auto const data = std::to_integer<int>(ident[5]);
+    if (data != elf::data_little and data != elf::data_big) {
+        throw std::runtime_error(path + " has an unknown byte order.");
+    }
+
+    auto const endianness =
+        data == elf::data_big ? Endianness::Big : Endianness::Little;
+
+    if (HeaderReader{image, endianness}.half(18) != elf::machine_mips) {
+        throw std::runtime_error(path + " is not a MIPS executable.");
+    }
+
+    return endianness;
+}
+
+}
+
+Program load_elf(Memory& memory, std::string const& path)
+{
+    auto const image = open_image(path);
+    auto const endianness = check_elf(image, path);
+    auto const header = HeaderReader{image, endianness};
+
+    auto const entry = header.word(24);
+    auto const table = std::size_t{header.word(28)};
+    auto const entry_size = std::size_t{header.half(42)};
+    auto const count = std::size_t{header.half(44)};
+
+    // Read every header before loading anything, since mapping a
+    // big-endian segment swaps the bytes of the file in place.
+    auto segments = std::vector<Segment>{};
+    for (auto i = std::size_t{0}; i < count; ++i) {
+        auto const at = table + i * entry_size;
+
+        if (header.word(at) != elf::segment_load) {
+            continue;
+        }
+
+        segments.push_back({
+            header.word(at + 4),
+            header.word(at + 8),
+            header.word(at + 16),
+            header.word(at + 20),
+            (header.word(at + 24) & elf::flag_executable) != 0,
+        });
+    }
+
+    memory.set_endianness(endianness);
+
+    auto code = AddressRange{
+        std::numeric_limits<Address>::max(),
+        std::numeric_limits<Address>::min(),
+    };
+
+    auto data_end = Address{0};
+
+    for (auto const& segment: segments) {
+        load_segment(memory, image, segment);
+
+        auto const end =
+            segment.address + static_cast<Address>(segment.memory_size);
+        data_end = std::max(data_end, end);
+
+        if (segment.executable) {
+            code.begin = std::min(code.begin, segment.address);
+            code.end = std::max(code.end, end);
+        }
+    }
+
+    if (code.begin >= code.end) {
+        throw std::runtime_error(path + " has no code to run.");
+    }
+
+    return {entry, code, data_end};
+}
+
+SymbolTable load_symbols(std::string const& path)
+{
+    auto const image = open_image(path);
+    auto const reader = HeaderReader{image, check_elf(image, path)};
+
+    auto const sections = std::size_t{reader.word(32)};
+    auto const count = std::size_t{reader.half(48)};
+
+    auto const section = [&](std::size_t index) {
+        return sections + index * elf::section_size;
+    };
+
+    auto symbols = SymbolTable{};
+
+    for (auto i = std::size_t{0}; i < count; ++i) {
+        if (reader.word(section(i) + 4) != elf::section_symbols) {
+            continue;
+        }
+
+        auto const table = std::size_t{reader.word(section(i) + 16)};
+        auto const size = std::size_t{reader.word(section(i) + 20)};
+        auto const names = section(reader.word(section(i) + 24));
+        auto const names_begin = std::size_t{reader.word(names + 16)};
+        auto const names_end = names_begin + reader.word(names + 20);
+
+        for (auto at = table; at + elf::symbol_size <= table + size;
+             at += elf::symbol_size) {
+            auto const type = reader.byte(at + 12) & 0xF;
+            auto const defined = reader.half(at + 14) != 0;
+
+            if (not defined or (type != elf::symbol_function and
+                                type != elf::symbol_notype)) {
+                continue;
+            }
+
+            auto name = reader.string(
+                names_begin + reader.word(at), names_end);
+
+            if (not name.empty()) {
+                symbols.add(
+                    std::move(name), reader.word(at + 4), reader.word(at + 8));
+            }
+        }
+    }
+
+    return symbols;
+}
+
+Program load_raw(
+    Memory& memory,
+    std::string const& path,
+    Address base,
+    Endianness endianness)
+{
+    auto const image = open_image(path);
+
+    memory.set_endianness(endianness);
+    load_segment(memory, image, {0, base, image.size, image.size, true});
+
+    auto const words = static_cast<Address>(image.size / 4);
+
+    return {
+        base,
+        {base, base + 4 * words},
+        base + static_cast<Address>(image.size),
+    };
+}
+
+}
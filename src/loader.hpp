@@ -0,0 +1,37 @@
+#ifndef MERCURY_LOADER_HPP
+#define MERCURY_LOADER_HPP
+
+#include <string>
+
+#include "memory.hpp"
+#include "program.hpp"
+#include "symbol_table.hpp"
+
+namespace mercury {
+
+// Load a MIPS32 ELF executable into `memory`, which is switched to the byte
+// order of the executable.
+//
+// Whole pages of each segment are mapped straight from the file, privately,
+// so that only the pages the guest writes to ever get copied. Big-endian
+// segments are byte-swapped in bulk as they are mapped, which writes to
+// every one of their pages, so those are all copied. Throws
+// std::runtime_error if the file cannot be loaded.
+Program load_elf(Memory& memory, std::string const& path);
+
+// The functions and labels in the symbol table of the ELF executable at
+// `path`, which is empty if it has none. Throws std::runtime_error if the
+// file cannot be read.
+SymbolTable load_symbols(std::string const& path);
+
+// Load a raw image into `memory` at `base`, with execution starting at its
+// first word. The whole image is considered code.
+Program load_raw(
+    Memory& memory,
+    std::string const& path,
+    Address base,
+    Endianness endianness);
+
+}
+
+#endif
@@ -0,0 +1,170 @@
+#include "lockstep.hpp"
+
+#include <algorithm>
+#include <random>
+
+namespace mercury {
+
+CPUState state_of(CPU const& cpu, RunResult result)
+{
+    return {
+        cpu.registers(),
+        cpu.hi(),
+        cpu.lo(),
+        cpu.pc(),
+        cpu.trap_pending(),
+        cpu.cause(),
+        result,
+    };
+}
+
+bool operator==(CPUState const& lhs, CPUState const& rhs)
+{
+    return lhs.registers == rhs.registers and lhs.hi == rhs.hi and
+           lhs.lo == rhs.lo and lhs.pc == rhs.pc and
+           lhs.trap_pending == rhs.trap_pending and lhs.cause == rhs.cause and
+           lhs.result.reason == rhs.result.reason and
+           lhs.result.steps == rhs.result.steps;
+}
+
+bool operator!=(CPUState const& lhs, CPUState const& rhs)
+{
+    return not(lhs == rhs);
+}
+
+bool skip_trap(CPU& cpu)
+{
+    cpu.return_from_trap(cpu.epc() + 4);
+    return true;
+}
+
+namespace {
+
+RunResult run(
+    CPU& cpu,
+    std::size_t length,
+    std::optional<Register> const& breakpoint)
+{
+    return breakpoint ? cpu.run_until(*breakpoint, length) : cpu.run(length);
+}
+
+// Go back to the start of a run that diverged, and run it again one
+// instruction at a time.
+std::optional<Divergence> narrow_down(
+    CPU& reference,
+    CPU& candidate,
+    Snapshot const& reference_start,
+    Snapshot const& candidate_start,
+    Divergence const& divergence)
+{
+    reference.restore(reference_start);
+    candidate.restore(candidate_start);
+
+    for (auto i = std::size_t{0}; i < divergence.length; ++i) {
+        auto const pc = reference.pc();
+        auto const expected =
+            state_of(reference, run(reference, 1, divergence.breakpoint));
+        auto const actual =
+            state_of(candidate, run(candidate, 1, divergence.breakpoint));
+
+        if (expected != actual) {
+            return Divergence{
+                divergence.step + i,
+                1,
+                divergence.breakpoint,
+                pc,
+                expected,
+                actual,
+            };
+        }
+
+        if (expected.result.reason != StopReason::StepLimit) {
+            break;
+        }
+    }
+
+    return std::nullopt;
+}
+
+}
+
+std::optional<Divergence> run_lockstep(
+    CPU& reference,
+    CPU& candidate,
+    LockstepOptions const& options,
+    TrapHandler const& on_trap)
+{
+    auto random = std::mt19937{options.seed.value_or(0)};
+    auto const below = [&](std::size_t bound) {
+        return std::size_t{random()} % bound;
+    };
+
+    auto const& breakpoints = options.breakpoints;
+    auto const breakpoint_count =
+        breakpoints.end > breakpoints.begin
+            ? std::size_t{(breakpoints.end - breakpoints.begin) / 4}
+            : std::size_t{0};
+
+    auto steps = std::size_t{0};
+    auto at_breakpoint = false;
+
+    while (steps < options.max_steps) {
+        auto length = std::min(options.interval, options.max_steps - steps);
+        auto breakpoint = std::optional<Register>{};
+
+        if (options.seed) {
+            length = 1 + below(length);
+
+            // Stopping at the same breakpoint again would get nowhere.
+            if (breakpoint_count != 0 and not at_breakpoint and
+                below(2) == 0) {
+                breakpoint = breakpoints.begin +
+                             static_cast<Register>(4 * below(breakpoint_count));
+            }
+        }
+
+        auto const pc = reference.pc();
+        auto const reference_start = reference.snapshot();
+        auto const candidate_start = candidate.snapshot();
+
+        auto const expected =
+            state_of(reference, run(reference, length, breakpoint));
+        auto const actual =
+            state_of(candidate, run(candidate, length, breakpoint));
+
+        if (expected != actual) {
+            auto const divergence =
+                Divergence{steps, length, breakpoint, pc, expected, actual};
+
+            return narrow_down(
+                       reference,
+                       candidate,
+                       reference_start,
+                       candidate_start,
+                       divergence)
+                .value_or(divergence);
+        }
+
+        steps += expected.result.steps;
+        at_breakpoint = false;
+
+        switch (expected.result.reason) {
+            case StopReason::Trap:
+                if (not on_trap(reference) or not on_trap(candidate)) {
+                    return std::nullopt;
+                }
+                break;
+            case StopReason::StepLimit:
+                break;
+            case StopReason::OutOfProgram:
+                return std::nullopt;
+            case StopReason::Breakpoint:
+                at_breakpoint = true;
+                break;
+        }
+    }
+
+    return std::nullopt;
+}
+
+}
@@ -0,0 +1,85 @@
+#ifndef MERCURY_LOCKSTEP_HPP
+#define MERCURY_LOCKSTEP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "registers.hpp"
+
+namespace mercury {
+
+// What lockstep runs compare: the architectural state of a CPU, and how its
+// last run ended.
+struct CPUState {
+    Registers registers;
+    Register hi;
+    Register lo;
+    Register pc;
+    bool trap_pending;
+    Register cause;
+    RunResult result;
+};
+
+CPUState state_of(CPU const& cpu, RunResult result);
+
+bool operator==(CPUState const& lhs, CPUState const& rhs);
+bool operator!=(CPUState const& lhs, CPUState const& rhs);
+
+struct LockstepOptions {
+    // The most instructions run between two comparisons.
+    std::size_t interval{64};
+
+    // Stop comparing after this many instructions, if the program is still
+    // running by then.
+    std::size_t max_steps{1'000'000};
+
+    // With a seed, runs are of random lengths up to `interval` instead, and
+    // half of them also stop at a random breakpoint in `breakpoints`, so that
+    // comparisons fall in the middle of blocks too.
+    std::optional<std::uint32_t> seed;
+    AddressRange breakpoints{0, 0};
+};
+
+// Where a candidate first disagreed with the reference.
+struct Divergence {
+    // How many instructions both had run, in agreement, before the run that
+    // diverged, and how many that run was asked for, along with its
+    // breakpoint. That is a single instruction if the divergence could be
+    // narrowed down to one, which it cannot when it depends on how long the
+    // run was.
+    std::size_t step;
+    std::size_t length;
+    std::optional<Register> breakpoint;
+    // Where that run started.
+    Register pc;
+    CPUState reference;
+    CPUState candidate;
+};
+
+// Handles a pending trap, returning whether to carry on.
+using TrapHandler = std::function<bool(CPU& cpu)>;
+
+// Carry on after the instruction that trapped.
+bool skip_trap(CPU& cpu);
+
+// Run `candidate` side by side with `reference`, from the same state, until
+// they disagree, the program leaves its code, `on_trap` gives up on a trap
+// or the step limit is reached. Both must have memory of their own, since
+// they are snapshotted before every run to narrow down divergences. After a
+// divergence, both are left somewhere around it.
+//
+// The reference is usually a CPU with Dispatch::Table, whose handlers define
+// what every instruction does, and the candidate a faster dispatch.
+std::optional<Divergence> run_lockstep(
+    CPU& reference,
+    CPU& candidate,
+    LockstepOptions const& options = {},
+    TrapHandler const& on_trap = skip_trap);
+
+}
+
+#endif
@@ -1,10 +1,227 @@
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 #include "cpu.hpp"
+#include "loader.hpp"
+#include "perf_map.hpp"
+#include "scheduler.hpp"
+#include "syscalls.hpp"
 
-int main()
+void print_registers(mercury::CPU const& cpu)
 {
+    auto count = 0;
+    for (auto& r: cpu.registers()) {
+        std::cout << "R" << count << ": " << r << '\n';
+        ++count;
+    }
+}
+
+// Say why `cpu` stopped if it was because of a trap.
+void report_trap(std::string const& name, mercury::CPU const& cpu)
+{
+    if (cpu.trap_pending()) {
+        auto const code = mercury::exception_code(cpu.cause());
+        std::cerr << name << ": " << mercury::name_of(code) << " at 0x"
+                  << std::hex << cpu.epc() << std::dec << '\n';
+    }
+}
+
+// Say how the guest behind `syscalls` ended, unless it exited successfully.
+void report_end(
+    std::string const& name,
+    mercury::CPU const& cpu,
+    mercury::Syscalls const& syscalls)
+{
+    auto const status = syscalls.exit_status();
+
+    if (not status) {
+        report_trap(name, cpu);
+    } else if (*status != 0) {
+        std::cerr << name << ": exited with status " << *status << '\n';
+    }
+}
+
+// When built with profiling, write each CPU's profile to the current
+// directory, as mercury-profile.json or, for several CPUs,
+// mercury-profile-<index>.json.
+void write_profiles(std::vector<std::unique_ptr<mercury::CPU>> const& cpus)
+{
+    if constexpr (mercury::profiling) {
+        for (auto i = std::size_t{0}; i < cpus.size(); ++i) {
+            auto const name = cpus.size() == 1
+                                  ? std::string{"mercury-profile.json"}
+                                  : "mercury-profile-" + std::to_string(i) +
+                                        ".json";
+            auto out = std::ofstream{name};
+            cpus[i]->profile().write_json(out);
+        }
+    }
+}
+
+// Run every ELF in `paths` to completion, each as a process of its own,
+// spreading them over all host threads. With a `trace` path, each CPU writes
+// a trace there or, for several CPUs, to <trace>-<index>. With `perf`, the
+// code the JIT compiles is described for Linux perf.
+int run_elfs(
+    std::vector<char const*> const& paths,
+    std::string const& trace,
+    bool perf)
+{
+    auto perf_map = std::unique_ptr<mercury::PerfMap>{};
+    auto cpus = std::vector<std::unique_ptr<mercury::CPU>>{};
+    auto processes = std::vector<std::unique_ptr<mercury::Syscalls>>{};
+
+    try {
+        if (perf) {
+            perf_map = std::make_unique<mercury::PerfMap>();
+        }
+
+        for (auto const* path: paths) {
+            auto& cpu = *cpus.emplace_back(
+                std::make_unique<mercury::CPU>(mercury::Dispatch::Jit));
+            auto const program = mercury::load_elf(cpu.memory(), path);
+            cpu.start(program);
+            processes.push_back(std::make_unique<mercury::Syscalls>(program));
+
+            if (perf_map) {
+                cpu.report_code_to(
+                    perf_map.get(), mercury::load_symbols(path));
+            }
+        }
+
+        for (auto i = std::size_t{0}; i < cpus.size() and not trace.empty();
+             ++i) {
+            cpus[i]->trace_to(
+                cpus.size() == 1 ? trace : trace + "-" + std::to_string(i));
+        }
+    } catch (std::runtime_error const& error) {
+        std::cerr << error.what() << '\n';
+        return 1;
+    }
+
+    auto guests = std::vector<mercury::CPU*>{};
+    for (auto& cpu: cpus) {
+        guests.push_back(cpu.get());
+    }
+
+    mercury::Scheduler{}.run(
+        guests,
+        mercury::unlimited_steps,
+        [&](std::size_t index, mercury::CPU& cpu) {
+            return processes[index]->handle(cpu) ? mercury::TrapAction::Resume
+                                                 : mercury::TrapAction::Stop;
+        });
+
+    for (auto& process: processes) {
+        process->flush();
+    }
+    write_profiles(cpus);
+
+    try {
+        for (auto& cpu: cpus) {
+            cpu->stop_trace();
+        }
+    } catch (std::runtime_error const& error) {
+        std::cerr << error.what() << '\n';
+        return 1;
+    }
+
+    for (auto i = std::size_t{0}; i < paths.size(); ++i) {
+        report_end(paths[i], *cpus[i], *processes[i]);
+
+        if (paths.size() > 1) {
+            std::cout << paths[i] << ":\n";
+        }
+        print_registers(*cpus[i]);
+    }
+
+    return 0;
+}
+
+// Run the ELF at `path` on `cores` CPUs sharing one memory, as one process,
+// each starting with its index in $a0.
+int run_smp(char const* path, std::size_t cores)
+{
+    auto cpus = std::vector<std::unique_ptr<mercury::CPU>>{};
+    auto process = std::unique_ptr<mercury::Syscalls>{};
+
+    try {
+        auto& first = *cpus.emplace_back(
+            std::make_unique<mercury::CPU>(mercury::Dispatch::Jit));
+        auto const program = mercury::load_elf(first.memory(), path);
+        first.start(program);
+        process = std::make_unique<mercury::Syscalls>(program);
+    } catch (std::runtime_error const& error) {
+        std::cerr << error.what() << '\n';
+        return 1;
+    }
+
+    auto guests = std::vector<mercury::CPU*>{cpus.front().get()};
+    for (auto i = std::size_t{1}; i < cores; ++i) {
+        auto& cpu = *cpus.emplace_back(std::make_unique<mercury::CPU>(
+            *cpus.front(), mercury::Dispatch::Jit));
+        cpu.registers()[4] = static_cast<mercury::Register>(i);
+        guests.push_back(&cpu);
+    }
+
+    // Once one core exits the process, the others stop too.
+    mercury::Scheduler{}.run(
+        guests, mercury::unlimited_steps, [&](std::size_t, mercury::CPU& cpu) {
+            if (process->handle(cpu)) {
+                return mercury::TrapAction::Resume;
+            }
+
+            return process->exit_status() ? mercury::TrapAction::StopAll
+                                          : mercury::TrapAction::Stop;
+        });
+
+    process->flush();
+    write_profiles(cpus);
+
+    for (auto i = std::size_t{0}; i < cores; ++i) {
+        report_end("core " + std::to_string(i), *cpus[i], *process);
+        std::cout << "core " << i << ":\n";
+        print_registers(*cpus[i]);
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 4 and std::string{argv[1]} == "--cores") {
+        auto const cores = std::stoul(argv[2]);
+        if (cores == 0) {
+            std::cerr << "--cores needs at least one core\n";
+            return 1;
+        }
+        return run_smp(argv[3], cores);
+    }
+
+    if (argc > 3 and std::string{argv[1]} == "--trace") {
+        if constexpr (not mercury::tracing) {
+            std::cerr << "--trace needs a build with MERCURY_TRACE\n";
+            return 1;
+        }
+        return run_elfs({argv + 3, argv + argc}, argv[2], false);
+    }
+
+    if (argc > 2 and std::string{argv[1]} == "--perf") {
+        if constexpr (not mercury::perf_map_supported) {
+            std::cerr << "--perf needs Linux\n";
+            return 1;
+        }
+        return run_elfs({argv + 2, argv + argc}, {}, true);
+    }
+
+    if (argc > 1) {
+        return run_elfs({argv + 1, argv + argc}, {}, false);
+    }
+
     auto const instructions = std::vector<mercury::RawInstruction>{
         0b001010'01000'01001'0000000000001010,  // slti $t1 $t0 10
         0b000100'00000'01001'0000000000000001,  // beq $t1 $zero
@@ -13,17 +230,14 @@ int main()
         0b000000'00000'00000'00000'00000'001000,    // jr $zero
     };
 
-    auto cpu = mercury::CPU{instructions.data()};
+    auto cpus = std::vector<std::unique_ptr<mercury::CPU>>{};
+    auto& cpu = *cpus.emplace_back(std::make_unique<mercury::CPU>(
+        instructions.data(),
+        instructions.size(),
+        mercury::Dispatch::Blocks));
 
-    while (cpu.pc()/4 < instructions.size()) {
-        cpu.execute_instruction();
-    }
-
-    {
-        auto count = 0;
-        for (auto& r: cpu.registers()) {
-            std::cout << "R" << count << ": " << r << '\n';
-            ++count;
-        }
-    }
+    cpu.run(mercury::unlimited_steps);
+    write_profiles(cpus);
+    report_trap("demo", cpu);
+    print_registers(cpu);
 }
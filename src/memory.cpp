@@ -0,0 +1,619 @@
+#include "memory.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace mercury {
+
+static constexpr auto zero_page = std::array<std::byte, Memory::page_size>{};
+
+Memory::Memory(Endianness endianness):
+    space{std::make_shared<AddressSpace>()}
+{
+    flush_tlb();
+    set_endianness(endianness);
+    space->views.push_back(this);
+}
+
+Memory::Memory(Memory& other, Shared):
+    space{other.space}, byte_swizzle{other.byte_swizzle}
+{
+    // Pages that were never written to are read from the zero page until
+    // now, which is no longer right once another view can write to them.
+    other.flush_tlb();
+    flush_tlb();
+
+    auto const lock = std::lock_guard{space->mutex};
+    space->views.push_back(this);
+}
+
+Memory::~Memory()
+{
+    auto const lock = std::lock_guard{space->mutex};
+    auto& views = space->views;
+    views.erase(std::find(views.begin(), views.end(), this));
+}
+
+Endianness Memory::endianness() const
+{
+    return byte_swizzle == 0 ? Endianness::Little : Endianness::Big;
+}
+
+void Memory::set_endianness(Endianness endianness)
+{
+    byte_swizzle = endianness == Endianness::Big ? 3 : 0;
+}
+
+bool Memory::shared() const
+{
+    return space.use_count() > 1;
+}
+
+std::uint64_t Memory::code_generation() const
+{
+    return space->code_generation.load(std::memory_order_acquire);
+}
+
+void Memory::wrote_code()
+{
+    if (shared()) {
+        space->code_generation.fetch_add(1, std::memory_order_release);
+    }
+}
+
+Memory::Page* Memory::find_page(Address address) const
+{
+    auto const& table = space->directory[address >> (page_bits + table_bits)];
+
+    if (not table) {
+        return nullptr;
+    }
+
+    auto& page = (*table)[(address >> page_bits) % table_size];
+
+    return page.bytes ? &page : nullptr;
+}
+
+Memory::Page& Memory::page_entry(Address address)
+{
+    auto& table = space->directory[address >> (page_bits + table_bits)];
+
+    if (not table) {
+        table = std::make_unique<PageTable>();
+    }
+
+    return (*table)[(address >> page_bits) % table_size];
+}
+
+Memory::Page& Memory::page_for_write(Address address)
+{
+    auto& page = page_entry(address);
+
+    if (not page.bytes or page.copy_on_write) {
+        auto owned = std::shared_ptr<std::byte[]>(new std::byte[page_size]());
+
+        if (page.bytes) {
+            std::memcpy(owned.get(), page.bytes, page_size);
+        }
+
+        page.bytes = owned.get();
+        page.owner = std::move(owned);
+        page.copy_on_write = false;
+
+        mark_dirty(address);
+
+        // The read TLB may still be pointing at the zero page, or at the
+        // frozen one.
+        flush_tlb(address);
+    }
+
+    return page;
+}
+
+void Memory::mark_dirty(Address address)
+{
+    if (space->base) {
+        space->dirty.push_back(page_base(address));
+    }
+}
+
+void Memory::flush_tlb(Address address)
+{
+    auto const index = tlb_index(address);
+
+    if (read_tlb[index].tag == page_base(address)) {
+        read_tlb[index] = {invalid_tag, nullptr};
+    }
+
+    if (write_tlb[index].tag == page_base(address)) {
+        write_tlb[index] = {invalid_tag, nullptr};
+    }
+}
+
+void Memory::flush_tlb()
+{
+    for (auto& entry: read_tlb) {
+        entry = {invalid_tag, nullptr};
+    }
+
+    for (auto& entry: write_tlb) {
+        entry = {invalid_tag, nullptr};
+    }
+}
+
+template <typename T>
+T Memory::load_slow(Address address)
+{
+    auto const location = address ^ swizzle<T>();
+
+    if (location % sizeof(T) != 0) {
+        // Misaligned accesses are put together a byte at a time, in the
+        // guest's byte order. Only the host makes them: guest loads and
+        // stores raise an address error first.
+        auto value = T{0};
+        for (auto i = std::size_t{0}; i < sizeof(T); ++i) {
+            auto const byte = T{load<std::uint8_t>(address + Address(i))};
+            auto const shift = endianness() == Endianness::Little
+                                   ? 8 * i
+                                   : 8 * (sizeof(T) - 1 - i);
+            value = static_cast<T>(value | (byte << shift));
+        }
+        return value;
+    }
+
+    auto const lock = std::lock_guard{space->mutex};
+
+    // Another view could write to a missing page at any time, so it must
+    // exist before a TLB can point at it.
+    auto const* page =
+        shared() ? &page_for_write(location) : find_page(location);
+    auto const* bytes = page ? page->bytes : zero_page.data();
+
+    read_tlb[tlb_index(location)] = {page_base(location), bytes};
+
+    return load_atomic<T>(bytes + offset_of(location));
+}
+
+template <typename T>
+bool Memory::store_slow(Address address, T value)
+{
+    auto const location = address ^ swizzle<T>();
+
+    if (location % sizeof(T) != 0) {
+        auto code = false;
+        for (auto i = std::size_t{0}; i < sizeof(T); ++i) {
+            auto const shift = endianness() == Endianness::Little
+                                   ? 8 * i
+                                   : 8 * (sizeof(T) - 1 - i);
+            auto const byte = static_cast<std::uint8_t>(value >> shift);
+            code = store<std::uint8_t>(address + Address(i), byte) or code;
+        }
+        return code;
+    }
+
+    auto const lock = std::lock_guard{space->mutex};
+    auto& page = page_for_write(location);
+
+    store_atomic(page.bytes + offset_of(location), value);
+
+    if (page.code) {
+        if (shared()) {
+            space->code_generation.fetch_add(1, std::memory_order_release);
+        }
+        return true;
+    }
+
+    write_tlb[tlb_index(location)] = {page_base(location), page.bytes};
+    read_tlb[tlb_index(location)] = {page_base(location), page.bytes};
+
+    return false;
+}
+
+template std::uint8_t Memory::load_slow(Address);
+template std::uint16_t Memory::load_slow(Address);
+template std::uint32_t Memory::load_slow(Address);
+
+template bool Memory::store_slow(Address, std::uint8_t);
+template bool Memory::store_slow(Address, std::uint16_t);
+template bool Memory::store_slow(Address, std::uint32_t);
+
+Memory::ReservationSlot& Memory::reservation_for(
+    AddressSpace& space,
+    Address address)
+{
+    return space.reservations[(address >> 2) % reservation_slots];
+}
+
+Memory::Link Memory::load_linked(Address address)
+{
+    auto const& slot = reservation_for(*space, address);
+    auto const version = slot.version.load(std::memory_order_acquire);
+
+    return {address, load<std::uint32_t>(address), version};
+}
+
+bool Memory::store_conditional(Link const& link, std::uint32_t value)
+{
+    if (link.address % 4 != 0) {
+        return false;
+    }
+
+    auto& entry = write_tlb[tlb_index(link.address)];
+    auto* bytes = entry.page;
+    auto code = false;
+
+    // Code pages never go in the write TLB, so that stores to them are seen.
+    if (entry.tag != page_base(link.address)) {
+        auto const lock = std::lock_guard{space->mutex};
+        auto& page = page_for_write(link.address);
+
+        bytes = page.bytes;
+        code = page.code;
+
+        if (not code) {
+            entry = {page_base(link.address), bytes};
+        }
+    }
+
+    auto& slot = reservation_for(*space, link.address);
+    auto const lock = std::lock_guard{slot.mutex};
+
+    if (slot.version.load(std::memory_order_relaxed) != link.version) {
+        return false;
+    }
+
+    auto* word = reinterpret_cast<std::uint32_t*>(
+        bytes + offset_of(link.address));
+    auto expected = link.value;
+
+#if defined(__GNUC__)
+    auto const stored = __atomic_compare_exchange_n(
+        word, &expected, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#else
+    auto const stored = *word == expected;
+    if (stored) {
+        *word = value;
+    }
+#endif
+
+    if (stored) {
+        slot.version.fetch_add(1, std::memory_order_release);
+
+        if (code) {
+            wrote_code();
+        }
+    }
+
+    return stored;
+}
+
+void Memory::read(Address address, void* data, std::size_t size)
+{
+    auto* out = static_cast<std::byte*>(data);
+
+    if (endianness() == Endianness::Big) {
+        for (auto i = std::size_t{0}; i < size; ++i) {
+            out[i] = std::byte{load<std::uint8_t>(address + Address(i))};
+        }
+        return;
+    }
+
+    auto const lock = std::lock_guard{space->mutex};
+
+    while (size > 0) {
+        auto const chunk =
+            std::min<std::size_t>(size, page_size - offset_of(address));
+        auto const* page = find_page(address);
+        auto const* bytes = page ? page->bytes : zero_page.data();
+
+        std::memcpy(out, bytes + offset_of(address), chunk);
+
+        out += chunk;
+        address += static_cast<Address>(chunk);
+        size -= chunk;
+    }
+}
+
+void Memory::write(Address address, void const* data, std::size_t size)
+{
+    auto const* in = static_cast<std::byte const*>(data);
+
+    if (endianness() == Endianness::Big) {
+        for (auto i = std::size_t{0}; i < size; ++i) {
+            auto const byte = std::to_integer<std::uint8_t>(in[i]);
+            store(address + Address(i), byte);
+        }
+        return;
+    }
+
+    auto const lock = std::lock_guard{space->mutex};
+
+    while (size > 0) {
+        auto const chunk =
+            std::min<std::size_t>(size, page_size - offset_of(address));
+        auto& page = page_for_write(address);
+
+        std::memcpy(page.bytes + offset_of(address), in, chunk);
+
+        in += chunk;
+        address += static_cast<Address>(chunk);
+        size -= chunk;
+    }
+}
+
+// Add the `size` bytes at `bytes` to `spans`, as part of the last span if
+// they follow on from it.
+template <typename Byte>
+static void append_span(
+    std::vector<Memory::HostSpan<Byte>>& spans,
+    Byte* bytes,
+    std::size_t size)
+{
+    if (not spans.empty() and
+        spans.back().data + spans.back().size == bytes) {
+        spans.back().size += size;
+    } else {
+        spans.push_back({bytes, size});
+    }
+}
+
+std::vector<Memory::HostSpan<std::byte const>>
+Memory::host_spans(Address address, std::size_t size)
+{
+    if (endianness() == Endianness::Big) {
+        throw std::logic_error("Big-endian memory has no host spans.");
+    }
+
+    auto spans = std::vector<HostSpan<std::byte const>>{};
+    auto const lock = std::lock_guard{space->mutex};
+
+    while (size > 0) {
+        auto const chunk =
+            std::min<std::size_t>(size, page_size - offset_of(address));
+        auto const* page = find_page(address);
+        auto const* bytes = page ? page->bytes : zero_page.data();
+
+        append_span(spans, bytes + offset_of(address), chunk);
+
+        address += static_cast<Address>(chunk);
+        size -= chunk;
+    }
+
+    return spans;
+}
+
+std::vector<Memory::HostSpan<std::byte>>
+Memory::writable_host_spans(Address address, std::size_t size)
+{
+    if (endianness() == Endianness::Big) {
+        throw std::logic_error("Big-endian memory has no host spans.");
+    }
+
+    auto spans = std::vector<HostSpan<std::byte>>{};
+    auto const lock = std::lock_guard{space->mutex};
+
+    while (size > 0) {
+        auto const chunk =
+            std::min<std::size_t>(size, page_size - offset_of(address));
+        auto& page = page_for_write(address);
+
+        append_span(spans, page.bytes + offset_of(address), chunk);
+
+        address += static_cast<Address>(chunk);
+        size -= chunk;
+    }
+
+    return spans;
+}
+
+void Memory::map(
+    Address address,
+    std::byte* host,
+    std::size_t size,
+    std::shared_ptr<void const> owner)
+{
+    auto const lock = std::lock_guard{space->mutex};
+
+    for (auto offset = std::size_t{0}; offset < size; offset += page_size) {
+        auto const page_address = address + static_cast<Address>(offset);
+        auto& page = page_entry(page_address);
+
+        page.bytes = host + offset;
+        page.owner = owner;
+        page.copy_on_write = false;
+
+        mark_dirty(page_address);
+
+        for (auto* view: space->views) {
+            view->flush_tlb(page_address);
+        }
+    }
+}
+
+void Memory::discard(Address address, std::size_t size)
+{
+    auto const lock = std::lock_guard{space->mutex};
+
+    for (auto offset = std::size_t{0}; offset < size; offset += page_size) {
+        auto const page_address = address + static_cast<Address>(offset);
+        auto const* page = find_page(page_address);
+
+        if (not page) {
+            continue;
+        }
+
+        if (page->code or shared()) {
+            std::memset(page_for_write(page_address).bytes, 0, page_size);
+            continue;
+        }
+
+        page_entry(page_address) = {};
+
+        mark_dirty(page_address);
+        flush_tlb(page_address);
+    }
+}
+
+void Memory::mark_code(AddressRange range)
+{
+    auto const lock = std::lock_guard{space->mutex};
+
+    for (auto address = page_base(range.begin); address < range.end;
+         address += page_size) {
+        auto& page = page_for_write(address);
+
+        // Snapshots and restores only look at dirty pages for changes.
+        if (not page.code) {
+            page.code = true;
+            mark_dirty(address);
+        }
+
+        for (auto* view: space->views) {
+            auto& entry = view->write_tlb[tlb_index(address)];
+            if (entry.tag == address) {
+                entry = {invalid_tag, nullptr};
+            }
+        }
+
+        // Avoid wrapping around at the top of the address space.
+        if (address == page_base(~Address{0})) {
+            break;
+        }
+    }
+}
+
+Memory::Image Memory::snapshot()
+{
+    if (shared()) {
+        throw std::logic_error("Cannot snapshot a shared address space.");
+    }
+
+    auto const lock = std::lock_guard{space->mutex};
+    auto pages = std::make_shared<std::vector<ImagePage>>();
+
+    auto const freeze = [&](Address address, Page& page) {
+        page.copy_on_write = true;
+        pages->push_back({address, page.bytes, page.owner, page.code});
+    };
+
+    if (space->base) {
+        // Only the pages written since the last snapshot or restore can
+        // differ from it, so merge those into it rather than walk every
+        // page table.
+        auto& dirty = space->dirty;
+        std::sort(dirty.begin(), dirty.end());
+        dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+        auto const& base = *space->base;
+        auto next = dirty.begin();
+        pages->reserve(base.size() + dirty.size());
+
+        auto const freeze_dirty_below = [&](std::uint64_t end) {
+            for (; next != dirty.end() and *next < end; ++next) {
+                if (auto* const page = find_page(*next)) {
+                    freeze(*next, *page);
+                }
+            }
+        };
+
+        for (auto const& frozen: base) {
+            freeze_dirty_below(frozen.address);
+
+            if (next != dirty.end() and *next == frozen.address) {
+                continue;
+            }
+
+            pages->push_back(frozen);
+        }
+
+        freeze_dirty_below(std::uint64_t{1} << 32);
+    } else {
+        for (auto i = std::size_t{0}; i < table_size; ++i) {
+            auto const& table = space->directory[i];
+
+            if (not table) {
+                continue;
+            }
+
+            for (auto j = std::size_t{0}; j < table_size; ++j) {
+                auto& page = (*table)[j];
+
+                if (not page.bytes) {
+                    continue;
+                }
+
+                auto const address =
+                    static_cast<Address>(((i * table_size) + j) << page_bits);
+                freeze(address, page);
+            }
+        }
+    }
+
+    space->base = pages;
+    space->dirty.clear();
+
+    // Every page is read-only from now on.
+    flush_tlb();
+
+    return {endianness(), std::move(pages)};
+}
+
+bool Memory::restore(Image const& image)
+{
+    if (shared()) {
+        throw std::logic_error("Cannot restore a shared address space.");
+    }
+
+    auto const lock = std::lock_guard{space->mutex};
+    auto const& pages = *image.pages;
+    auto code_changed = false;
+
+    auto const install = [&](Page& page, ImagePage const* frozen) {
+        code_changed = code_changed or page.code or (frozen and frozen->code);
+
+        page = frozen ? Page{frozen->bytes, frozen->owner, frozen->code, true}
+                      : Page{};
+    };
+
+    if (space->base == image.pages) {
+        for (auto const address: space->dirty) {
+            auto const frozen = std::lower_bound(
+                pages.begin(),
+                pages.end(),
+                address,
+                [](ImagePage const& page, Address value) {
+                    return page.address < value;
+                });
+            auto const found =
+                frozen != pages.end() and frozen->address == address;
+
+            install(page_entry(address), found ? &*frozen : nullptr);
+        }
+    } else {
+        for (auto& table: space->directory) {
+            if (not table) {
+                continue;
+            }
+
+            for (auto& page: *table) {
+                if (page.bytes) {
+                    install(page, nullptr);
+                }
+            }
+        }
+
+        for (auto const& frozen: pages) {
+            install(page_entry(frozen.address), &frozen);
+        }
+    }
+
+    space->base = image.pages;
+    space->dirty.clear();
+
+    set_endianness(image.endianness);
+    flush_tlb();
+
+    return code_changed;
+}
+
+}
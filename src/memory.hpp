@@ -0,0 +1,361 @@
+#ifndef MERCURY_MEMORY_HPP
+#define MERCURY_MEMORY_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace mercury {
+
+using Address = std::uint32_t;
+
+// A half-open range of guest addresses.
+struct AddressRange {
+    Address begin;
+    Address end;
+
+    constexpr bool contains(Address address) const
+    {
+        return address >= begin and address < end;
+    }
+};
+
+enum class Endianness {
+    Little,
+    Big,
+};
+
+// The guest's flat 4 GiB address space.
+//
+// Pages are allocated the first time they are written to, and reading from
+// a page that was never written gives zeroes. Host memory, such as a mapped
+// file, can also be mapped straight into the address space.
+//
+// Words are always kept in host order. For a big-endian guest, the bytes of
+// each word are stored swapped, and byte and halfword accesses flip their
+// address within the word to compensate.
+//
+// Loads and stores first look their page up in a small direct-mapped TLB of
+// host pointers, so that an aligned access to a recently used page costs a
+// compare and a copy. Everything else takes the out-of-line slow path.
+//
+// Several Memory objects can share one address space, so that CPUs on
+// different host threads see each other's stores. Each of them keeps TLBs
+// of its own, and guest loads and stores are single-copy atomic.
+//
+// A snapshot freezes every page as it is, and the memory then copies a page
+// the first time it writes to it. Restoring the snapshot only has to put
+// back the pages written since.
+class Memory {
+public:
+    static constexpr auto page_bits = 12;
+    static constexpr auto page_size = Address{1} << page_bits;
+
+    // Tag for constructing a Memory that shares another one's address space.
+    struct Shared {};
+
+    // A reservation taken by load_linked().
+    struct Link {
+        Address address;
+        std::uint32_t value;
+        std::uint64_t version;
+    };
+
+    // A page of an Image. Its bytes are never written to.
+    struct ImagePage {
+        Address address;
+        std::byte* bytes;
+        std::shared_ptr<void const> owner;
+        bool code;
+    };
+
+    // The contents of the whole address space at some point, as the pages
+    // that were ever written to, sorted by address. Copies share the pages.
+    struct Image {
+        Endianness endianness{Endianness::Little};
+        std::shared_ptr<std::vector<ImagePage> const> pages;
+    };
+
+    explicit Memory(Endianness endianness = Endianness::Little);
+
+    // Another view of `other`'s address space. `other` must not be in use by
+    // another thread while this is being constructed.
+    Memory(Memory& other, Shared);
+    ~Memory();
+
+    Memory(Memory const&) = delete;
+    Memory& operator=(Memory const&) = delete;
+
+    Endianness endianness() const;
+
+    // Changing the byte order does not convert what is already stored. It
+    // must be set before the memory is shared.
+    void set_endianness(Endianness endianness);
+
+    // Load a value of type T (std::uint8_t, std::uint16_t or std::uint32_t)
+    // from `address`.
+    template <typename T>
+    T load(Address address)
+    {
+        auto const location = address ^ swizzle<T>();
+        auto const& entry = read_tlb[tlb_index(location)];
+
+        if (entry.tag == tag_of<T>(location)) {
+            return load_atomic<T>(entry.page + offset_of(location));
+        }
+
+        return load_slow<T>(address);
+    }
+
+    // Store a value of type T at `address`. Returns whether the store hit a
+    // page marked as code, in which case decoded copies of that code are
+    // stale.
+    template <typename T>
+    bool store(Address address, T value)
+    {
+        auto const location = address ^ swizzle<T>();
+        auto const& entry = write_tlb[tlb_index(location)];
+
+        if (entry.tag == tag_of<T>(location)) {
+            store_atomic(entry.page + offset_of(location), value);
+            return false;
+        }
+
+        return store_slow<T>(address, value);
+    }
+
+    // Load a word and reserve it for a following store_conditional().
+    Link load_linked(Address address);
+
+    // Store `value` at the linked address if no other store_conditional()
+    // has hit it, and no store has changed it, since it was loaded. Returns
+    // whether the store happened. Misaligned addresses always fail.
+    //
+    // Reservations are tracked per granule of a hashed table, so the store
+    // may also fail because of a store_conditional() to some other address,
+    // which guests must retry anyway.
+    bool store_conditional(Link const& link, std::uint32_t value);
+
+    // Incremented whenever a store hits code while the memory is shared, so
+    // that other CPUs can tell their decoded instructions may be stale.
+    std::uint64_t code_generation() const;
+
+    // Tell the other views that code has changed other than through store(),
+    // as by write() or through host spans, so that their CPUs drop what they
+    // decoded. Only needed once the bytes are in place.
+    void wrote_code();
+
+    // Bulk copies of byte streams between guest and host memory. Writing
+    // over code does not invalidate anything, the caller is responsible for
+    // that, with wrote_code() for other CPUs. These are not atomic with
+    // respect to guest accesses from other threads.
+    void read(Address address, void* data, std::size_t size);
+    void write(Address address, void const* data, std::size_t size);
+
+    // Host bytes backing part of the address space.
+    template <typename Byte>
+    struct HostSpan {
+        Byte* data;
+        std::size_t size;
+    };
+
+    // The host bytes behind [address, address + size), in order, so that
+    // host I/O can read or fill guest buffers in place. Pages that follow
+    // each other in host memory, as mapped files do, come as one span. The
+    // spans stay valid until pages are remapped or restored.
+    //
+    // Only little-endian memory keeps guest bytes in order, so these throw
+    // std::logic_error for big-endian memory. Like write(), filling the
+    // writable spans does not invalidate code.
+    std::vector<HostSpan<std::byte const>>
+    host_spans(Address address, std::size_t size);
+    std::vector<HostSpan<std::byte>>
+    writable_host_spans(Address address, std::size_t size);
+
+    // Make the `size` bytes at `host` show up at `address`, without copying
+    // them. Both must be page-aligned and `size` must be a multiple of the
+    // page size. The data must already be in the layout described above, and
+    // is kept alive by `owner`. Pages must not be remapped while another
+    // thread is using the memory.
+    void map(
+        Address address,
+        std::byte* host,
+        std::size_t size,
+        std::shared_ptr<void const> owner);
+
+    // Make the pages in [address, address + size) read as zeroes again,
+    // dropping them so that they take no host memory until written to.
+    // `address` must be page-aligned. Pages of code are zeroed in place
+    // instead, to stay marked, and so are all pages while the address space
+    // is shared, since other threads may still hold them in their TLBs.
+    // Like write(), this does not invalidate code.
+    void discard(Address address, std::size_t size);
+
+    // Mark the pages overlapping `range` as holding code. Stores to them
+    // always take the slow path, in every view, which reports them. Other
+    // views of the address space must not be in use by another thread
+    // meanwhile.
+    void mark_code(AddressRange range);
+
+    // Freeze the current contents of memory, without copying any page. After
+    // the first, only pages written since the last snapshot or restore are
+    // looked at. Throws std::logic_error if the address space is shared.
+    Image snapshot();
+
+    // Go back to the contents of `image`. If it is the last snapshot taken
+    // or restored here, only the pages written since are touched. Returns
+    // whether any page holding code, before or after, changed. Throws
+    // std::logic_error if the address space is shared.
+    bool restore(Image const& image);
+
+private:
+    static constexpr auto table_bits = 10;
+    static constexpr auto table_size = std::size_t{1} << table_bits;
+    static constexpr auto tlb_size = std::size_t{256};
+    static constexpr auto reservation_slots = std::size_t{256};
+
+    static_assert(
+        page_bits + 2 * table_bits == 32,
+        "Page tables must cover exactly the 32-bit address space.");
+
+    // Tags only ever have bits in the page number and the low two bits for
+    // misalignment, so this one never matches.
+    static constexpr auto invalid_tag = Address{4};
+
+    struct Page {
+        // Points into `owner`, which is either a page of our own or someone
+        // else's mapping.
+        std::byte* bytes{nullptr};
+        std::shared_ptr<void const> owner;
+        bool code{false};
+        // Part of an Image, so it must be copied before being written to.
+        bool copy_on_write{false};
+    };
+
+    using PageTable = std::array<Page, table_size>;
+
+    // Store-conditionals to the words hashing to a slot are serialized, and
+    // each successful one bumps its version.
+    struct alignas(64) ReservationSlot {
+        std::mutex mutex;
+        std::atomic<std::uint64_t> version{0};
+    };
+
+    // What every view of the address space shares. The page tables are only
+    // touched with `mutex` held.
+    struct AddressSpace {
+        std::mutex mutex;
+        std::array<std::unique_ptr<PageTable>, table_size> directory;
+        std::array<ReservationSlot, reservation_slots> reservations;
+        std::atomic<std::uint64_t> code_generation{0};
+
+        // Every view, so that remapping pages or marking them as code can
+        // reach all of their TLBs.
+        std::vector<Memory*> views;
+
+        // The image last snapshotted or restored, and the addresses of the
+        // pages that have been replaced since, maybe more than once.
+        std::shared_ptr<std::vector<ImagePage> const> base;
+        std::vector<Address> dirty;
+    };
+
+    template <typename Pointer>
+    struct TLBEntry {
+        Address tag;
+        Pointer page;
+    };
+
+    static constexpr Address page_base(Address address)
+    {
+        return address & ~(page_size - 1);
+    }
+
+    static constexpr Address offset_of(Address address)
+    {
+        return address & (page_size - 1);
+    }
+
+    static constexpr std::size_t tlb_index(Address address)
+    {
+        return (address >> page_bits) % tlb_size;
+    }
+
+    // Misaligned addresses keep their low bits in the tag, so that they
+    // never hit the TLB.
+    template <typename T>
+    static constexpr Address tag_of(Address address)
+    {
+        return address & ~((page_size - 1) & ~Address{sizeof(T) - 1});
+    }
+
+    // Where a value of type T actually lives within its word.
+    template <typename T>
+    Address swizzle() const
+    {
+        return byte_swizzle & Address{4 - sizeof(T)};
+    }
+
+    // Guest memory is accessed with relaxed atomics, so that other threads
+    // sharing it never see torn values.
+    template <typename T>
+    static T load_atomic(std::byte const* bytes)
+    {
+#if defined(__GNUC__)
+        return __atomic_load_n(
+            reinterpret_cast<T const*>(bytes), __ATOMIC_RELAXED);
+#else
+        auto value = T{};
+        std::memcpy(&value, bytes, sizeof(T));
+        return value;
+#endif
+    }
+
+    template <typename T>
+    static void store_atomic(std::byte* bytes, T value)
+    {
+#if defined(__GNUC__)
+        __atomic_store_n(reinterpret_cast<T*>(bytes), value, __ATOMIC_RELAXED);
+#else
+        std::memcpy(bytes, &value, sizeof(T));
+#endif
+    }
+
+    static ReservationSlot& reservation_for(
+        AddressSpace& space,
+        Address address);
+
+    bool shared() const;
+
+    // These must be called with the address space's mutex held.
+    Page* find_page(Address address) const;
+    Page& page_entry(Address address);
+    Page& page_for_write(Address address);
+    void mark_dirty(Address address);
+
+    void flush_tlb(Address address);
+    void flush_tlb();
+
+    template <typename T>
+    T load_slow(Address address);
+
+    template <typename T>
+    bool store_slow(Address address, T value);
+
+    std::shared_ptr<AddressSpace> space;
+
+    // 3 for big-endian, 0 for little-endian. Read by every access, so it
+    // comes before the TLBs rather than 8 KiB after the start of them.
+    Address byte_swizzle;
+
+    std::array<TLBEntry<std::byte const*>, tlb_size> read_tlb;
+    std::array<TLBEntry<std::byte*>, tlb_size> write_tlb;
+};
+
+}
+
+#endif
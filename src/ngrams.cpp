@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "block_cache.hpp"
+#include "decoder.hpp"
+#include "instruction_spec.hpp"
+#include "specializer.hpp"
+#include "superinstructions.hpp"
+#include "trace_reader.hpp"
+
+namespace mercury {
+
+namespace {
+
+using Operations = std::vector<Operation>;
+
+// Every straight-line run of operations the traces went through, as blocks
+// would have executed it, with how many times it ran for each instruction in
+// its trace. Each trace weighs the same, however long it is.
+using Runs = std::map<Operations, double>;
+
+// Split the trace into the runs of instructions that blocks would have
+// executed, specialized and fused as they are in blocks.
+void add_trace(std::istream& in, Runs& runs)
+{
+    auto reader = TraceReader{in};
+    auto counts = std::map<Operations, std::uint64_t>{};
+    auto instructions = std::uint64_t{0};
+    auto run = std::vector<DecodedInstruction>{};
+    auto next_pc = Register{0};
+
+    auto const end_run = [&] {
+        if (not run.empty()) {
+            auto operations = Operations{};
+            for (auto const& instruction: run) {
+                operations.push_back(instruction.operation);
+            }
+
+            ++counts[operations];
+            run.clear();
+        }
+    };
+
+    while (auto const record = reader.next()) {
+        auto const decoded = specialize(decode_instruction(record->raw));
+
+        ++instructions;
+
+        if (record->pc != next_pc or
+            run.size() == BlockCache::max_block_size) {
+            end_run();
+        }
+
+        auto const fused =
+            run.empty() ? std::nullopt : fuse(run.back(), decoded);
+
+        if (fused) {
+            run.back() = *fused;
+        } else {
+            run.push_back(decoded);
+        }
+
+        next_pc = record->pc + 4;
+
+        if (decoded.operation == Operation::UNKNOWN or
+            spec_for(decoded.operation).flow != Flow::Next) {
+            end_run();
+        }
+    }
+
+    end_run();
+
+    for (auto const& [operations, count]: counts) {
+        runs[operations] +=
+            static_cast<double>(count) / static_cast<double>(instructions);
+    }
+}
+
+// How many dispatches a run takes with `chosen` superinstructions, matched
+// as blocks match them: the longest one at each instruction, or the first
+// listed of equally long ones.
+std::size_t dispatches(
+    Operations const& run,
+    std::vector<Operations> const& chosen)
+{
+    auto count = std::size_t{0};
+
+    for (auto i = std::size_t{0}; i < run.size(); ++count) {
+        auto length = std::size_t{1};
+
+        for (auto const& superinstruction: chosen) {
+            if (superinstruction.size() > length and
+                superinstruction.size() <= run.size() - i and
+                std::equal(
+                    superinstruction.begin(),
+                    superinstruction.end(),
+                    run.begin() + static_cast<std::ptrdiff_t>(i))) {
+                length = superinstruction.size();
+            }
+        }
+
+        i += length;
+    }
+
+    return count;
+}
+
+// How many dispatches each instruction takes, on average, with `chosen`
+// superinstructions, summed over the traces.
+double dispatch_share(Runs const& runs, std::vector<Operations> const& chosen)
+{
+    auto share = 0.0;
+
+    for (auto const& [run, weight]: runs) {
+        share += weight * static_cast<double>(dispatches(run, chosen));
+    }
+
+    return share;
+}
+
+struct Choice {
+    Operations superinstruction;
+    // What dispatch_share() is down to with it and those before.
+    double share;
+};
+
+// Choose up to `count` superinstructions, one at a time, each the sequence
+// that removes the most dispatches given those chosen before it.
+std::vector<Choice> choose(Runs const& runs, std::size_t count)
+{
+    auto candidates = std::set<Operations>{};
+
+    for (auto const& [run, weight]: runs) {
+        for (auto i = std::size_t{0}; i < run.size(); ++i) {
+            for (auto length = std::size_t{2};
+                 length <= max_superinstruction_length and
+                 i + length <= run.size();
+                 ++length) {
+                if (may_fuse(run.data() + i, length)) {
+                    candidates.emplace(
+                        run.begin() + static_cast<std::ptrdiff_t>(i),
+                        run.begin() + static_cast<std::ptrdiff_t>(i + length));
+                }
+            }
+        }
+    }
+
+    auto choices = std::vector<Choice>{};
+    auto chosen = std::vector<Operations>{};
+    auto share = dispatch_share(runs, chosen);
+
+    while (choices.size() < count and not candidates.empty()) {
+        auto best = candidates.end();
+        auto best_share = share;
+
+        for (auto candidate = candidates.begin();
+             candidate != candidates.end();
+             ++candidate) {
+            chosen.push_back(*candidate);
+            auto const candidate_share = dispatch_share(runs, chosen);
+            chosen.pop_back();
+
+            if (candidate_share < best_share) {
+                best = candidate;
+                best_share = candidate_share;
+            }
+        }
+
+        if (best == candidates.end()) {
+            break;
+        }
+
+        chosen.push_back(*best);
+        choices.push_back({*best, best_share});
+        candidates.erase(best);
+        share = best_share;
+    }
+
+    return choices;
+}
+
+std::string mnemonics(Operations const& operations)
+{
+    auto text = std::string{};
+
+    for (auto const operation: operations) {
+        text += text.empty() ? "" : "+";
+        text += mnemonic(operation);
+    }
+
+    return text;
+}
+
+// Operations are named as their mnemonics are, in upper case.
+std::string enumerators(Operations const& operations)
+{
+    auto text = std::string{};
+
+    for (auto const operation: operations) {
+        text += text.empty() ? "Operation::" : ", Operation::";
+
+        for (auto const* c = mnemonic(operation); *c; ++c) {
+            text += static_cast<char>(std::toupper(*c));
+        }
+    }
+
+    return text;
+}
+
+void print_table(
+    Runs const& runs,
+    std::vector<Choice> const& choices,
+    std::size_t traces)
+{
+    std::printf(
+        "%-24s %s\n", "superinstruction", "dispatches per instruction");
+    std::printf(
+        "%-24s %.3f\n",
+        "-",
+        dispatch_share(runs, {}) / static_cast<double>(traces));
+
+    for (auto const& [superinstruction, share]: choices) {
+        std::printf(
+            "%-24s %.3f\n",
+            mnemonics(superinstruction).c_str(),
+            share / static_cast<double>(traces));
+    }
+}
+
+// Print the list that superinstructions.hpp includes.
+void print_list(std::vector<Choice> const& choices)
+{
+    std::printf("// Generated by mercury-ngrams.\n");
+
+    for (auto const& choice: choices) {
+        std::printf(
+            "sequence(%s),\n", enumerators(choice.superinstruction).c_str());
+    }
+}
+
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    auto generate = false;
+    auto count = std::size_t{16};
+    auto paths = std::vector<char const*>{};
+
+    for (auto i = 1; i < argc; ++i) {
+        auto const argument = std::string{argv[i]};
+
+        if (argument == "--generate") {
+            generate = true;
+        } else if (argument == "--count" and i + 1 < argc) {
+            count = std::stoul(argv[++i]);
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    if (paths.empty() or count == 0) {
+        std::cerr << "usage: mercury-ngrams [--count <superinstructions>] "
+                     "[--generate] <trace>...\n";
+        return 1;
+    }
+
+    auto runs = mercury::Runs{};
+
+    for (auto const* path: paths) {
+        auto in = std::ifstream{path, std::ios::binary};
+        if (not in) {
+            std::cerr << "Could not open " << path << ".\n";
+            return 1;
+        }
+
+        try {
+            mercury::add_trace(in, runs);
+        } catch (std::runtime_error const& error) {
+            std::cerr << path << ": " << error.what() << '\n';
+            return 1;
+        }
+    }
+
+    auto const choices = mercury::choose(runs, count);
+
+    if (choices.empty()) {
+        std::cerr << "Nothing in the traces is worth fusing.\n";
+        return 1;
+    }
+
+    if (generate) {
+        mercury::print_list(choices);
+    } else {
+        mercury::print_table(runs, choices, paths.size());
+    }
+}
@@ -0,0 +1,217 @@
+#include "perf_map.hpp"
+
+#include <ctime>
+#include <stdexcept>
+#include <string>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace mercury {
+
+#if defined(__linux__)
+
+namespace {
+
+// The jitdump format, as tools/perf/Documentation/jitdump-specification.txt
+// in the Linux sources describes it.
+namespace jitdump {
+
+constexpr auto magic = std::uint32_t{0x4A695444};
+constexpr auto version = std::uint32_t{1};
+// EM_X86_64, the only host the JIT compiles for.
+constexpr auto machine = std::uint32_t{62};
+constexpr auto code_load = std::uint32_t{0};
+
+struct Header {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t size;
+    std::uint32_t machine;
+    std::uint32_t padding;
+    std::uint32_t pid;
+    std::uint64_t timestamp;
+    std::uint64_t flags;
+};
+
+static_assert(sizeof(Header) == 40);
+
+// Followed by the name, null-terminated, and the code.
+struct CodeLoad {
+    std::uint32_t id;
+    std::uint32_t size;
+    std::uint64_t timestamp;
+    std::uint32_t pid;
+    std::uint32_t tid;
+    std::uint64_t address;
+    std::uint64_t code_address;
+    std::uint64_t code_size;
+    std::uint64_t index;
+};
+
+static_assert(sizeof(CodeLoad) == 56);
+
+}
+
+// What perf shows code as: the guest address range it was compiled from,
+// and the symbol that starts in, if any.
+std::string name_of(Register start, Register end, SymbolTable const& symbols)
+{
+    char range[32];
+    std::snprintf(range, sizeof(range), "[%08x, %08x)", start, end);
+
+    auto const symbol = symbols.describe(start);
+
+    return "guest " + (symbol ? *symbol + " " : std::string{}) + range;
+}
+
+// perf takes its timestamps from this clock with `-k mono`.
+std::uint64_t now()
+{
+    auto time = timespec{};
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return static_cast<std::uint64_t>(time.tv_sec) * 1'000'000'000u +
+           static_cast<std::uint64_t>(time.tv_nsec);
+}
+
+std::uint32_t thread_id()
+{
+    return static_cast<std::uint32_t>(syscall(SYS_gettid));
+}
+
+}
+
+PerfMap::PerfMap()
+{
+    auto const pid = static_cast<std::uint32_t>(getpid());
+    auto const map_path = "/tmp/perf-" + std::to_string(pid) + ".map";
+    auto const jitdump_path = "/tmp/jit-" + std::to_string(pid) + ".dump";
+
+    map = std::fopen(map_path.c_str(), "w");
+    if (not map) {
+        throw std::runtime_error("Could not create " + map_path + ".");
+    }
+
+    jitdump = ::open(
+        jitdump_path.c_str(), O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0644);
+    if (jitdump < 0) {
+        std::fclose(map);
+        throw std::runtime_error("Could not create " + jitdump_path + ".");
+    }
+
+    auto const page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    marker = mmap(
+        nullptr, page_size, PROT_READ | PROT_EXEC, MAP_PRIVATE, jitdump, 0);
+    if (marker == MAP_FAILED) {
+        marker = nullptr;
+    }
+
+    auto const header = jitdump::Header{
+        jitdump::magic,
+        jitdump::version,
+        sizeof(jitdump::Header),
+        jitdump::machine,
+        0,
+        pid,
+        now(),
+        0,
+    };
+
+    write_jitdump(&header, sizeof(header));
+}
+
+PerfMap::~PerfMap()
+{
+    if (marker) {
+        munmap(marker, static_cast<std::size_t>(sysconf(_SC_PAGESIZE)));
+    }
+
+    ::close(jitdump);
+    std::fclose(map);
+}
+
+void PerfMap::add(
+    void const* code,
+    std::size_t size,
+    Register start,
+    Register end,
+    SymbolTable const& symbols)
+{
+    auto const name = name_of(start, end, symbols);
+    auto const address =
+        std::uint64_t{reinterpret_cast<std::uintptr_t>(code)};
+
+    auto const lock = std::lock_guard{mutex};
+
+    std::fprintf(
+        map,
+        "%llx %zx %s\n",
+        static_cast<unsigned long long>(address),
+        size,
+        name.c_str());
+    std::fflush(map);
+
+    auto const record = jitdump::CodeLoad{
+        jitdump::code_load,
+        static_cast<std::uint32_t>(
+            sizeof(jitdump::CodeLoad) + name.size() + 1 + size),
+        now(),
+        static_cast<std::uint32_t>(getpid()),
+        thread_id(),
+        address,
+        address,
+        size,
+        loads++,
+    };
+
+    write_jitdump(&record, sizeof(record));
+    write_jitdump(name.c_str(), name.size() + 1);
+    write_jitdump(code, size);
+}
+
+void PerfMap::write_jitdump(void const* data, std::size_t size)
+{
+    auto const* bytes = static_cast<char const*>(data);
+
+    while (size != 0) {
+        auto const written = ::write(jitdump, bytes, size);
+
+        // Profiles are only ever missing a few symbols if this fails, which
+        // is not worth stopping the guest for.
+        if (written <= 0) {
+            return;
+        }
+
+        bytes += written;
+        size -= static_cast<std::size_t>(written);
+    }
+}
+
+#else
+
+PerfMap::PerfMap()
+{
+    throw std::runtime_error("perf maps need Linux.");
+}
+
+PerfMap::~PerfMap() = default;
+
+void PerfMap::add(
+    void const*,
+    std::size_t,
+    Register,
+    Register,
+    SymbolTable const&)
+{}
+
+void PerfMap::write_jitdump(void const*, std::size_t)
+{}
+
+#endif
+
+}
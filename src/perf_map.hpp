@@ -0,0 +1,66 @@
+#ifndef MERCURY_PERF_MAP_HPP
+#define MERCURY_PERF_MAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+#include "registers.hpp"
+#include "symbol_table.hpp"
+
+namespace mercury {
+
+// Linux perf finds out about code generated at run time through files named
+// after the process, which only exist there.
+#if defined(__linux__)
+constexpr auto perf_map_supported = true;
+#else
+constexpr auto perf_map_supported = false;
+#endif
+
+// Tells Linux perf which guest code the machine code compiled by the JIT
+// runs, so that `perf report` puts the samples taken in it under the guest
+// PCs and symbols it came from rather than under anonymous memory.
+//
+// Every compiled block gets a line in /tmp/perf-<pid>.map, which perf reads
+// on its own, and a code load record in /tmp/jit-<pid>.dump, a jitdump that
+// `perf inject --jit` turns into symbols and code for perf to annotate, from
+// a profile recorded with `perf record -k mono`. Only the jitdump keeps
+// blocks apart whose code ended up at the same address one after the other.
+class PerfMap {
+public:
+    // Throws std::runtime_error if the files cannot be created, or on hosts
+    // other than Linux.
+    PerfMap();
+    ~PerfMap();
+
+    PerfMap(PerfMap const&) = delete;
+    PerfMap& operator=(PerfMap const&) = delete;
+
+    // Describe `size` bytes of machine code at `code`, compiled from the
+    // guest instructions from `start` up to `end`, which are named after the
+    // symbol in `symbols` they start in, if any. Safe to call from any
+    // thread.
+    void add(
+        void const* code,
+        std::size_t size,
+        Register start,
+        Register end,
+        SymbolTable const& symbols);
+
+private:
+    void write_jitdump(void const* data, std::size_t size);
+
+    std::mutex mutex;
+    std::FILE* map{nullptr};
+    int jitdump{-1};
+    // perf only finds the jitdump through an executable mapping of it.
+    void* marker{nullptr};
+    std::uint64_t loads{0};
+};
+
+}
+
+#endif
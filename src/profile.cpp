@@ -0,0 +1,89 @@
+#include "profile.hpp"
+
+#include <algorithm>
+#include <ostream>
+#include <utility>
+
+#include "instruction_spec.hpp"
+
+namespace mercury {
+
+void Profile::reset(AddressRange range)
+{
+    operations = {};
+    code = range;
+    pcs.assign((range.end - range.begin) / 4, 0);
+    branches.clear();
+}
+
+void Profile::record(
+    Register pc,
+    DecodedInstruction instruction,
+    Register next_pc)
+{
+    ++operations[instruction.operation];
+
+    if (code.contains(pc)) {
+        ++pcs[(pc - code.begin) / 4];
+    }
+
+    auto const operation = instruction.operation;
+    if (operation == Operation::BEQ or operation == Operation::BNE) {
+        auto& counts = branches[pc];
+        ++(next_pc == pc + 4 ? counts.not_taken : counts.taken);
+    }
+}
+
+Profile::Counter Profile::executions(Operation operation) const
+{
+    return operations[operation];
+}
+
+void Profile::write_json(std::ostream& out) const
+{
+    auto separator = "";
+
+    out << "{\n  \"instructions\": {";
+
+    for (auto i = 0; i <= value_of(Operation::LAST); ++i) {
+        auto const operation = static_cast<Operation>(i);
+        if (operations[operation] != 0) {
+            out << separator << "\n    \"" << mnemonic(operation)
+                << "\": " << operations[operation];
+            separator = ",";
+        }
+    }
+
+    out << "\n  },\n  \"pcs\": [";
+
+    auto hot = std::vector<std::pair<Register, Counter>>{};
+    for (auto i = std::size_t{0}; i < pcs.size(); ++i) {
+        if (pcs[i] != 0) {
+            hot.emplace_back(code.begin + static_cast<Register>(4 * i), pcs[i]);
+        }
+    }
+    std::stable_sort(hot.begin(), hot.end(), [](auto const& a, auto const& b) {
+        return a.second > b.second;
+    });
+
+    separator = "";
+    for (auto const& [pc, count]: hot) {
+        out << separator << "\n    {\"pc\": " << pc << ", \"count\": " << count
+            << "}";
+        separator = ",";
+    }
+
+    out << "\n  ],\n  \"branches\": [";
+
+    separator = "";
+    for (auto const& [pc, counts]: branches) {
+        out << separator << "\n    {\"pc\": " << pc
+            << ", \"taken\": " << counts.taken
+            << ", \"not_taken\": " << counts.not_taken << "}";
+        separator = ",";
+    }
+
+    out << "\n  ]\n}\n";
+}
+
+}
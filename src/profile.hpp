@@ -0,0 +1,60 @@
+#ifndef MERCURY_PROFILE_HPP
+#define MERCURY_PROFILE_HPP
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <vector>
+
+#include "decoded_instruction.hpp"
+#include "enum_indexed_array.hpp"
+#include "memory.hpp"
+#include "registers.hpp"
+
+namespace mercury {
+
+// Profiling is chosen at build time, with the MERCURY_PROFILE CMake option,
+// so that it costs nothing when it is off.
+#if defined(MERCURY_PROFILE)
+constexpr auto profiling = true;
+#else
+constexpr auto profiling = false;
+#endif
+
+struct BranchCounts {
+    std::uint64_t taken{0};
+    std::uint64_t not_taken{0};
+};
+
+// What a CPU executed since its program was started: how often each
+// instruction and each PC ran, and which way each conditional branch went.
+// It stays empty unless profiling is on.
+class Profile {
+public:
+    using Counter = std::uint64_t;
+
+    // Clear everything, and track PCs within `code`.
+    void reset(AddressRange code);
+
+    // Count the instruction at `pc`, which was followed by `next_pc`.
+    void record(
+        Register pc,
+        DecodedInstruction instruction,
+        Register next_pc);
+
+    Counter executions(Operation operation) const;
+
+    // Write the counts as a JSON object, with PCs from hottest to coldest.
+    void write_json(std::ostream& out) const;
+
+private:
+    EnumIndexedArray<Operation, Counter, Operation::LAST> operations;
+
+    AddressRange code{0, 0};
+    std::vector<Counter> pcs;
+    std::map<Register, BranchCounts> branches;
+};
+
+}
+
+#endif
@@ -0,0 +1 @@
+#include "program.hpp"
@@ -0,0 +1,18 @@
+#ifndef MERCURY_PROGRAM_HPP
+#define MERCURY_PROGRAM_HPP
+
+#include "memory.hpp"
+
+namespace mercury {
+
+// Where a program that has been put in guest memory starts, where its code
+// lives, and where what was loaded ends, which is where its heap can start.
+struct Program {
+    Address entry;
+    AddressRange code;
+    Address data_end;
+};
+
+}
+
+#endif
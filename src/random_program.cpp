@@ -0,0 +1,167 @@
+#include "random_program.hpp"
+
+#include <random>
+#include <variant>
+
+#include "decoder.hpp"
+#include "encoder.hpp"
+#include "enum_tools.hpp"
+#include "instruction_spec.hpp"
+
+namespace mercury {
+
+namespace {
+
+constexpr auto ra = std::uint8_t{31};
+
+class Generator {
+public:
+    Generator(std::uint32_t seed, std::size_t size): random{seed}, size_{size}
+    {
+        for (auto const& spec: instruction_specs) {
+            if (spec.format != Format::Special) {
+                encodable.push_back(&spec);
+            }
+        }
+    }
+
+    RandomProgram generate()
+    {
+        auto program = RandomProgram{};
+        auto& code = program.code;
+
+        while (code.size() < size_) {
+            // The usual way of loading 32-bit constants, which gets fused.
+            if (below(16) == 0 and code.size() + 1 < size_) {
+                auto const destination = reg();
+                auto const second = below(2) == 0 ? Opcode::ORI : Opcode::ADDIU;
+
+                code.push_back(
+                    i_type(Opcode::LUI, destination, 0, immediate()));
+                code.push_back(
+                    i_type(second, destination, destination, immediate()));
+                continue;
+            }
+
+            code.push_back(instruction(code.size()));
+        }
+
+        code.push_back(j_type(Opcode::J, 0));
+
+        for (auto i = std::uint8_t{1}; i < 16; ++i) {
+            program.registers[i] = word();
+        }
+
+        return program;
+    }
+
+private:
+    RawInstruction instruction(std::size_t index)
+    {
+        if (below(32) == 0) {
+            return word();
+        }
+
+        auto const& spec = *encodable[below(encodable.size())];
+        auto raw = (word() & ~mask::opcode) |
+                   set_field(value_of(spec.opcode), info::opcode);
+
+        if (spec.format == Format::R) {
+            raw = (raw & ~mask::funct) |
+                  set_field(value_of(spec.funct), info::funct);
+        }
+
+        auto decoded = *decode(raw);
+        std::visit([&](auto& operands) { tame(operands, index); }, decoded);
+
+        return encode(decoded);
+    }
+
+    void tame(RInstruction& instruction, std::size_t)
+    {
+        instruction.rs = reg();
+        instruction.rt = reg();
+        instruction.rd = reg();
+
+        if (instruction.funct == Funct::JR and below(4) != 0) {
+            instruction.rs = ra;
+        }
+    }
+
+    void tame(IInstruction& instruction, std::size_t index)
+    {
+        instruction.rs = reg();
+        instruction.rt = reg();
+
+        switch (instruction.opcode) {
+            case Opcode::BEQ:
+            case Opcode::BNE: {
+                // Relative to the instruction after the next one.
+                auto const offset = static_cast<std::int64_t>(target()) -
+                                    static_cast<std::int64_t>(index) - 2;
+                instruction.immediate = static_cast<std::uint16_t>(offset);
+                break;
+            }
+            case Opcode::LBU:
+            case Opcode::LHU:
+            case Opcode::LW:
+            case Opcode::LL:
+            case Opcode::SB:
+            case Opcode::SH:
+            case Opcode::SW:
+            case Opcode::SC:
+                if (below(2) == 0) {
+                    instruction.rs = random_program_base;
+                    instruction.immediate =
+                        static_cast<std::uint16_t>(4 * target() + below(4));
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    void tame(JInstruction& instruction, std::size_t)
+    {
+        instruction.address = target();
+    }
+
+    // Word addresses in the program, including the jump at its end.
+    std::uint32_t target()
+    {
+        return below(size_ + 1);
+    }
+
+    std::uint8_t reg()
+    {
+        return static_cast<std::uint8_t>(below(16));
+    }
+
+    std::int32_t immediate()
+    {
+        return static_cast<std::int32_t>(below(0x10000));
+    }
+
+    std::uint32_t below(std::size_t bound)
+    {
+        return static_cast<std::uint32_t>(word() % bound);
+    }
+
+    std::uint32_t word()
+    {
+        return static_cast<std::uint32_t>(random());
+    }
+
+    std::mt19937 random;
+    std::size_t size_;
+    std::vector<InstructionSpec const*> encodable;
+};
+
+}
+
+RandomProgram random_program(std::uint32_t seed, std::size_t size)
+{
+    return Generator{seed, size}.generate();
+}
+
+}
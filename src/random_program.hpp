@@ -0,0 +1,36 @@
+#ifndef MERCURY_RANDOM_PROGRAM_HPP
+#define MERCURY_RANDOM_PROGRAM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "instruction_formats.hpp"
+#include "registers.hpp"
+
+namespace mercury {
+
+// A program to be loaded at address 0, and the registers to start it with.
+struct RandomProgram {
+    std::vector<RawInstruction> code;
+    Registers registers;
+};
+
+// The register that random programs keep at zero, as a base for loads and
+// stores that may hit their own code.
+constexpr auto random_program_base = std::uint8_t{28};
+
+// Generate `size` random instructions, followed by a jump back to the start,
+// the same for the same `seed`.
+//
+// Each instruction is drawn from every encoding decode() knows, with random
+// fields, then has its operands tamed so that the program runs for a while:
+// registers come from the first 16, branches and jumps stay in the program,
+// and `jr` mostly returns through $ra. A few words are left entirely random,
+// which mostly makes unknown instructions. Nothing else is ruled out, so
+// programs trap, overwrite their own code and jump to misaligned addresses.
+RandomProgram random_program(std::uint32_t seed, std::size_t size);
+
+}
+
+#endif
@@ -0,0 +1 @@
+#include "registers.hpp"
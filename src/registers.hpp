@@ -0,0 +1,14 @@
+#ifndef MERCURY_REGISTERS_HPP
+#define MERCURY_REGISTERS_HPP
+
+#include <array>
+#include <cstdint>
+
+namespace mercury {
+
+using Register = std::uint32_t;
+using Registers = std::array<Register, 32>;
+
+}
+
+#endif
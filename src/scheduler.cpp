@@ -0,0 +1,204 @@
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace mercury {
+
+namespace {
+
+// Big enough for the cache lines of the hosts we run on.
+constexpr auto cache_line_size = std::size_t{64};
+
+// Each worker's state sits on its own cache lines, so that workers updating
+// their own queues do not slow each other down.
+struct alignas(cache_line_size) Worker {
+    std::mutex lock;
+    std::deque<std::size_t> queue;
+
+    void push(std::size_t guest)
+    {
+        auto guard = std::lock_guard{lock};
+        queue.push_back(guest);
+    }
+
+    std::optional<std::size_t> pop()
+    {
+        auto guard = std::lock_guard{lock};
+        if (queue.empty()) {
+            return std::nullopt;
+        }
+
+        auto const guest = queue.front();
+        queue.pop_front();
+        return guest;
+    }
+
+    std::optional<std::size_t> steal()
+    {
+        auto guard = std::lock_guard{lock};
+        if (queue.empty()) {
+            return std::nullopt;
+        }
+
+        auto const guest = queue.back();
+        queue.pop_back();
+        return guest;
+    }
+};
+
+struct alignas(cache_line_size) Guest {
+    CPU* cpu;
+    GuestResult result;
+};
+
+}
+
+Scheduler::Scheduler(std::size_t workers, std::size_t time_slice):
+    workers_{workers != 0 ? workers
+                          : std::max(std::thread::hardware_concurrency(), 1u)},
+    time_slice_{std::max(time_slice, std::size_t{1})}
+{}
+
+std::vector<GuestResult> Scheduler::run(
+    std::vector<CPU*> const& cpus,
+    std::uint64_t max_steps,
+    TrapHandler const& on_trap)
+{
+    auto guests = std::vector<Guest>{};
+    for (auto* cpu: cpus) {
+        guests.push_back({cpu, {StopReason::StepLimit, 0}});
+    }
+
+    auto const worker_count =
+        std::min(workers_, std::max(cpus.size(), std::size_t{1}));
+    auto workers = std::vector<Worker>(worker_count);
+
+    for (auto i = std::size_t{0}; i < guests.size(); ++i) {
+        workers[i % worker_count].queue.push_back(i);
+    }
+
+    alignas(cache_line_size) auto remaining =
+        std::atomic<std::size_t>{guests.size()};
+    // Set by TrapAction::StopAll.
+    alignas(cache_line_size) auto stopping = std::atomic<bool>{false};
+
+    // How many guests wait in the queues, and how many workers sleep until
+    // that is no longer 0, every guest is done or they are all stopping.
+    // These are sequentially consistent, so that a worker going to sleep
+    // either sees a guest that was just queued or is seen by the worker
+    // that queued it.
+    alignas(cache_line_size) auto queued =
+        std::atomic<std::size_t>{guests.size()};
+    alignas(cache_line_size) auto sleeping = std::atomic<std::size_t>{0};
+    auto idle_lock = std::mutex{};
+    auto wake = std::condition_variable{};
+
+    auto const wake_workers = [&](bool all) {
+        if (sleeping.load() != 0) {
+            auto const guard = std::lock_guard{idle_lock};
+            if (all) {
+                wake.notify_all();
+            } else {
+                wake.notify_one();
+            }
+        }
+    };
+
+    auto const sleep = [&] {
+        auto guard = std::unique_lock{idle_lock};
+        sleeping.fetch_add(1);
+        wake.wait(guard, [&] {
+            return queued.load() != 0 or remaining.load() == 0 or
+                   stopping.load();
+        });
+        sleeping.fetch_sub(1);
+    };
+
+    using GuestIndex = std::optional<std::size_t>;
+
+    auto const next_guest = [&](std::size_t self) -> GuestIndex {
+        auto guest = workers[self].pop();
+
+        for (auto i = std::size_t{1}; i < worker_count and not guest; ++i) {
+            guest = workers[(self + i) % worker_count].steal();
+        }
+
+        if (guest) {
+            queued.fetch_sub(1);
+        }
+
+        return guest;
+    };
+
+    auto const work = [&](std::size_t self) {
+        while (remaining.load(std::memory_order_acquire) != 0 and
+               not stopping.load()) {
+            auto const index = next_guest(self);
+            if (not index) {
+                sleep();
+                continue;
+            }
+
+            auto& guest = guests[*index];
+            auto const budget = std::min<std::uint64_t>(
+                time_slice_, max_steps - guest.result.steps);
+            auto const result =
+                guest.cpu->run(static_cast<std::size_t>(budget));
+
+            auto const action = result.reason == StopReason::Trap and on_trap
+                                    ? on_trap(*index, *guest.cpu)
+                                    : TrapAction::Stop;
+
+            if (action == TrapAction::StopAll) {
+                stopping.store(true);
+                wake_workers(true);
+            }
+
+            guest.result.reason = action == TrapAction::Resume
+                                      ? StopReason::StepLimit
+                                      : result.reason;
+            guest.result.steps += result.steps;
+
+            auto const finished =
+                guest.result.reason != StopReason::StepLimit or
+                guest.result.steps == max_steps;
+
+            if (finished) {
+                if (remaining.fetch_sub(1) == 1) {
+                    wake_workers(true);
+                }
+            } else {
+                queued.fetch_add(1);
+                workers[self].push(*index);
+                wake_workers(false);
+            }
+        }
+    };
+
+    auto threads = std::vector<std::thread>{};
+    for (auto i = std::size_t{1}; i < worker_count; ++i) {
+        threads.emplace_back(work, i);
+    }
+
+    // The calling thread is worker 0.
+    work(0);
+
+    for (auto& thread: threads) {
+        thread.join();
+    }
+
+    auto results = std::vector<GuestResult>{};
+    for (auto const& guest: guests) {
+        results.push_back(guest.result);
+    }
+
+    return results;
+}
+
+}
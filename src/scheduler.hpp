@@ -0,0 +1,64 @@
+#ifndef MERCURY_SCHEDULER_HPP
+#define MERCURY_SCHEDULER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "cpu.hpp"
+
+namespace mercury {
+
+struct GuestResult {
+    StopReason reason;
+    std::uint64_t steps;
+};
+
+// What the scheduler does with a guest once its trap has been handled.
+enum class TrapAction: std::uint8_t {
+    // Leave it stopped on the trap.
+    Stop,
+    // Run it for the rest of its steps.
+    Resume,
+    // Leave it stopped, and stop every other guest at the end of its time
+    // slice, as a process exiting stops all of its threads.
+    StopAll,
+};
+
+// Runs many independent CPUs across host threads.
+//
+// Guests are run a time slice at a time. Each worker thread keeps its own
+// queue of guests, running them in turn from the front of it and putting
+// guests that used their whole slice at the back, so a guest tends to stay
+// on the same core. Idle workers steal from the back of other workers'
+// queues, and sleep while there is nothing to steal.
+class Scheduler {
+public:
+    // Called on a worker thread when the guest at `index` stops on a trap.
+    // Guests are never handled by two threads at once.
+    using TrapHandler =
+        std::function<TrapAction(std::size_t index, CPU& cpu)>;
+
+    // A `workers` of 0 uses one worker per host thread.
+    explicit Scheduler(
+        std::size_t workers = 0,
+        std::size_t time_slice = std::size_t{1} << 16);
+
+    // Run every CPU until it stops for a reason other than its time slice
+    // running out, and that `on_trap` does not handle, or until it has
+    // executed `max_steps` instructions. Blocks until all of them are done.
+    // Guests cut short by TrapAction::StopAll end with StopReason::StepLimit.
+    std::vector<GuestResult> run(
+        std::vector<CPU*> const& cpus,
+        std::uint64_t max_steps = unlimited_steps,
+        TrapHandler const& on_trap = {});
+
+private:
+    std::size_t workers_;
+    std::size_t time_slice_;
+};
+
+}
+
+#endif
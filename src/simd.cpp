@@ -0,0 +1,44 @@
+#include "simd.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MERCURY_X86_SIMD
+#endif
+
+namespace mercury {
+
+SimdLevel best_simd_level()
+{
+#ifdef MERCURY_X86_SIMD
+    if (__builtin_cpu_supports("avx512f")) {
+        return SimdLevel::AVX512;
+    }
+
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SimdLevel::SSE4;
+    }
+#endif
+
+    return SimdLevel::None;
+}
+
+char const* name_of(SimdLevel level)
+{
+    switch (level) {
+        case SimdLevel::None:
+            return "scalar";
+        case SimdLevel::SSE4:
+            return "sse4";
+        case SimdLevel::AVX2:
+            return "avx2";
+        case SimdLevel::AVX512:
+            return "avx512";
+    }
+
+    return "?";
+}
+
+}
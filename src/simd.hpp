@@ -0,0 +1,27 @@
+#ifndef MERCURY_SIMD_HPP
+#define MERCURY_SIMD_HPP
+
+#include <cstdint>
+
+namespace mercury {
+
+// The vector instructions bulk decoding and batches may use, from narrowest
+// to widest.
+enum class SimdLevel: std::uint8_t {
+    None,
+    // 128-bit vectors, with SSE4.1.
+    SSE4,
+    // 256-bit vectors.
+    AVX2,
+    // 512-bit vectors, with AVX-512 Foundation.
+    AVX512,
+};
+
+// The widest level this machine supports.
+SimdLevel best_simd_level();
+
+char const* name_of(SimdLevel level);
+
+}
+
+#endif
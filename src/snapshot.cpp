@@ -0,0 +1,175 @@
+#include "snapshot.hpp"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "file_image.hpp"
+
+namespace mercury {
+
+namespace {
+
+constexpr auto magic =
+    std::array<char, 8>{'M', 'E', 'R', 'C', 'S', 'N', 'A', 'P'};
+constexpr auto format_version = std::uint32_t{2};
+
+// Written in host order, which pages are in as well.
+constexpr auto byte_order_mark = std::uint32_t{0x01020304};
+
+// The file starts with a header, followed by a FilePage for each page. The
+// contents of the pages come next, in the same order, from the first page
+// boundary on.
+struct FileHeader {
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t byte_order_mark;
+    std::uint32_t big_endian;
+    std::uint32_t page_count;
+    Registers registers;
+    Register hi;
+    Register lo;
+    Register pc;
+    Register epc;
+    Register cause;
+    std::uint32_t trap_pending;
+    Address code_begin;
+    Address code_end;
+};
+
+struct FilePage {
+    Address address;
+    std::uint32_t code;
+};
+
+std::size_t pages_offset(std::size_t page_count)
+{
+    auto const size = sizeof(FileHeader) + page_count * sizeof(FilePage);
+    auto const page_size = std::size_t{Memory::page_size};
+
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+}
+
+void save_snapshot(Snapshot const& snapshot, std::string const& path)
+{
+    auto const& pages = *snapshot.memory.pages;
+
+    auto header = FileHeader{};
+    header.magic = magic;
+    header.version = format_version;
+    header.byte_order_mark = byte_order_mark;
+    header.big_endian = snapshot.memory.endianness == Endianness::Big;
+    header.page_count = static_cast<std::uint32_t>(pages.size());
+    header.registers = snapshot.registers;
+    header.hi = snapshot.hi;
+    header.lo = snapshot.lo;
+    header.pc = snapshot.pc;
+    header.epc = snapshot.epc;
+    header.cause = snapshot.cause;
+    header.trap_pending = snapshot.trap_pending;
+    header.code_begin = snapshot.code.begin;
+    header.code_end = snapshot.code.end;
+
+    auto entries = std::vector<FilePage>{};
+    for (auto const& page: pages) {
+        entries.push_back({page.address, page.code});
+    }
+
+    auto file = std::ofstream{path, std::ios::binary | std::ios::trunc};
+
+    auto const write = [&](void const* data, std::size_t size) {
+        file.write(
+            static_cast<char const*>(data),
+            static_cast<std::streamsize>(size));
+    };
+
+    write(&header, sizeof(header));
+    write(entries.data(), entries.size() * sizeof(FilePage));
+
+    auto const padding = std::vector<char>(
+        pages_offset(pages.size()) - sizeof(header) -
+        entries.size() * sizeof(FilePage));
+    write(padding.data(), padding.size());
+
+    for (auto const& page: pages) {
+        write(page.bytes, Memory::page_size);
+    }
+
+    if (not file.flush()) {
+        throw std::runtime_error("Could not write " + path + ".");
+    }
+}
+
+Snapshot load_snapshot(std::string const& path)
+{
+    auto const image = open_image(path);
+    auto header = FileHeader{};
+
+    if (image.size < sizeof(header)) {
+        throw std::runtime_error(path + " is not a snapshot.");
+    }
+
+    std::memcpy(&header, image.data.get(), sizeof(header));
+
+    if (header.magic != magic or header.version != format_version) {
+        throw std::runtime_error(path + " is not a snapshot.");
+    }
+
+    if (header.byte_order_mark != byte_order_mark) {
+        throw std::runtime_error(
+            path + " was saved on a host with another byte order.");
+    }
+
+    auto const count = std::size_t{header.page_count};
+    auto const offset = pages_offset(count);
+
+    if (image.size < offset or
+        (image.size - offset) / Memory::page_size < count) {
+        throw std::runtime_error(path + " is truncated.");
+    }
+
+    auto const* entries = image.data.get() + sizeof(header);
+    auto pages = std::make_shared<std::vector<Memory::ImagePage>>();
+
+    for (auto i = std::size_t{0}; i < count; ++i) {
+        auto entry = FilePage{};
+        std::memcpy(&entry, entries + i * sizeof(entry), sizeof(entry));
+
+        auto const sorted = pages->empty() or
+                            pages->back().address < entry.address;
+
+        if (entry.address % Memory::page_size != 0 or not sorted) {
+            throw std::runtime_error(path + " has a corrupt page table.");
+        }
+
+        pages->push_back({
+            entry.address,
+            image.data.get() + offset + i * Memory::page_size,
+            image.data,
+            entry.code != 0,
+        });
+    }
+
+    auto const endianness =
+        header.big_endian ? Endianness::Big : Endianness::Little;
+
+    return {
+        header.registers,
+        header.hi,
+        header.lo,
+        header.pc,
+        header.epc,
+        header.cause,
+        header.trap_pending != 0,
+        {header.code_begin, header.code_end},
+        {endianness, std::move(pages)},
+    };
+}
+
+}
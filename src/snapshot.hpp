@@ -0,0 +1,38 @@
+#ifndef MERCURY_SNAPSHOT_HPP
+#define MERCURY_SNAPSHOT_HPP
+
+#include <string>
+
+#include "memory.hpp"
+#include "registers.hpp"
+
+namespace mercury {
+
+// Everything needed to carry on running a CPU from where it was. Copying a
+// snapshot shares its memory pages.
+struct Snapshot {
+    Registers registers;
+    Register hi;
+    Register lo;
+    Register pc;
+    Register epc;
+    Register cause;
+    bool trap_pending;
+    AddressRange code;
+    Memory::Image memory;
+};
+
+// Write `snapshot` to `path`, with every page aligned in the file so that
+// load_snapshot() can map them instead of reading them. The file is only
+// meant for hosts with the same byte order. Throws std::runtime_error on
+// failure.
+void save_snapshot(Snapshot const& snapshot, std::string const& path);
+
+// Map a snapshot written by save_snapshot(). Its pages are only copied when
+// a CPU restored from it writes to them. Throws std::runtime_error if the
+// file cannot be read or is not a snapshot.
+Snapshot load_snapshot(std::string const& path);
+
+}
+
+#endif
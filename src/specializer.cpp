@@ -0,0 +1,88 @@
+#include "specializer.hpp"
+
+#include "decoder.hpp"
+
+namespace mercury {
+
+namespace {
+
+constexpr DecodedInstruction specialized(RawInstruction raw)
+{
+    return specialize(decode_instruction(raw));
+}
+
+// clang-format off
+static_assert(
+    specialized(0) == DecodedInstruction{Operation::NOP, 0, 0, 0, 0}
+);
+static_assert(
+    specialized(0b000000'00001'00010'00000'00000'100001) ==
+    DecodedInstruction{Operation::NOP, 0, 0, 0, 0}
+);
+static_assert(
+    specialized(0b001111'00000'00000'0000000000000001) ==
+    DecodedInstruction{Operation::NOP, 0, 0, 0, 0}
+);
+static_assert(
+    specialized(0b000000'00001'00010'00000'00000'100000).operation ==
+    Operation::ADD
+);
+static_assert(
+    specialized(0b100100'00001'00000'0000000000000100) ==
+    DecodedInstruction{Operation::NOP, 0, 0, 0, 0}
+);
+static_assert(
+    specialized(0b100011'00001'00000'0000000000000001).operation ==
+    Operation::LW
+);
+static_assert(
+    specialized(0b110000'00001'00000'0000000000000100).operation ==
+    Operation::LL
+);
+static_assert(
+    specialized(0b000000'00001'00000'00011'00000'100001) ==
+    DecodedInstruction{Operation::MOVE, 1, 0, 3, 0}
+);
+static_assert(
+    specialized(0b000000'00000'00010'00011'00000'100101) ==
+    DecodedInstruction{Operation::MOVE, 2, 0, 3, 0}
+);
+static_assert(
+    specialized(0b000000'00000'00010'00011'00000'000000) ==
+    DecodedInstruction{Operation::MOVE, 2, 0, 3, 0}
+);
+static_assert(
+    specialized(0b000000'00001'00010'00011'00000'100001).operation ==
+    Operation::ADDU
+);
+static_assert(
+    specialized(0b001101'00000'00010'1111111111111110) ==
+    DecodedInstruction{Operation::LI, 0, 2, 0, 0xFFFE}
+);
+static_assert(
+    specialized(0b001001'00000'00010'1111111111111110) ==
+    DecodedInstruction{Operation::LI, 0, 2, 0, 0xFFFFFFFE}
+);
+static_assert(
+    fuse(
+        specialized(0b001111'00000'00010'0001001000110100),
+        specialized(0b001101'00010'00010'0101011001111000)
+    ) == DecodedInstruction{Operation::LI32, 0, 2, 0, 0x12345678}
+);
+static_assert(
+    fuse(
+        specialized(0b001111'00000'00010'0001001000110100),
+        specialized(0b001001'00010'00010'1111111111111111)
+    ) == DecodedInstruction{Operation::LI32, 0, 2, 0, 0x1233FFFF}
+);
+static_assert(
+    not fuse(
+        specialized(0b001111'00000'00010'0001001000110100),
+        specialized(0b001101'00010'00011'0101011001111000)
+    )
+);
+// clang-format on
+
+}
+
+}
@@ -0,0 +1,123 @@
+#ifndef MERCURY_SPECIALIZER_HPP
+#define MERCURY_SPECIALIZER_HPP
+
+#include <optional>
+
+#include "decoded_instruction.hpp"
+#include "instruction_spec.hpp"
+
+namespace mercury {
+
+// Guest instructions never change $zero, so it always reads as zero, and
+// a few common idioms need less work than their instructions in general.
+// Executing a decoded instruction goes through specialize() first.
+
+constexpr DecodedInstruction move_instruction(
+    std::uint8_t destination,
+    std::uint8_t source)
+{
+    return {Operation::MOVE, source, 0, destination, 0};
+}
+
+constexpr DecodedInstruction load_instruction(
+    Operation operation,
+    std::uint8_t destination,
+    std::uint32_t value)
+{
+    return {operation, 0, destination, 0, value};
+}
+
+// Bind `instruction` to the special case it is, if any:
+//
+// - Anything that only writes $zero is a NOP, like the canonical
+//   `sll $0, $0, 0`, and so are loads into it that cannot trap. Loads that
+//   need alignment still run, since a misaligned address traps, and so do
+//   LL and SC, which also do more than write a register.
+// - ADDU, SUBU and OR with $zero, and shifts by 0, are a MOVE from rs to
+//   rd.
+// - ORI and ADDIU from $zero are an LI of their immediate into rt.
+constexpr DecodedInstruction specialize(DecodedInstruction instruction)
+{
+    auto const operation = instruction.operation;
+
+    if (operation == Operation::UNKNOWN) {
+        return instruction;
+    }
+
+    auto const& spec = spec_for(operation);
+    auto const writes_zero =
+        (spec.destination == Destination::Rd and instruction.rd == 0) or
+        (spec.destination == Destination::Rt and instruction.rt == 0);
+
+    if (writes_zero and spec.flow == Flow::Next and
+        not needs_alignment(operation)) {
+        return {Operation::NOP, 0, 0, 0, 0};
+    }
+
+    switch (operation) {
+        case Operation::ADDU:
+        case Operation::OR:
+            if (instruction.rt == 0) {
+                return move_instruction(instruction.rd, instruction.rs);
+            }
+            if (instruction.rs == 0) {
+                return move_instruction(instruction.rd, instruction.rt);
+            }
+            break;
+        case Operation::SUBU:
+            if (instruction.rt == 0) {
+                return move_instruction(instruction.rd, instruction.rs);
+            }
+            break;
+        case Operation::SLL:
+        case Operation::SRL:
+            if (instruction.immediate == 0) {
+                return move_instruction(instruction.rd, instruction.rt);
+            }
+            break;
+        case Operation::ADDIU:
+        case Operation::ORI:
+            if (instruction.rs == 0) {
+                return load_instruction(
+                    Operation::LI, instruction.rt, instruction.immediate);
+            }
+            break;
+        default:
+            break;
+    }
+
+    return instruction;
+}
+
+// The single operation that does what `first` and then `second`, both
+// specialized already, do, if there is one. That is only an LI32 for a LUI
+// followed by an ORI or ADDIU of the same register, which is how 32-bit
+// constants and addresses get loaded.
+constexpr std::optional<DecodedInstruction> fuse(
+    DecodedInstruction first,
+    DecodedInstruction second)
+{
+    if (first.operation != Operation::LUI or second.rs != first.rt or
+        second.rt != first.rt) {
+        return std::nullopt;
+    }
+
+    switch (second.operation) {
+        case Operation::ORI:
+            return load_instruction(
+                Operation::LI32,
+                first.rt,
+                first.immediate | second.immediate);
+        case Operation::ADDIU:
+            return load_instruction(
+                Operation::LI32,
+                first.rt,
+                first.immediate + second.immediate);
+        default:
+            return std::nullopt;
+    }
+}
+
+}
+
+#endif
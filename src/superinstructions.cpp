@@ -0,0 +1,35 @@
+#include "superinstructions.hpp"
+
+namespace mercury {
+
+std::optional<std::size_t> find_superinstruction(
+    DecodedInstruction const* instructions,
+    std::size_t count)
+{
+    auto found = std::optional<std::size_t>{};
+
+    for (auto i = std::size_t{0}; i < superinstructions.size(); ++i) {
+        auto const& superinstruction = superinstructions[i];
+        auto const length = superinstruction.length;
+
+        if (length > count or
+            (found and length <= superinstructions[*found].length)) {
+            continue;
+        }
+
+        auto matches = true;
+
+        for (auto j = std::size_t{0}; j < length and matches; ++j) {
+            matches = instructions[j].operation ==
+                      superinstruction.operations[j];
+        }
+
+        if (matches) {
+            found = i;
+        }
+    }
+
+    return found;
+}
+
+}
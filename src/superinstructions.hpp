@@ -0,0 +1,92 @@
+#ifndef MERCURY_SUPERINSTRUCTIONS_HPP
+#define MERCURY_SUPERINSTRUCTIONS_HPP
+
+#include <array>
+#include <cstddef>
+#include <optional>
+
+#include "decoded_instruction.hpp"
+#include "instruction_spec.hpp"
+
+namespace mercury {
+
+constexpr auto max_superinstruction_length = std::size_t{3};
+
+// A sequence of operations that blocks run with a single dispatch, through a
+// handler that executes each of them in turn.
+struct Superinstruction {
+    std::array<Operation, max_superinstruction_length> operations;
+    std::size_t length;
+};
+
+template <typename... Operations>
+constexpr Superinstruction sequence(Operations... operations)
+{
+    static_assert(sizeof...(operations) <= max_superinstruction_length);
+
+    return {{operations...}, sizeof...(operations)};
+}
+
+// Only the last operation of a superinstruction may leave its block, by
+// jumping or trapping, or invalidate it, by storing. Loads may trap earlier
+// on, which their handlers check for. Operations are specialized, and fused
+// as blocks fuse them.
+constexpr bool may_fuse(Operation const* operations, std::size_t length)
+{
+    if (length < 2 or length > max_superinstruction_length) {
+        return false;
+    }
+
+    for (auto i = std::size_t{0}; i < length; ++i) {
+        auto const operation = operations[i];
+
+        if (operation == Operation::UNKNOWN) {
+            return false;
+        }
+
+        auto const last = i + 1 == length;
+        auto const stores =
+            operation == Operation::SB or operation == Operation::SH or
+            operation == Operation::SW or operation == Operation::SC;
+
+        if (not last and (spec_for(operation).flow != Flow::Next or stores)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// The sequences that got the most dispatches out of the way in traces of the
+// benchmark kernels and test programs, as `mercury-ngrams --generate` listed
+// them. Handlers for each are instantiated from this list at build time.
+inline constexpr auto superinstructions = std::array{
+#include "superinstructions.inc"
+};
+
+constexpr bool superinstructions_may_fuse()
+{
+    for (auto const& superinstruction: superinstructions) {
+        if (not may_fuse(
+                superinstruction.operations.data(),
+                superinstruction.length)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static_assert(
+    superinstructions_may_fuse(),
+    "Superinstructions may only leave their block on their last operation.");
+
+// The index in `superinstructions` of the longest one that `instructions`
+// start with, if any. Of equally long ones, the first listed wins.
+std::optional<std::size_t> find_superinstruction(
+    DecodedInstruction const* instructions,
+    std::size_t count);
+
+}
+
+#endif
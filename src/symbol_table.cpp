@@ -0,0 +1,49 @@
+#include "symbol_table.hpp"
+
+#include <cstdio>
+#include <iterator>
+#include <utility>
+
+namespace mercury {
+
+void SymbolTable::add(std::string name, Address address, std::uint32_t size)
+{
+    auto& symbol = symbols[address];
+
+    // Of several symbols at one address, keep the one that says how big it
+    // is, since labels often share their address with a function.
+    if (symbol.name.empty() or (symbol.size == 0 and size != 0)) {
+        symbol = {std::move(name), size};
+    }
+}
+
+bool SymbolTable::empty() const
+{
+    return symbols.empty();
+}
+
+std::optional<std::string> SymbolTable::describe(Address address) const
+{
+    auto after = symbols.upper_bound(address);
+    if (after == symbols.begin()) {
+        return std::nullopt;
+    }
+
+    auto const& [start, symbol] = *std::prev(after);
+    auto const offset = address - start;
+
+    if (symbol.size != 0 and offset >= symbol.size) {
+        return std::nullopt;
+    }
+
+    if (offset == 0) {
+        return symbol.name;
+    }
+
+    char suffix[16];
+    std::snprintf(suffix, sizeof(suffix), "+0x%x", offset);
+
+    return symbol.name + suffix;
+}
+
+}
@@ -0,0 +1,37 @@
+#ifndef MERCURY_SYMBOL_TABLE_HPP
+#define MERCURY_SYMBOL_TABLE_HPP
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+
+#include "memory.hpp"
+
+namespace mercury {
+
+// The functions and labels of a guest program, by address.
+class SymbolTable {
+public:
+    // A `size` of 0 means the symbol's size is unknown, and it covers
+    // everything up to the next one.
+    void add(std::string name, Address address, std::uint32_t size);
+
+    bool empty() const;
+
+    // The symbol `address` is in, with the offset into it unless that is 0,
+    // like "main+0x1c".
+    std::optional<std::string> describe(Address address) const;
+
+private:
+    struct Symbol {
+        std::string name;
+        std::uint32_t size;
+    };
+
+    std::map<Address, Symbol> symbols;
+};
+
+}
+
+#endif
@@ -0,0 +1,656 @@
+#include "syscalls.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace mercury {
+
+namespace {
+
+namespace spim {
+
+constexpr auto print_int = Register{1};
+constexpr auto print_string = Register{4};
+constexpr auto sbrk = Register{9};
+constexpr auto exit = Register{10};
+constexpr auto print_char = Register{11};
+constexpr auto exit2 = Register{17};
+
+}
+
+namespace linux_o32 {
+
+constexpr auto first = Register{4000};
+constexpr auto exit = Register{4001};
+constexpr auto read = Register{4003};
+constexpr auto write = Register{4004};
+constexpr auto open = Register{4005};
+constexpr auto close = Register{4006};
+constexpr auto brk = Register{4045};
+constexpr auto mmap = Register{4090};
+constexpr auto munmap = Register{4091};
+constexpr auto writev = Register{4146};
+constexpr auto exit_group = Register{4246};
+
+}
+
+// The flags and errnos MIPS numbers its own way.
+namespace guest {
+
+constexpr auto open_access = Register{0x0003};
+constexpr auto open_append = Register{0x0008};
+constexpr auto open_nonblock = Register{0x0080};
+constexpr auto open_create = Register{0x0100};
+constexpr auto open_truncate = Register{0x0200};
+constexpr auto open_exclusive = Register{0x0400};
+
+constexpr auto map_fixed = Register{0x0010};
+constexpr auto map_anonymous = Register{0x0800};
+
+constexpr auto name_too_long = Register{78};
+constexpr auto no_system_call = Register{89};
+constexpr auto loop = Register{90};
+constexpr auto not_empty = Register{93};
+
+}
+
+// Registers of the o32 calling convention.
+constexpr auto v0 = std::size_t{2};
+constexpr auto a0 = std::size_t{4};
+constexpr auto a1 = std::size_t{5};
+constexpr auto a2 = std::size_t{6};
+constexpr auto a3 = std::size_t{7};
+constexpr auto sp = std::size_t{29};
+
+// The most one read or write transfers, so that a huge count does not get
+// every page it covers allocated up front. Guests must cope with short
+// transfers anyway.
+constexpr auto max_transfer = std::size_t{1} << 20;
+
+// The most buffers a writev() takes, like Linux.
+constexpr auto max_vectors = std::size_t{1024};
+
+constexpr auto output_capacity = std::size_t{1} << 16;
+
+// Where mmap() puts mappings, upwards, below which the heap can grow.
+constexpr auto mapping_base = Address{0x40000000};
+
+constexpr auto max_path = std::size_t{4096};
+
+constexpr auto address_space_size = std::uint64_t{1} << 32;
+
+Register guest_errno(int error)
+{
+    switch (error) {
+        case ENAMETOOLONG:
+            return guest::name_too_long;
+        case ENOSYS:
+            return guest::no_system_call;
+        case ELOOP:
+            return guest::loop;
+        case ENOTEMPTY:
+            return guest::not_empty;
+        default:
+            // The classic errnos are the same everywhere.
+            return static_cast<Register>(error);
+    }
+}
+
+int host_open_flags(Register flags)
+{
+    auto host = 0;
+
+    switch (flags & guest::open_access) {
+        case 0:
+            host = O_RDONLY;
+            break;
+        case 1:
+            host = O_WRONLY;
+            break;
+        default:
+            host = O_RDWR;
+            break;
+    }
+
+    auto const pairs = std::array<std::pair<Register, int>, 5>{{
+        {guest::open_append, O_APPEND},
+        {guest::open_nonblock, O_NONBLOCK},
+        {guest::open_create, O_CREAT},
+        {guest::open_truncate, O_TRUNC},
+        {guest::open_exclusive, O_EXCL},
+    }};
+
+    for (auto const& [bit, flag]: pairs) {
+        if (flags & bit) {
+            host |= flag;
+        }
+    }
+
+    return host | O_CLOEXEC;
+}
+
+// The length of the NUL-terminated string at `address`, or `limit` if it
+// is at least that long.
+std::size_t
+string_length(Memory& memory, Address address, std::size_t limit)
+{
+    auto length = std::size_t{0};
+    while (length < limit and
+           memory.load<std::uint8_t>(address + Address(length)) != 0) {
+        ++length;
+    }
+
+    return length;
+}
+
+template <typename Byte>
+void add_vectors(
+    std::vector<iovec>& vectors,
+    std::vector<Memory::HostSpan<Byte>> const& spans)
+{
+    for (auto const& span: spans) {
+        // writev() only reads from its buffers, whatever their type says.
+        std::byte const* data = span.data;
+        vectors.push_back({const_cast<std::byte*>(data), span.size});
+    }
+}
+
+}
+
+Syscalls::Syscalls(Program const& program):
+    code{program.code},
+    heap_start{program.data_end},
+    program_break{program.data_end},
+    next_mapping{mapping_base},
+    files{0, 1, 2}
+{
+    pending.reserve(output_capacity);
+}
+
+Syscalls::~Syscalls()
+{
+    flush();
+
+    for (auto i = std::size_t{3}; i < files.size(); ++i) {
+        if (files[i] >= 0) {
+            ::close(files[i]);
+        }
+    }
+}
+
+bool Syscalls::handle(CPU& cpu)
+{
+    if (not cpu.trap_pending() or
+        exception_code(cpu.cause()) != ExceptionCode::Syscall) {
+        return false;
+    }
+
+    auto const lock = std::lock_guard{mutex};
+
+    if (exit_status_) {
+        return false;
+    }
+
+    auto& registers = cpu.registers();
+
+    if (registers[v0] < linux_o32::first) {
+        if (not spim_call(cpu)) {
+            return false;
+        }
+    } else {
+        auto const result = linux_call(cpu);
+        registers[v0] = result.value;
+        registers[a3] = result.failed ? 1 : 0;
+    }
+
+    if (exit_status_) {
+        flush_locked();
+        return false;
+    }
+
+    cpu.return_from_trap(cpu.epc() + 4);
+
+    return true;
+}
+
+std::optional<int> Syscalls::exit_status() const
+{
+    auto const lock = std::lock_guard{mutex};
+    return exit_status_;
+}
+
+void Syscalls::flush()
+{
+    auto const lock = std::lock_guard{mutex};
+    flush_locked();
+}
+
+Syscalls::Result Syscalls::succeeded(Register value)
+{
+    return {value, false};
+}
+
+Syscalls::Result Syscalls::failed(int host_error)
+{
+    return {guest_errno(host_error), true};
+}
+
+Syscalls::Result Syscalls::from_host(long result)
+{
+    return result < 0 ? failed(errno) : succeeded(Register(result));
+}
+
+Syscalls::Buffer Syscalls::buffer_at(Address address, std::size_t size)
+{
+    auto const room = address_space_size - address;
+
+    return {address, std::min<std::uint64_t>({size, room, max_transfer})};
+}
+
+bool Syscalls::spim_call(CPU& cpu)
+{
+    auto& registers = cpu.registers();
+    auto const argument = registers[a0];
+
+    switch (registers[v0]) {
+        case spim::print_int: {
+            auto text = std::array<char, 16>{};
+            auto const end =
+                std::to_chars(
+                    text.data(),
+                    text.data() + text.size(),
+                    static_cast<std::int32_t>(argument))
+                    .ptr;
+            output(text.data(), static_cast<std::size_t>(end - text.data()));
+            return true;
+        }
+        case spim::print_string: {
+            auto& memory = cpu.memory();
+            auto const length = string_length(memory, argument, max_transfer);
+            output(memory, {buffer_at(argument, length)});
+            return true;
+        }
+        case spim::sbrk:
+            registers[v0] = program_break;
+            program_break += argument;
+            return true;
+        case spim::exit:
+            exit_status_ = 0;
+            return true;
+        case spim::print_char: {
+            auto const character = static_cast<char>(argument & 0xFF);
+            output(&character, 1);
+            return true;
+        }
+        case spim::exit2:
+            exit_status_ = static_cast<std::int32_t>(argument);
+            return true;
+    }
+
+    return false;
+}
+
+Syscalls::Result Syscalls::linux_call(CPU& cpu)
+{
+    auto const& registers = cpu.registers();
+
+    switch (registers[v0]) {
+        case linux_o32::exit:
+        case linux_o32::exit_group:
+            exit_status_ = static_cast<int>(registers[a0] & 0xFF);
+            return succeeded(0);
+        case linux_o32::read:
+            return read(
+                cpu, registers[a0], buffer_at(registers[a1], registers[a2]));
+        case linux_o32::write:
+            return write(
+                cpu,
+                registers[a0],
+                {buffer_at(registers[a1], registers[a2])});
+        case linux_o32::open:
+            return open(cpu, registers[a0], registers[a1], registers[a2]);
+        case linux_o32::close:
+            return close(registers[a0]);
+        case linux_o32::brk:
+            return brk(registers[a0]);
+        case linux_o32::mmap:
+            return mmap(cpu);
+        case linux_o32::munmap:
+            // Mappings are only ever zero-filled guest memory.
+            return succeeded(0);
+        case linux_o32::writev:
+            return writev(cpu, registers[a0], registers[a1], registers[a2]);
+    }
+
+    return failed(ENOSYS);
+}
+
+Syscalls::Result Syscalls::read(CPU& cpu, Register fd, Buffer buffer)
+{
+    auto const file = host_file(fd);
+    if (not file) {
+        return failed(EBADF);
+    }
+
+    // Whatever the guest asks for may depend on what it wrote before, such
+    // as a prompt.
+    flush_locked();
+
+    return from_host(fill(cpu, *file, buffer, std::nullopt));
+}
+
+Syscalls::Result
+Syscalls::write(CPU& cpu, Register fd, std::vector<Buffer> const& buffers)
+{
+    auto const file = host_file(fd);
+    if (not file) {
+        return failed(EBADF);
+    }
+
+    if (fd == 1) {
+        return output(cpu.memory(), buffers);
+    }
+
+    flush_locked();
+
+    return from_host(send(cpu.memory(), *file, buffers));
+}
+
+Syscalls::Result
+Syscalls::writev(CPU& cpu, Register fd, Address vectors, Register count)
+{
+    if (count > max_vectors) {
+        return failed(EINVAL);
+    }
+
+    auto& memory = cpu.memory();
+    auto buffers = std::vector<Buffer>{};
+    auto total = std::size_t{0};
+
+    for (auto i = Register{0}; i < count; ++i) {
+        auto const base = memory.load<std::uint32_t>(vectors + 8 * i);
+        auto const size = memory.load<std::uint32_t>(vectors + 8 * i + 4);
+        auto const buffer = buffer_at(
+            base, std::min<std::size_t>(size, max_transfer - total));
+
+        buffers.push_back(buffer);
+        total += buffer.size;
+    }
+
+    return write(cpu, fd, buffers);
+}
+
+Syscalls::Result
+Syscalls::open(CPU& cpu, Address path, Register flags, Register mode)
+{
+    auto& memory = cpu.memory();
+    auto const length = string_length(memory, path, max_path);
+    if (length == max_path) {
+        return failed(ENAMETOOLONG);
+    }
+
+    auto name = std::string(length, '\0');
+    memory.read(path, name.data(), length);
+
+    auto const file =
+        ::open(name.c_str(), host_open_flags(flags), mode & 07777);
+    if (file < 0) {
+        return from_host(file);
+    }
+
+    auto const slot = std::find(files.begin() + 3, files.end(), -1);
+    auto const fd = static_cast<Register>(slot - files.begin());
+
+    if (slot == files.end()) {
+        files.push_back(file);
+    } else {
+        *slot = file;
+    }
+
+    return succeeded(fd);
+}
+
+Syscalls::Result Syscalls::close(Register fd)
+{
+    auto const file = host_file(fd);
+    if (not file) {
+        return failed(EBADF);
+    }
+
+    if (fd == 1) {
+        flush_locked();
+    }
+
+    files[fd] = -1;
+
+    // The standard files are the host's as well.
+    return fd < 3 ? succeeded(0) : from_host(::close(*file));
+}
+
+Syscalls::Result Syscalls::brk(Address address)
+{
+    if (address >= heap_start and address < next_mapping) {
+        program_break = address;
+    }
+
+    // Linux answers with the break as it is, whether it moved or not.
+    return succeeded(program_break);
+}
+
+// mmap(address, length, protection, flags, fd, offset), with the last two
+// arguments on the stack.
+Syscalls::Result Syscalls::mmap(CPU& cpu)
+{
+    auto& memory = cpu.memory();
+    auto const& registers = cpu.registers();
+
+    auto const address = registers[a0];
+    auto const length = std::size_t{registers[a1]};
+    auto const flags = registers[a3];
+    auto const fd = memory.load<std::uint32_t>(registers[sp] + 16);
+    auto const offset = memory.load<std::uint32_t>(registers[sp] + 20);
+
+    auto const anonymous = (flags & guest::map_anonymous) != 0;
+    auto const file = anonymous ? std::nullopt : host_file(fd);
+
+    if (not anonymous and not file) {
+        return failed(EBADF);
+    }
+
+    auto const page_mask = std::size_t{Memory::page_size - 1};
+    auto const size = (length + page_mask) & ~page_mask;
+
+    if (length == 0 or (offset & page_mask) != 0) {
+        return failed(EINVAL);
+    }
+
+    auto start = Address{0};
+
+    if (flags & guest::map_fixed) {
+        if ((address & page_mask) != 0 or
+            address + std::uint64_t{size} > address_space_size) {
+            return failed(EINVAL);
+        }
+
+        start = address;
+        memory.discard(start, size);
+        wrote(cpu, start, size);
+    } else {
+        if (next_mapping + std::uint64_t{size} > address_space_size) {
+            return failed(ENOMEM);
+        }
+
+        // Nothing is ever put there but mappings, so it is still zero.
+        start = next_mapping;
+        next_mapping += static_cast<Address>(size);
+    }
+
+    for (auto done = std::size_t{0}; file and done < length;) {
+        auto const buffer =
+            buffer_at(start + Address(done), length - done);
+        auto const filled =
+            fill(cpu, *file, buffer, long(offset) + long(done));
+
+        if (filled < 0) {
+            return from_host(filled);
+        }
+
+        if (filled == 0) {
+            break;
+        }
+
+        done += static_cast<std::size_t>(filled);
+    }
+
+    return succeeded(start);
+}
+
+Syscalls::Result
+Syscalls::output(Memory& memory, std::vector<Buffer> const& buffers)
+{
+    auto total = std::size_t{0};
+    for (auto const& buffer: buffers) {
+        total += buffer.size;
+    }
+
+    if (pending.size() + total > output_capacity) {
+        flush_locked();
+
+        // Too big to be worth copying, so straight from guest memory.
+        if (total >= output_capacity) {
+            return from_host(send(memory, STDOUT_FILENO, buffers));
+        }
+    }
+
+    for (auto const& buffer: buffers) {
+        auto const end = pending.size();
+        pending.resize(end + buffer.size);
+        memory.read(buffer.address, pending.data() + end, buffer.size);
+    }
+
+    return succeeded(static_cast<Register>(total));
+}
+
+void Syscalls::output(char const* text, std::size_t size)
+{
+    if (pending.size() + size > output_capacity) {
+        flush_locked();
+    }
+
+    pending.insert(pending.end(), text, text + size);
+}
+
+void Syscalls::flush_locked()
+{
+    auto const* data = pending.data();
+    auto left = pending.size();
+
+    while (left > 0) {
+        auto const written = ::write(STDOUT_FILENO, data, left);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Like stdio, give up on the output rather than on the guest.
+            break;
+        }
+
+        data += written;
+        left -= static_cast<std::size_t>(written);
+    }
+
+    pending.clear();
+}
+
+long Syscalls::send(
+    Memory& memory,
+    int file,
+    std::vector<Buffer> const& buffers)
+{
+    if (memory.endianness() == Endianness::Big) {
+        auto bytes = std::vector<std::byte>{};
+        for (auto const& buffer: buffers) {
+            auto const end = bytes.size();
+            bytes.resize(end + buffer.size);
+            memory.read(buffer.address, bytes.data() + end, buffer.size);
+        }
+
+        return ::write(file, bytes.data(), bytes.size());
+    }
+
+    auto vectors = std::vector<iovec>{};
+    for (auto const& buffer: buffers) {
+        add_vectors(vectors, memory.host_spans(buffer.address, buffer.size));
+    }
+
+    // Short writes are allowed, so whatever does not fit in one call waits
+    // for the next.
+    auto const count = std::min(vectors.size(), max_vectors);
+
+    return ::writev(file, vectors.data(), static_cast<int>(count));
+}
+
+long Syscalls::fill(
+    CPU& cpu,
+    int file,
+    Buffer buffer,
+    std::optional<long> offset)
+{
+    auto& memory = cpu.memory();
+    auto filled = long{0};
+
+    if (memory.endianness() == Endianness::Big) {
+        auto bytes = std::vector<std::byte>(buffer.size);
+
+        filled = offset ? ::pread(file, bytes.data(), bytes.size(), *offset)
+                        : ::read(file, bytes.data(), bytes.size());
+
+        if (filled > 0) {
+            memory.write(buffer.address, bytes.data(), std::size_t(filled));
+        }
+    } else {
+        auto vectors = std::vector<iovec>{};
+        add_vectors(
+            vectors, memory.writable_host_spans(buffer.address, buffer.size));
+
+        auto const count = static_cast<int>(vectors.size());
+
+        filled = offset ? ::preadv(file, vectors.data(), count, *offset)
+                        : ::readv(file, vectors.data(), count);
+    }
+
+    if (filled > 0) {
+        wrote(cpu, buffer.address, static_cast<std::size_t>(filled));
+    }
+
+    return filled;
+}
+
+void Syscalls::wrote(CPU& cpu, Address address, std::size_t size) const
+{
+    if (address < code.end and address + std::uint64_t{size} > code.begin) {
+        cpu.invalidate_instructions();
+        cpu.memory().wrote_code();
+    }
+}
+
+std::optional<int> Syscalls::host_file(Register fd) const
+{
+    if (fd >= files.size() or files[fd] < 0) {
+        return std::nullopt;
+    }
+
+    return files[fd];
+}
+
+}
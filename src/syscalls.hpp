@@ -0,0 +1,124 @@
+#ifndef MERCURY_SYSCALLS_HPP
+#define MERCURY_SYSCALLS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "program.hpp"
+#include "registers.hpp"
+
+namespace mercury {
+
+// Emulates the system calls of one guest process with host ones, for CPUs
+// stopped on a `syscall` instruction.
+//
+// The call is picked by $v0. Numbers below 4000 are SPIM's: print_int,
+// print_string, sbrk, exit, print_char and exit2. The others are Linux o32
+// ones: exit, read, write, open, close, brk, mmap, munmap, writev and
+// exit_group, which return their result in $v0 or, on failure, set $a3 and
+// return a MIPS errno. Other Linux calls fail with ENOSYS.
+//
+// Reads and writes go straight between host files and the guest pages
+// behind their buffers, without copying them, except for big-endian guests,
+// whose bytes are not in order in host memory. Writes to standard output
+// that fit in a buffer are gathered there instead, and written out in
+// batches. The buffer is flushed before any other I/O, when the guest
+// exits, and by flush().
+//
+// Guest file descriptors 0, 1 and 2 are the host's standard files, which
+// closing does not close, and the others are files opened by the guest.
+//
+// CPUs sharing memory must share their Syscalls, which serializes the calls.
+class Syscalls {
+public:
+    explicit Syscalls(Program const& program);
+
+    // Flushes output and closes the files the guest left open.
+    ~Syscalls();
+
+    Syscalls(Syscalls const&) = delete;
+    Syscalls& operator=(Syscalls const&) = delete;
+
+    // Carry out the system call `cpu` is trapped on, and return from the
+    // trap past it. Returns whether the CPU can carry on, which it cannot if
+    // it is not trapped on a system call, if the call is unknown to SPIM, or
+    // once the guest has exited.
+    bool handle(CPU& cpu);
+
+    // The status the guest exited with, if it did.
+    std::optional<int> exit_status() const;
+
+    void flush();
+
+private:
+    // What a Linux call returns: a value or, if it failed, a MIPS errno.
+    struct Result {
+        Register value;
+        bool failed;
+    };
+
+    // A guest buffer, cut short so that it neither wraps around the address
+    // space nor takes more than one transfer.
+    struct Buffer {
+        Address address;
+        std::size_t size;
+    };
+
+    static Result succeeded(Register value);
+    static Result failed(int host_error);
+    // From a host call returning -1 and setting errno on failure.
+    static Result from_host(long result);
+    static Buffer buffer_at(Address address, std::size_t size);
+
+    bool spim_call(CPU& cpu);
+    Result linux_call(CPU& cpu);
+
+    Result read(CPU& cpu, Register fd, Buffer buffer);
+    Result write(CPU& cpu, Register fd, std::vector<Buffer> const& buffers);
+    Result writev(CPU& cpu, Register fd, Address vectors, Register count);
+    Result open(CPU& cpu, Address path, Register flags, Register mode);
+    Result close(Register fd);
+    Result brk(Address address);
+    Result mmap(CPU& cpu);
+
+    // Gather writes to standard output in `pending`, as long as they fit.
+    Result output(Memory& memory, std::vector<Buffer> const& buffers);
+    void output(char const* text, std::size_t size);
+    void flush_locked();
+
+    // Write `buffers` to `file` in one host call. Returns the byte count,
+    // or -1.
+    long send(Memory& memory, int file, std::vector<Buffer> const& buffers);
+
+    // Fill `buffer` from `file`, at `offset` if there is one. Returns the
+    // byte count, or -1.
+    long fill(CPU& cpu, int file, Buffer buffer, std::optional<long> offset);
+
+    // Decoded copies of code overwritten by the host are stale, on every CPU
+    // sharing the memory.
+    void wrote(CPU& cpu, Address address, std::size_t size) const;
+
+    std::optional<int> host_file(Register fd) const;
+
+    mutable std::mutex mutex;
+
+    AddressRange code;
+    Address heap_start;
+    Address program_break;
+    Address next_mapping;
+
+    // Host file descriptors by guest ones, -1 for closed ones.
+    std::vector<int> files;
+
+    std::vector<char> pending;
+    std::optional<int> exit_status_;
+};
+
+}
+
+#endif
@@ -0,0 +1,396 @@
+#include "threaded_interpreter.hpp"
+
+#include "cpu_internals.hpp"
+#include "decoder.hpp"
+#include "enum_indexed_array.hpp"
+#include "specializer.hpp"
+
+namespace mercury {
+
+void ThreadedCode::invalidate(Register address)
+{
+    auto const index = static_cast<std::size_t>((address - base) / 4);
+
+    // The last slot is the end-of-program sentinel and is never translated.
+    if (address >= base and index + 1 < slots.size()) {
+        slots[index].label = untranslated;
+    }
+}
+
+void ThreadedCode::invalidate()
+{
+    for (auto i = std::size_t{0}; i + 1 < slots.size(); ++i) {
+        slots[i].label = untranslated;
+    }
+}
+
+#if defined(__GNUC__)
+
+// Labels as values are a GNU extension, which is the whole point here.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+// Label addresses outlive the function, but GCC takes them for addresses of
+// locals when they are stored in the threaded code.
+#if !defined(__clang__) && __GNUC__ >= 12
+#pragma GCC diagnostic ignored "-Wdangling-pointer"
+#endif
+
+RunResult run_threaded(
+    CPUInternals& impl,
+    std::size_t max_steps,
+    Register breakpoint)
+{
+    using Labels = EnumIndexedArray<Operation, void const*, Operation::LAST>;
+
+    // Anything without a dedicated label goes through its bound handler,
+    // including unknown instructions, which it reports. So does everything
+    // when profiling or tracing, since that is where instructions are
+    // counted and recorded.
+    auto labels = Labels{&&generic};
+
+    if constexpr (not profiling and not tracing) {
+        labels[Operation::ADD] = &&add;
+        labels[Operation::ADDU] = &&addu;
+        labels[Operation::AND] = &&bitwise_and;
+        labels[Operation::JR] = &&jr;
+        labels[Operation::NOR] = &&nor;
+        labels[Operation::OR] = &&bitwise_or;
+        labels[Operation::SLT] = &&slt;
+        labels[Operation::SLTU] = &&sltu;
+        labels[Operation::SLL] = &&sll;
+        labels[Operation::SRL] = &&srl;
+        labels[Operation::SUB] = &&sub;
+        labels[Operation::SUBU] = &&subu;
+
+        labels[Operation::ADDI] = &&addi;
+        labels[Operation::ADDIU] = &&addiu;
+        labels[Operation::ANDI] = &&andi;
+        labels[Operation::BEQ] = &&beq;
+        labels[Operation::BNE] = &&bne;
+        labels[Operation::LUI] = &&lui;
+        labels[Operation::ORI] = &&ori;
+        labels[Operation::SLTI] = &&slti;
+        labels[Operation::SLTIU] = &&sltiu;
+        labels[Operation::LW] = &&lw;
+        labels[Operation::LBU] = &&lbu;
+        labels[Operation::LHU] = &&lhu;
+        labels[Operation::SB] = &&sb;
+        labels[Operation::SH] = &&sh;
+        labels[Operation::SW] = &&sw;
+
+        labels[Operation::J] = &&jump;
+        labels[Operation::JAL] = &&jal;
+
+        labels[Operation::NOP] = &&nop;
+        labels[Operation::MOVE] = &&move;
+        labels[Operation::LI] = &&load_constant;
+    }
+
+    auto& code = impl.threaded_code;
+    auto const range = impl.code;
+    auto const program_size = std::size_t{(range.end - range.begin) / 4};
+
+    if (code.base != range.begin or code.slots.size() != program_size + 1) {
+        code.base = range.begin;
+        code.slots.assign(program_size + 1, {&&translate, {}});
+        code.slots.back().label = &&end_of_program;
+    }
+    code.untranslated = &&translate;
+
+    auto const slot_index = [&](Register address) {
+        return static_cast<std::size_t>((address - range.begin) / 4);
+    };
+
+    // Breakpoints are set by patching their slot, so that checking for them
+    // costs nothing on every other instruction.
+    auto* const breakpoint_slot =
+        breakpoint % 4 == 0 and range.contains(breakpoint)
+            ? &code.slots[slot_index(breakpoint)]
+            : nullptr;
+    auto const* const breakpoint_label =
+        breakpoint_slot ? breakpoint_slot->label : nullptr;
+
+    if (breakpoint_slot) {
+        breakpoint_slot->label = &&breakpoint_reached;
+    }
+
+    auto steps = std::size_t{0};
+    auto reason = StopReason::StepLimit;
+    ThreadedInstruction* op = nullptr;
+
+#define MERCURY_STOP(stop_reason)                                              \
+    do {                                                                       \
+        reason = stop_reason;                                                  \
+        goto done;                                                             \
+    } while (false)
+
+#define MERCURY_JUMP()                                                         \
+    do {                                                                       \
+        op = &code.slots[slot_index(impl.pc)];                                 \
+        impl.pc += 4;                                                          \
+        ++steps;                                                               \
+        goto* op->label;                                                       \
+    } while (false)
+
+// Sequential instructions can always dispatch through the next slot, since
+// running off the end of the program lands on the sentinel.
+#define MERCURY_DISPATCH()                                                     \
+    do {                                                                       \
+        if (steps == max_steps) {                                              \
+            MERCURY_STOP(StopReason::StepLimit);                               \
+        }                                                                      \
+        MERCURY_JUMP();                                                        \
+    } while (false)
+
+// Control transfers may go anywhere, so they check the target first.
+#define MERCURY_DISPATCH_CHECKED()                                             \
+    do {                                                                       \
+        if (steps == max_steps) {                                              \
+            MERCURY_STOP(StopReason::StepLimit);                               \
+        }                                                                      \
+        if (not range.contains(impl.pc)) {                                     \
+            MERCURY_STOP(StopReason::OutOfProgram);                            \
+        }                                                                      \
+        MERCURY_JUMP();                                                        \
+    } while (false)
+
+// Instructions that may trap stop if they did.
+#define MERCURY_DISPATCH_TRAPPING()                                            \
+    do {                                                                       \
+        if (impl.trap_pending) {                                               \
+            MERCURY_STOP(StopReason::Trap);                                    \
+        }                                                                      \
+        MERCURY_DISPATCH();                                                    \
+    } while (false)
+
+    if (impl.trap_pending) {
+        MERCURY_STOP(StopReason::Trap);
+    }
+
+    MERCURY_DISPATCH_CHECKED();
+
+translate : {
+    // The breakpoint's slot was invalidated after being patched, and must
+    // stay untranslated until it is unpatched.
+    if (op == breakpoint_slot) {
+        goto breakpoint_reached;
+    }
+
+    auto const raw = impl.memory.load<RawInstruction>(impl.pc - 4);
+
+    op->decoded = specialize(decode_instruction(raw));
+    op->label = labels[op->decoded.operation];
+
+    goto* op->label;
+}
+
+generic:
+    dispatch(impl, op->decoded);
+
+    if (impl.trap_pending) {
+        MERCURY_STOP(StopReason::Trap);
+    }
+
+    MERCURY_DISPATCH_CHECKED();
+
+add:
+    impl.add(op->decoded);
+    MERCURY_DISPATCH_TRAPPING();
+
+addu:
+    impl.addu(op->decoded);
+    MERCURY_DISPATCH();
+
+bitwise_and:
+    impl.bitwise_and(op->decoded);
+    MERCURY_DISPATCH();
+
+jr:
+    impl.jr(op->decoded);
+
+    if (impl.trap_pending) {
+        MERCURY_STOP(StopReason::Trap);
+    }
+
+    MERCURY_DISPATCH_CHECKED();
+
+nor:
+    impl.nor(op->decoded);
+    MERCURY_DISPATCH();
+
+bitwise_or:
+    impl.bitwise_or(op->decoded);
+    MERCURY_DISPATCH();
+
+slt:
+    impl.slt(op->decoded);
+    MERCURY_DISPATCH();
+
+sltu:
+    impl.sltu(op->decoded);
+    MERCURY_DISPATCH();
+
+sll:
+    impl.sll(op->decoded);
+    MERCURY_DISPATCH();
+
+srl:
+    impl.srl(op->decoded);
+    MERCURY_DISPATCH();
+
+sub:
+    impl.sub(op->decoded);
+    MERCURY_DISPATCH_TRAPPING();
+
+subu:
+    impl.subu(op->decoded);
+    MERCURY_DISPATCH();
+
+addi:
+    impl.addi(op->decoded);
+    MERCURY_DISPATCH_TRAPPING();
+
+addiu:
+    impl.addiu(op->decoded);
+    MERCURY_DISPATCH();
+
+andi:
+    impl.andi(op->decoded);
+    MERCURY_DISPATCH();
+
+beq:
+    impl.beq(op->decoded);
+    MERCURY_DISPATCH_CHECKED();
+
+bne:
+    impl.bne(op->decoded);
+    MERCURY_DISPATCH_CHECKED();
+
+lui:
+    impl.lui(op->decoded);
+    MERCURY_DISPATCH();
+
+ori:
+    impl.ori(op->decoded);
+    MERCURY_DISPATCH();
+
+slti:
+    impl.slti(op->decoded);
+    MERCURY_DISPATCH();
+
+sltiu:
+    impl.sltiu(op->decoded);
+    MERCURY_DISPATCH();
+
+lw:
+    impl.lw(op->decoded);
+    MERCURY_DISPATCH_TRAPPING();
+
+lbu:
+    impl.lbu(op->decoded);
+    MERCURY_DISPATCH();
+
+lhu:
+    impl.lhu(op->decoded);
+    MERCURY_DISPATCH_TRAPPING();
+
+sb:
+    impl.sb(op->decoded);
+    MERCURY_DISPATCH();
+
+sh:
+    impl.sh(op->decoded);
+    MERCURY_DISPATCH_TRAPPING();
+
+sw:
+    impl.sw(op->decoded);
+    MERCURY_DISPATCH_TRAPPING();
+
+jump:
+    impl.jump(op->decoded);
+    MERCURY_DISPATCH_CHECKED();
+
+jal:
+    impl.jal(op->decoded);
+    MERCURY_DISPATCH_CHECKED();
+
+nop:
+    MERCURY_DISPATCH();
+
+move:
+    impl.move(op->decoded);
+    MERCURY_DISPATCH();
+
+load_constant:
+    impl.load_constant<1>(op->decoded);
+    MERCURY_DISPATCH();
+
+end_of_program:
+    // Undo the dispatch that landed here, nothing was executed.
+    impl.pc -= 4;
+    --steps;
+    MERCURY_STOP(StopReason::OutOfProgram);
+
+breakpoint_reached:
+    impl.pc -= 4;
+    --steps;
+    MERCURY_STOP(StopReason::Breakpoint);
+
+done:
+    // Unless the patch went along with the rest of the slot.
+    if (breakpoint_slot and breakpoint_slot->label == &&breakpoint_reached) {
+        breakpoint_slot->label = breakpoint_label;
+    }
+
+    return {reason, steps};
+
+#undef MERCURY_DISPATCH_TRAPPING
+#undef MERCURY_DISPATCH_CHECKED
+#undef MERCURY_DISPATCH
+#undef MERCURY_JUMP
+#undef MERCURY_STOP
+}
+
+#pragma GCC diagnostic pop
+
+#else
+
+// Without labels as values there is no threaded code to run, so fall back to
+// plain table dispatch.
+RunResult run_threaded(
+    CPUInternals& impl,
+    std::size_t max_steps,
+    Register breakpoint)
+{
+    auto steps = std::size_t{0};
+
+    while (true) {
+        if (impl.trap_pending) {
+            return {StopReason::Trap, steps};
+        }
+
+        if (steps == max_steps) {
+            return {StopReason::StepLimit, steps};
+        }
+
+        if (not impl.code.contains(impl.pc)) {
+            return {StopReason::OutOfProgram, steps};
+        }
+
+        if (impl.pc == breakpoint) {
+            return {StopReason::Breakpoint, steps};
+        }
+
+        auto const& decoded =
+            impl.instruction_cache.fetch(impl.memory, impl.pc);
+
+        impl.pc += 4;
+        dispatch(impl, decoded);
+        ++steps;
+    }
+}
+
+#endif
+
+}
@@ -0,0 +1,51 @@
+#ifndef MERCURY_THREADED_INTERPRETER_HPP
+#define MERCURY_THREADED_INTERPRETER_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include "cpu.hpp"
+#include "decoded_instruction.hpp"
+#include "memory.hpp"
+#include "registers.hpp"
+
+namespace mercury {
+
+// One instruction of direct-threaded code: the address of the interpreter
+// code that executes it, along with its decoded form.
+struct ThreadedInstruction {
+    void const* label;
+    DecodedInstruction decoded;
+};
+
+// The program's code as direct-threaded code, one slot per instruction word.
+//
+// Slots are translated lazily by the interpreter the first time they are
+// executed. Invalidating a slot sends it back through translation.
+class ThreadedCode {
+public:
+    void invalidate(Register address);
+    void invalidate();
+
+private:
+    friend RunResult run_threaded(
+        CPUInternals& impl,
+        std::size_t max_steps,
+        Register breakpoint);
+
+    // Slot i holds the instruction at base + 4 * i.
+    Address base{0};
+    std::vector<ThreadedInstruction> slots;
+    void const* untranslated{nullptr};
+};
+
+// Execute up to `max_steps` instructions with direct-threaded dispatch, with
+// the same stop conditions as CPU::run_until().
+RunResult run_threaded(
+    CPUInternals& impl,
+    std::size_t max_steps,
+    Register breakpoint);
+
+}
+
+#endif
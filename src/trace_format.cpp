@@ -0,0 +1,191 @@
+#include "trace_format.hpp"
+
+namespace mercury {
+
+namespace {
+
+namespace flag {
+
+constexpr auto jump = std::uint8_t{1};
+constexpr auto raw = std::uint8_t{2};
+constexpr auto writes_shift = 2;
+
+}
+
+// PCs are word-aligned, so no PC ever has this tag.
+constexpr auto invalid_pc = ~Address{0};
+
+constexpr std::uint32_t zigzag(std::uint32_t difference)
+{
+    auto const sign = difference >> 31 ? ~std::uint32_t{0} : 0;
+    return (difference << 1) ^ sign;
+}
+
+constexpr std::uint32_t unzigzag(std::uint32_t value)
+{
+    return (value >> 1) ^ (0 - (value & 1));
+}
+
+static_assert(zigzag(0) == 0);
+static_assert(zigzag(~std::uint32_t{0}) == 1);
+static_assert(zigzag(1) == 2);
+static_assert(unzigzag(zigzag(0x80000000u)) == 0x80000000u);
+
+std::byte* put_number(std::uint32_t value, std::byte* out)
+{
+    while (value >= 0x80) {
+        *out++ = std::byte{static_cast<std::uint8_t>(value | 0x80)};
+        value >>= 7;
+    }
+
+    *out++ = std::byte{static_cast<std::uint8_t>(value)};
+
+    return out;
+}
+
+std::byte const* get_number(
+    std::byte const* in,
+    std::byte const* end,
+    std::uint32_t& value)
+{
+    value = 0;
+
+    for (auto shift = 0; shift < 35; shift += 7) {
+        if (in == end) {
+            return nullptr;
+        }
+
+        auto const byte = std::to_integer<std::uint32_t>(*in++);
+        value |= (byte & 0x7F) << shift;
+
+        if (byte < 0x80) {
+            return in;
+        }
+    }
+
+    return nullptr;
+}
+
+}
+
+TraceContext::TraceContext(): next_pc{0}, registers{}, raws{}
+{
+    for (auto& line: raws) {
+        line = {invalid_pc, 0};
+    }
+}
+
+std::byte* TraceContext::encode(TraceRecord const& record, std::byte* out)
+{
+    auto& line = raw_line(record.pc);
+    auto flags = static_cast<std::uint8_t>(record.write_count
+                                           << flag::writes_shift);
+
+    if (record.pc != next_pc) {
+        flags |= flag::jump;
+    }
+
+    if (line.pc != record.pc or line.raw != record.raw) {
+        flags |= flag::raw;
+    }
+
+    *out++ = std::byte{flags};
+
+    if (flags & flag::jump) {
+        out = put_number(zigzag(record.pc - next_pc), out);
+    }
+
+    if (flags & flag::raw) {
+        for (auto shift = 0; shift < 32; shift += 8) {
+            *out++ = std::byte{static_cast<std::uint8_t>(record.raw >> shift)};
+        }
+        line = {record.pc, record.raw};
+    }
+
+    for (auto i = std::size_t{0}; i < record.write_count; ++i) {
+        auto const& write = record.writes[i];
+        auto& last = registers[write.index];
+
+        *out++ = std::byte{write.index};
+        out = put_number(zigzag(write.value - last), out);
+        last = write.value;
+    }
+
+    next_pc = record.pc + 4;
+
+    return out;
+}
+
+std::byte const* TraceContext::decode(
+    std::byte const* in,
+    std::byte const* end,
+    TraceRecord& record)
+{
+    if (in == end) {
+        return nullptr;
+    }
+
+    auto const flags = std::to_integer<std::uint8_t>(*in++);
+    auto decoded = TraceRecord{};
+    auto number = std::uint32_t{0};
+
+    decoded.pc = next_pc;
+    decoded.write_count =
+        static_cast<std::uint8_t>(flags >> flag::writes_shift);
+
+    if (decoded.write_count > trace::max_writes) {
+        return nullptr;
+    }
+
+    if (flags & flag::jump) {
+        if (not (in = get_number(in, end, number))) {
+            return nullptr;
+        }
+        decoded.pc = next_pc + unzigzag(number);
+    }
+
+    auto& line = raw_line(decoded.pc);
+
+    if (flags & flag::raw) {
+        if (end - in < 4) {
+            return nullptr;
+        }
+
+        for (auto shift = 0; shift < 32; shift += 8) {
+            decoded.raw |= std::to_integer<std::uint32_t>(*in++) << shift;
+        }
+    } else {
+        decoded.raw = line.raw;
+    }
+
+    for (auto i = std::size_t{0}; i < decoded.write_count; ++i) {
+        if (in == end) {
+            return nullptr;
+        }
+
+        auto const index = std::to_integer<std::uint8_t>(*in++);
+
+        if (index >= trace::register_count or
+            not (in = get_number(in, end, number))) {
+            return nullptr;
+        }
+
+        decoded.writes[i] = {index, registers[index] + unzigzag(number)};
+    }
+
+    // Only now that the whole record is there can the context move on.
+    for (auto i = std::size_t{0}; i < decoded.write_count; ++i) {
+        registers[decoded.writes[i].index] = decoded.writes[i].value;
+    }
+
+    if (flags & flag::raw) {
+        line = {decoded.pc, decoded.raw};
+    }
+
+    next_pc = decoded.pc + 4;
+    record = decoded;
+
+    return in;
+}
+
+}
@@ -0,0 +1,99 @@
+#ifndef MERCURY_TRACE_FORMAT_HPP
+#define MERCURY_TRACE_FORMAT_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "instruction_formats.hpp"
+#include "memory.hpp"
+#include "registers.hpp"
+
+namespace mercury {
+
+// Tracing is chosen at build time, with the MERCURY_TRACE CMake option, so
+// that it costs nothing when it is off.
+#if defined(MERCURY_TRACE)
+constexpr auto tracing = true;
+#else
+constexpr auto tracing = false;
+#endif
+
+namespace trace {
+
+// Traces start with this, followed by one record per executed instruction.
+constexpr auto magic =
+    std::array<char, 8>{'M', 'E', 'R', 'C', 'T', 'R', 'C', '1'};
+
+// Register numbers of hi and lo in register writes.
+constexpr auto hi = std::uint8_t{32};
+constexpr auto lo = std::uint8_t{33};
+constexpr auto register_count = std::size_t{34};
+
+constexpr auto max_writes = std::size_t{2};
+
+// A flags byte, a PC and a raw word, and the writes.
+constexpr auto max_record_size = std::size_t{1 + 5 + 4 + max_writes * 6};
+
+}
+
+struct RegisterWrite {
+    std::uint8_t index;
+    Register value;
+};
+
+// An instruction that was executed, and the distinct registers it wrote.
+struct TraceRecord {
+    Address pc;
+    RawInstruction raw;
+    std::uint8_t write_count;
+    std::array<RegisterWrite, trace::max_writes> writes;
+};
+
+// What both ends of a trace remember of the records so far, which later
+// ones are encoded against.
+//
+// A record starts with a flags byte. Its low bit is set when the PC is not
+// right after the previous one, in which case the difference follows. The
+// next bit is set when the raw word is not the one last seen at that PC, in
+// which case it follows as four little-endian bytes. The next two bits are
+// the number of register writes, each of which is the register number and
+// how much it changed since its last write. Differences are zigzag-encoded
+// LEB128 numbers, so a loop mostly costs two or three bytes per instruction.
+class TraceContext {
+public:
+    TraceContext();
+
+    // Encode `record` at `out`, which must have room for
+    // trace::max_record_size bytes. Returns the end of the record.
+    std::byte* encode(TraceRecord const& record, std::byte* out);
+
+    // Decode a record from [`in`, `end`) into `record`. Returns where it
+    // ends, or nullptr if it is cut short or corrupt, in which case nothing
+    // changes.
+    std::byte const* decode(
+        std::byte const* in,
+        std::byte const* end,
+        TraceRecord& record);
+
+private:
+    static constexpr auto raw_cache_size = std::size_t{1024};
+
+    struct RawLine {
+        Address pc;
+        RawInstruction raw;
+    };
+
+    RawLine& raw_line(Address pc)
+    {
+        return raws[(pc / 4) % raw_cache_size];
+    }
+
+    Address next_pc;
+    std::array<Register, trace::register_count> registers;
+    std::array<RawLine, raw_cache_size> raws;
+};
+
+}
+
+#endif
@@ -0,0 +1,67 @@
+#include "trace_reader.hpp"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+namespace mercury {
+
+TraceReader::TraceReader(std::istream& in):
+    in_{in}, buffer(std::size_t{64} << 10), begin{0}, end{0}
+{
+    auto magic = std::array<char, trace::magic.size()>{};
+    in_.read(magic.data(), magic.size());
+
+    if (not in_ or magic != trace::magic) {
+        throw std::runtime_error("Not a trace.");
+    }
+}
+
+std::optional<TraceRecord> TraceReader::next()
+{
+    auto record = TraceRecord{};
+
+    while (true) {
+        auto const* data = buffer.data();
+        auto const* decoded =
+            context.decode(data + begin, data + end, record);
+
+        if (decoded) {
+            begin = static_cast<std::size_t>(decoded - data);
+            return record;
+        }
+
+        if (end - begin >= trace::max_record_size) {
+            throw std::runtime_error("Corrupt trace.");
+        }
+
+        if (not refill()) {
+            if (begin == end) {
+                return std::nullopt;
+            }
+
+            throw std::runtime_error("Truncated trace.");
+        }
+    }
+}
+
+bool TraceReader::refill()
+{
+    std::copy(
+        buffer.begin() + static_cast<std::ptrdiff_t>(begin),
+        buffer.begin() + static_cast<std::ptrdiff_t>(end),
+        buffer.begin());
+    end -= begin;
+    begin = 0;
+
+    in_.read(
+        reinterpret_cast<char*>(buffer.data() + end),
+        static_cast<std::streamsize>(buffer.size() - end));
+
+    auto const count = static_cast<std::size_t>(in_.gcount());
+    end += count;
+
+    return count > 0;
+}
+
+}
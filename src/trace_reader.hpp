@@ -0,0 +1,37 @@
+#ifndef MERCURY_TRACE_READER_HPP
+#define MERCURY_TRACE_READER_HPP
+
+#include <cstddef>
+#include <istream>
+#include <optional>
+#include <vector>
+
+#include "trace_format.hpp"
+
+namespace mercury {
+
+// Reads back the records of a trace written by a TraceWriter.
+class TraceReader {
+public:
+    // Throws std::runtime_error if `in` does not hold a trace.
+    explicit TraceReader(std::istream& in);
+
+    // The next record, or nothing at the end of the trace. Throws
+    // std::runtime_error if the trace is cut short or corrupt.
+    std::optional<TraceRecord> next();
+
+private:
+    // Move what is left to the front of the buffer and read more after it.
+    // Returns whether anything was read.
+    bool refill();
+
+    std::istream& in_;
+    TraceContext context;
+    std::vector<std::byte> buffer;
+    std::size_t begin;
+    std::size_t end;
+};
+
+}
+
+#endif
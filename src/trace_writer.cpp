@@ -0,0 +1,98 @@
+#include "trace_writer.hpp"
+
+#include <stdexcept>
+
+namespace mercury {
+
+TraceWriter::TraceWriter(std::string const& path):
+    path_{path},
+    file{path, std::ios::binary | std::ios::trunc},
+    storage(chunk_size * chunk_count),
+    sizes{},
+    cursor{storage.data()},
+    chunk_end{storage.data() + chunk_size}
+{
+    file.write(trace::magic.data(), trace::magic.size());
+
+    if (not file) {
+        throw std::runtime_error("Could not create " + path + ".");
+    }
+
+    thread = std::thread{[this] { drain(); }};
+}
+
+TraceWriter::~TraceWriter()
+{
+    try {
+        close();
+    } catch (std::runtime_error const&) {
+        // Nobody is left to tell.
+    }
+}
+
+void TraceWriter::hand_off()
+{
+    auto lock = std::unique_lock{mutex};
+
+    sizes[filled % chunk_count] =
+        static_cast<std::size_t>(cursor - chunk(filled));
+    ++filled;
+    chunk_ready.notify_one();
+
+    chunk_free.wait(lock, [this] { return filled - written < chunk_count; });
+
+    cursor = chunk(filled);
+    chunk_end = cursor + chunk_size;
+}
+
+void TraceWriter::drain()
+{
+    auto lock = std::unique_lock{mutex};
+
+    while (true) {
+        chunk_ready.wait(lock, [this] { return written < filled or closing; });
+
+        if (written == filled) {
+            return;
+        }
+
+        auto const* bytes = chunk(written);
+        auto const size = sizes[written % chunk_count];
+
+        lock.unlock();
+        file.write(
+            reinterpret_cast<char const*>(bytes),
+            static_cast<std::streamsize>(size));
+        lock.lock();
+
+        failed = failed or not file;
+        ++written;
+        chunk_free.notify_one();
+    }
+}
+
+void TraceWriter::close()
+{
+    if (not thread.joinable()) {
+        return;
+    }
+
+    {
+        auto const lock = std::lock_guard{mutex};
+
+        sizes[filled % chunk_count] =
+            static_cast<std::size_t>(cursor - chunk(filled));
+        ++filled;
+        closing = true;
+        chunk_ready.notify_one();
+    }
+
+    thread.join();
+    file.close();
+
+    if (failed or not file) {
+        throw std::runtime_error("Could not write " + path_ + ".");
+    }
+}
+
+}
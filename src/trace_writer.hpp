@@ -0,0 +1,89 @@
+#ifndef MERCURY_TRACE_WRITER_HPP
+#define MERCURY_TRACE_WRITER_HPP
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trace_format.hpp"
+
+namespace mercury {
+
+// Streams trace records to a file from a background thread.
+//
+// Records are encoded into the chunks of a ring buffer, and each chunk is
+// handed to the writer thread once it is full. Recording only synchronizes
+// with the thread once per chunk, and only waits for it when the whole ring
+// is waiting to be written.
+class TraceWriter {
+public:
+    // Throws std::runtime_error if `path` cannot be created.
+    explicit TraceWriter(std::string const& path);
+
+    // Finishes writing, ignoring errors. Call close() to see them.
+    ~TraceWriter();
+
+    TraceWriter(TraceWriter const&) = delete;
+    TraceWriter& operator=(TraceWriter const&) = delete;
+
+    void record(TraceRecord const& record)
+    {
+        if (static_cast<std::size_t>(chunk_end - cursor) <
+            trace::max_record_size) {
+            hand_off();
+        }
+
+        cursor = context.encode(record, cursor);
+    }
+
+    // Write everything recorded so far and stop the writer thread. Nothing
+    // can be recorded after this. Throws std::runtime_error if writing
+    // failed.
+    void close();
+
+private:
+    static constexpr auto chunk_size = std::size_t{64} << 10;
+    static constexpr auto chunk_count = std::size_t{16};
+
+    std::byte* chunk(std::size_t index)
+    {
+        return storage.data() + (index % chunk_count) * chunk_size;
+    }
+
+    // Give the current chunk to the writer thread and move on to the next
+    // one, waiting for it to be written first if needed.
+    void hand_off();
+
+    // Body of the writer thread.
+    void drain();
+
+    std::string path_;
+    std::ofstream file;
+    TraceContext context;
+
+    std::vector<std::byte> storage;
+    std::array<std::size_t, chunk_count> sizes;
+    std::byte* cursor;
+    std::byte* chunk_end;
+
+    // Chunks are numbered in the order they are filled. All of this is
+    // guarded by `mutex`.
+    std::mutex mutex;
+    std::condition_variable chunk_ready;
+    std::condition_variable chunk_free;
+    std::size_t filled{0};
+    std::size_t written{0};
+    bool closing{false};
+    bool failed{false};
+
+    std::thread thread;
+};
+
+}
+
+#endif
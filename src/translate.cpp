@@ -0,0 +1,57 @@
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "aot_translator.hpp"
+#include "loader.hpp"
+
+namespace {
+
+// A C++ identifier made from the file name of `path`.
+std::string module_name(std::string const& path)
+{
+    auto const slash = path.find_last_of('/');
+    auto const file = path.substr(slash == std::string::npos ? 0 : slash + 1);
+    auto name = std::string{"aot_"};
+
+    for (auto c: file.substr(0, file.find('.'))) {
+        name += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+    }
+
+    return name;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 3 and argc != 4) {
+        std::cerr << "usage: mercury-aot <program.elf> <output.cpp> [name]\n";
+        return 1;
+    }
+
+    auto const name = argc == 4 ? std::string{argv[3]} : module_name(argv[1]);
+
+    try {
+        auto memory = mercury::Memory{};
+        auto const program = mercury::load_elf(memory, argv[1]);
+
+        auto out = std::ofstream{argv[2]};
+        if (not out) {
+            throw std::runtime_error(
+                std::string{"Could not create "} + argv[2] + ".");
+        }
+
+        mercury::translate_program(memory, program, name, out);
+
+        if (not out.flush()) {
+            throw std::runtime_error(
+                std::string{"Could not write "} + argv[2] + ".");
+        }
+    } catch (std::runtime_error const& error) {
+        std::cerr << error.what() << '\n';
+        return 1;
+    }
+}
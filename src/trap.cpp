@@ -0,0 +1,32 @@
+#include "trap.hpp"
+
+namespace mercury {
+
+static_assert(cause_of(ExceptionCode::Overflow) == 0x30);
+static_assert(exception_code(0x30) == ExceptionCode::Overflow);
+
+char const* name_of(ExceptionCode code)
+{
+    switch (code) {
+        case ExceptionCode::Interrupt:
+            return "interrupt";
+        case ExceptionCode::AddressErrorLoad:
+            return "address error on load";
+        case ExceptionCode::AddressErrorStore:
+            return "address error on store";
+        case ExceptionCode::Syscall:
+            return "system call";
+        case ExceptionCode::Breakpoint:
+            return "breakpoint";
+        case ExceptionCode::ReservedInstruction:
+            return "reserved instruction";
+        case ExceptionCode::Overflow:
+            return "arithmetic overflow";
+        case ExceptionCode::Trap:
+            return "trap";
+    }
+
+    return "unknown exception";
+}
+
+}
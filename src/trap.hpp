@@ -0,0 +1,38 @@
+#ifndef MERCURY_TRAP_HPP
+#define MERCURY_TRAP_HPP
+
+#include <cstdint>
+
+#include "registers.hpp"
+
+namespace mercury {
+
+// The MIPS exception codes, as found in the ExcCode field of the Cause
+// register.
+enum class ExceptionCode: std::uint8_t {
+    Interrupt = 0,
+    AddressErrorLoad = 4,
+    AddressErrorStore = 5,
+    Syscall = 8,
+    Breakpoint = 9,
+    ReservedInstruction = 10,
+    Overflow = 12,
+    Trap = 13,
+};
+
+// The Cause register for an exception, with only ExcCode set.
+constexpr Register cause_of(ExceptionCode code)
+{
+    return Register{static_cast<std::uint8_t>(code)} << 2;
+}
+
+constexpr ExceptionCode exception_code(Register cause)
+{
+    return static_cast<ExceptionCode>((cause >> 2) & 0x1F);
+}
+
+char const* name_of(ExceptionCode code);
+
+}
+
+#endif
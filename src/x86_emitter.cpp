@@ -0,0 +1,259 @@
+#include "x86_emitter.hpp"
+
+#include "enum_tools.hpp"
+
+namespace mercury::x86 {
+
+// The low three bits of a register go in ModRM, the fourth one in REX.
+static std::uint8_t low_bits(Reg reg)
+{
+    return value_of(reg) & 7u;
+}
+
+static bool extended(Reg reg)
+{
+    return value_of(reg) >= 8u;
+}
+
+void Emitter::mov(Reg destination, Reg source)
+{
+    rex(false, source, destination);
+    byte(0x89);
+    modrm(source, destination);
+}
+
+void Emitter::mov(Reg destination, std::uint32_t immediate)
+{
+    rex(false, Reg::rax, destination);
+    byte(static_cast<std::uint8_t>(0xB8 + low_bits(destination)));
+    word(immediate);
+}
+
+void Emitter::load(Reg destination, Reg base, std::int32_t displacement)
+{
+    rex(false, destination, base);
+    byte(0x8B);
+    memory(destination, base, displacement);
+}
+
+void Emitter::store(Reg base, std::int32_t displacement, Reg source)
+{
+    rex(false, source, base);
+    byte(0x89);
+    memory(source, base, displacement);
+}
+
+void Emitter::store(
+    Reg base,
+    std::int32_t displacement,
+    std::uint32_t immediate)
+{
+    rex(false, Reg::rax, base);
+    byte(0xC7);
+    memory(0, base, displacement);
+    word(immediate);
+}
+
+void Emitter::mov64(Reg destination, Reg source)
+{
+    rex(true, source, destination);
+    byte(0x89);
+    modrm(source, destination);
+}
+
+void Emitter::mov64(Reg destination, std::uint64_t immediate)
+{
+    rex(true, Reg::rax, destination);
+    byte(static_cast<std::uint8_t>(0xB8 + low_bits(destination)));
+    word(static_cast<std::uint32_t>(immediate));
+    word(static_cast<std::uint32_t>(immediate >> 32));
+}
+
+// The register forms of ADD, OR, AND, SUB, XOR and CMP are 8 * digit + 1
+// with the destination in r/m, and 8 * digit + 3 with it in reg.
+void Emitter::alu(Alu operation, Reg destination, Reg source)
+{
+    rex(false, source, destination);
+    byte(static_cast<std::uint8_t>(value_of(operation) * 8 + 1));
+    modrm(source, destination);
+}
+
+void Emitter::alu(Alu operation, Reg destination, std::uint32_t immediate)
+{
+    rex(false, Reg::rax, destination);
+    byte(0x81);
+    modrm(value_of(operation), destination);
+    word(immediate);
+}
+
+void Emitter::alu(
+    Alu operation,
+    Reg destination,
+    Reg base,
+    std::int32_t displacement)
+{
+    rex(false, destination, base);
+    byte(static_cast<std::uint8_t>(value_of(operation) * 8 + 3));
+    memory(destination, base, displacement);
+}
+
+void Emitter::shift_left(Reg destination, std::uint8_t amount)
+{
+    rex(false, Reg::rax, destination);
+    byte(0xC1);
+    modrm(4, destination);
+    byte(amount);
+}
+
+void Emitter::shift_right(Reg destination, std::uint8_t amount)
+{
+    rex(false, Reg::rax, destination);
+    byte(0xC1);
+    modrm(5, destination);
+    byte(amount);
+}
+
+void Emitter::bitwise_not(Reg destination)
+{
+    rex(false, Reg::rax, destination);
+    byte(0xF7);
+    modrm(2, destination);
+}
+
+void Emitter::set(Condition condition, Reg destination)
+{
+    // SETcc, then MOVZX to clear the rest of the register.
+    byte(0x0F);
+    byte(static_cast<std::uint8_t>(0x90 + value_of(condition)));
+    modrm(0, destination);
+    byte(0x0F);
+    byte(0xB6);
+    modrm(destination, destination);
+}
+
+void Emitter::compare_byte(Reg base, std::uint8_t immediate)
+{
+    rex(false, Reg::rax, base);
+    byte(0x80);
+    memory(7, base, 0);
+    byte(immediate);
+}
+
+Label Emitter::jump(Condition condition)
+{
+    byte(0x0F);
+    byte(static_cast<std::uint8_t>(0x80 + value_of(condition)));
+    word(0);
+
+    return {code_.size() - 4};
+}
+
+void Emitter::bind(Label label)
+{
+    auto const relative =
+        static_cast<std::uint32_t>(code_.size() - (label.displacement + 4));
+
+    for (auto i = std::size_t{0}; i < 4; ++i) {
+        code_[label.displacement + i] =
+            static_cast<std::uint8_t>(relative >> (8 * i));
+    }
+}
+
+void Emitter::call(Reg target)
+{
+    rex(false, Reg::rax, target);
+    byte(0xFF);
+    modrm(2, target);
+}
+
+void Emitter::push(Reg source)
+{
+    rex(false, Reg::rax, source);
+    byte(static_cast<std::uint8_t>(0x50 + low_bits(source)));
+}
+
+void Emitter::pop(Reg destination)
+{
+    rex(false, Reg::rax, destination);
+    byte(static_cast<std::uint8_t>(0x58 + low_bits(destination)));
+}
+
+void Emitter::add_rsp(std::uint8_t amount)
+{
+    rex(true, Reg::rax, Reg::rsp);
+    byte(0x83);
+    modrm(0, Reg::rsp);
+    byte(amount);
+}
+
+void Emitter::sub_rsp(std::uint8_t amount)
+{
+    rex(true, Reg::rax, Reg::rsp);
+    byte(0x83);
+    modrm(5, Reg::rsp);
+    byte(amount);
+}
+
+void Emitter::ret()
+{
+    byte(0xC3);
+}
+
+std::vector<std::uint8_t> const& Emitter::code() const
+{
+    return code_;
+}
+
+void Emitter::byte(std::uint8_t value)
+{
+    code_.push_back(value);
+}
+
+void Emitter::word(std::uint32_t value)
+{
+    for (auto i = 0; i < 4; ++i) {
+        byte(static_cast<std::uint8_t>(value >> (8 * i)));
+    }
+}
+
+// Only emitted when needed, since a bare REX prefix would change the
+// meaning of byte registers.
+void Emitter::rex(bool wide, Reg reg, Reg rm)
+{
+    auto const prefix = 0x40u | (wide ? 8u : 0u) | (extended(reg) ? 4u : 0u) |
+                        (extended(rm) ? 1u : 0u);
+
+    if (prefix != 0x40u) {
+        byte(static_cast<std::uint8_t>(prefix));
+    }
+}
+
+void Emitter::modrm(Reg reg, Reg rm)
+{
+    modrm(low_bits(reg), rm);
+}
+
+void Emitter::modrm(std::uint8_t reg, Reg rm)
+{
+    byte(static_cast<std::uint8_t>(0xC0 | reg << 3 | low_bits(rm)));
+}
+
+void Emitter::memory(Reg reg, Reg base, std::int32_t displacement)
+{
+    memory(low_bits(reg), base, displacement);
+}
+
+// Always the 32-bit displacement form. rsp and r12 as a base need a SIB
+// byte.
+void Emitter::memory(std::uint8_t reg, Reg base, std::int32_t displacement)
+{
+    byte(static_cast<std::uint8_t>(0x80 | reg << 3 | low_bits(base)));
+
+    if (low_bits(base) == 4) {
+        byte(0x24);
+    }
+
+    word(static_cast<std::uint32_t>(displacement));
+}
+
+}
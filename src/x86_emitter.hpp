@@ -0,0 +1,114 @@
+#ifndef MERCURY_X86_EMITTER_HPP
+#define MERCURY_X86_EMITTER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mercury::x86 {
+
+// General-purpose registers, numbered as in their encodings.
+enum class Reg: std::uint8_t {
+    rax,
+    rcx,
+    rdx,
+    rbx,
+    rsp,
+    rbp,
+    rsi,
+    rdi,
+    r8,
+    r9,
+    r10,
+    r11,
+    r12,
+    r13,
+    r14,
+    r15,
+};
+
+// Condition codes, numbered as in Jcc and SETcc.
+enum class Condition: std::uint8_t {
+    Overflow = 0x0,
+    Below = 0x2,
+    Equal = 0x4,
+    NotEqual = 0x5,
+    Less = 0xC,
+};
+
+// The operations sharing the 0x81 /digit encoding, numbered by their digit.
+enum class Alu: std::uint8_t {
+    Add = 0,
+    Or = 1,
+    And = 4,
+    Sub = 5,
+    Xor = 6,
+    Cmp = 7,
+};
+
+// Where a forward jump's displacement is, to be patched by bind().
+struct Label {
+    std::size_t displacement;
+};
+
+// Appends x86-64 instructions to a buffer, each one a fixed template with
+// its operands patched in. Operations are on 32 bits unless their name ends
+// in 64, and memory operands are always [base + 32-bit displacement].
+class Emitter {
+public:
+    void mov(Reg destination, Reg source);
+    void mov(Reg destination, std::uint32_t immediate);
+    void load(Reg destination, Reg base, std::int32_t displacement);
+    void store(Reg base, std::int32_t displacement, Reg source);
+    void store(Reg base, std::int32_t displacement, std::uint32_t immediate);
+
+    void mov64(Reg destination, Reg source);
+    void mov64(Reg destination, std::uint64_t immediate);
+
+    void alu(Alu operation, Reg destination, Reg source);
+    void alu(Alu operation, Reg destination, std::uint32_t immediate);
+    void alu(
+        Alu operation,
+        Reg destination,
+        Reg base,
+        std::int32_t displacement);
+
+    void shift_left(Reg destination, std::uint8_t amount);
+    void shift_right(Reg destination, std::uint8_t amount);
+    void bitwise_not(Reg destination);
+
+    // Set `destination` to 1 if `condition` holds and 0 otherwise.
+    // `destination` must be one of rax, rcx, rdx and rbx.
+    void set(Condition condition, Reg destination);
+
+    // Compare the byte at [base] with `immediate`.
+    void compare_byte(Reg base, std::uint8_t immediate);
+
+    // Jump if `condition` holds, to wherever the label gets bound.
+    Label jump(Condition condition);
+    void bind(Label label);
+
+    void call(Reg target);
+    void push(Reg source);
+    void pop(Reg destination);
+    void add_rsp(std::uint8_t amount);
+    void sub_rsp(std::uint8_t amount);
+    void ret();
+
+    std::vector<std::uint8_t> const& code() const;
+
+private:
+    void byte(std::uint8_t value);
+    void word(std::uint32_t value);
+    void rex(bool wide, Reg reg, Reg rm);
+    void modrm(Reg reg, Reg rm);
+    void modrm(std::uint8_t reg, Reg rm);
+    void memory(Reg reg, Reg base, std::int32_t displacement);
+    void memory(std::uint8_t reg, Reg base, std::int32_t displacement);
+
+    std::vector<std::uint8_t> code_;
+};
+
+}
+
+#endif